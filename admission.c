@@ -0,0 +1,314 @@
+#include "admission.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define ADMISSION_TOKEN     1000
+
+static uint64_t monotonic_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static void admission_address(const struct sockaddr_storage *_address, uint8_t *address)
+{
+    memset(address, 0, 16);
+    if(_address->ss_family == AF_INET)
+    {
+        /* ::ffff:a.b.c.d */
+        address[10] = 0xff;
+        address[11] = 0xff;
+        memcpy(&address[12], &((const struct sockaddr_in *)_address)->sin_addr, 4);
+    }
+    else if(_address->ss_family == AF_INET6)
+    {
+        memcpy(address, &((const struct sockaddr_in6 *)_address)->sin6_addr, 16);
+    }
+}
+
+uint8_t admission_init(admission_t *admission, uint32_t _host_connections_max, const char *_trusted_hosts)
+{
+    char list[ADMISSION_TRUSTED_MAX * (INET6_ADDRSTRLEN + 1)];
+    struct sockaddr_storage trusted;
+    char *name, *saveptr;
+
+    memset(admission, 0, sizeof(admission_t));
+
+    admission->tokens = ADMISSION_BURST * ADMISSION_TOKEN;
+    admission->refilled_ms = monotonic_ms();
+    admission->host_connections_max = _host_connections_max;
+
+    if(strlen(_trusted_hosts) >= sizeof(list))
+    {
+        fprintf(stderr, "Admission: trusted host list too long\n");
+        return 0;
+    }
+    strcpy(list, _trusted_hosts);
+    for(name = strtok_r(list, ", ", &saveptr); name != NULL; name = strtok_r(NULL, ", ", &saveptr))
+    {
+        memset(&trusted, 0, sizeof(trusted));
+        if(inet_pton(AF_INET, name, &((struct sockaddr_in *)&trusted)->sin_addr) == 1)
+        {
+            trusted.ss_family = AF_INET;
+        }
+        else if(inet_pton(AF_INET6, name, &((struct sockaddr_in6 *)&trusted)->sin6_addr) == 1)
+        {
+            trusted.ss_family = AF_INET6;
+        }
+        else
+        {
+            fprintf(stderr, "Admission: trusted host \"%s\" is not an IPv4 or IPv6 address\n", name);
+            return 0;
+        }
+
+        if(admission->trusted_count == ADMISSION_TRUSTED_MAX)
+        {
+            fprintf(stderr, "Admission: more than %d trusted hosts\n", ADMISSION_TRUSTED_MAX);
+            return 0;
+        }
+        admission_address(&trusted, admission->trusted[admission->trusted_count++]);
+    }
+
+    return 1;
+}
+
+/* Loopback and trusted hosts are held only to the total and the rate */
+static bool admission_exempt(const admission_t *admission, const uint8_t *address)
+{
+    static const uint8_t v4_mapped[12] = { 0,0,0,0, 0,0,0,0, 0,0,0xff,0xff };
+    static const uint8_t v6_loopback[16] = { 0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,1 };
+    uint32_t i;
+
+    if(admission->host_connections_max == 0
+        || (memcmp(address, v4_mapped, 12) == 0 && address[12] == 127)
+        || memcmp(address, v6_loopback, 16) == 0)
+    {
+        return true;
+    }
+    for(i = 0; i < admission->trusted_count; i++)
+    {
+        if(memcmp(address, admission->trusted[i], 16) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t admission_hash(const uint8_t *address)
+{
+    uint32_t hash = 2166136261u;
+    uint32_t i;
+
+    /* FNV-1a */
+    for(i = 0; i < 16; i++)
+    {
+        hash = (hash ^ address[i]) * 16777619u;
+    }
+    return hash & (ADMISSION_HOSTS - 1);
+}
+
+/* Find the host's slot, or a free one for it if _insert. Returns -1 if neither. */
+static int32_t admission_host_find(admission_t *admission, const uint8_t *address, bool _insert)
+{
+    const uint32_t home = admission_hash(address);
+    uint32_t i, j;
+    admission_host_t *host;
+
+    /* Linear probing, a chain ends at the first free slot */
+    for(i = 0; i < ADMISSION_HOSTS; i++)
+    {
+        j = (home + i) & (ADMISSION_HOSTS - 1);
+        host = &admission->hosts[j];
+        if(!host->used)
+        {
+            if(!_insert)
+            {
+                return -1;
+            }
+            memcpy(host->address, address, 16);
+            host->connections = 0;
+            host->used = true;
+            return j;
+        }
+        if(memcmp(host->address, address, 16) == 0)
+        {
+            return j;
+        }
+    }
+    return -1;
+}
+
+/* Free a slot, moving later hosts of its probe chain back into the gap so chains stay unbroken (backward shift) */
+static void admission_host_remove(admission_t *admission, uint32_t _slot)
+{
+    uint32_t gap = _slot, i, j, home;
+
+    for(i = 1, j = _slot; i < ADMISSION_HOSTS; i++)
+    {
+        j = (j + 1) & (ADMISSION_HOSTS - 1);
+        if(!admission->hosts[j].used)
+        {
+            break;
+        }
+
+        /* A host stays put if its home slot is after the gap, cyclically */
+        home = admission_hash(admission->hosts[j].address);
+        if(((j - home) & (ADMISSION_HOSTS - 1)) < ((j - gap) & (ADMISSION_HOSTS - 1)))
+        {
+            continue;
+        }
+        admission->hosts[gap] = admission->hosts[j];
+        gap = j;
+    }
+    admission->hosts[gap].used = false;
+}
+
+static admission_verdict_t admission_check(admission_t *admission, const struct sockaddr_storage *_address)
+{
+    uint8_t address[16];
+    int32_t host;
+
+    if(admission->connections >= ADMISSION_CONNECTIONS_MAX)
+    {
+        return ADMISSION_REJECT_FULL;
+    }
+
+    admission_address(_address, address);
+    if(admission_exempt(admission, address))
+    {
+        return ADMISSION_ACCEPT;
+    }
+    host = admission_host_find(admission, address, false);
+    if(host >= 0 && admission->hosts[host].connections >= admission->host_connections_max)
+    {
+        return ADMISSION_REJECT_HOST;
+    }
+
+    return ADMISSION_ACCEPT;
+}
+
+static void admission_count(admission_t *admission, admission_verdict_t verdict)
+{
+    switch(verdict)
+    {
+        case ADMISSION_ACCEPT:
+            __atomic_add_fetch(&admission->admitted, 1, __ATOMIC_RELAXED);
+            break;
+        case ADMISSION_REJECT_FULL:
+            __atomic_add_fetch(&admission->rejected_full, 1, __ATOMIC_RELAXED);
+            break;
+        case ADMISSION_REJECT_HOST:
+            __atomic_add_fetch(&admission->rejected_host, 1, __ATOMIC_RELAXED);
+            break;
+        case ADMISSION_REJECT_RATE:
+            __atomic_add_fetch(&admission->rejected_rate, 1, __ATOMIC_RELAXED);
+            break;
+    }
+}
+
+admission_verdict_t admission_connect(admission_t *admission, const struct sockaddr_storage *_address)
+{
+    admission_verdict_t verdict;
+    uint64_t now_ms, refill;
+
+    verdict = admission_check(admission, _address);
+    if(verdict == ADMISSION_ACCEPT)
+    {
+        /* ADMISSION_RATE handshakes per second is ADMISSION_RATE thousandths per ms */
+        now_ms = monotonic_ms();
+        refill = (now_ms - admission->refilled_ms) * ADMISSION_RATE;
+        if(refill > 0)
+        {
+            admission->tokens = (admission->tokens + refill > ADMISSION_BURST * ADMISSION_TOKEN)
+                ? ADMISSION_BURST * ADMISSION_TOKEN : admission->tokens + refill;
+            admission->refilled_ms = now_ms;
+        }
+
+        if(admission->tokens < ADMISSION_TOKEN)
+        {
+            verdict = ADMISSION_REJECT_RATE;
+        }
+        else
+        {
+            admission->tokens -= ADMISSION_TOKEN;
+        }
+    }
+
+    admission_count(admission, verdict);
+    return verdict;
+}
+
+admission_verdict_t admission_upgrade(admission_t *admission, const struct sockaddr_storage *_address)
+{
+    admission_verdict_t verdict;
+
+    /* Admissions were counted on connect */
+    verdict = admission_check(admission, _address);
+    if(verdict != ADMISSION_ACCEPT)
+    {
+        admission_count(admission, verdict);
+    }
+    return verdict;
+}
+
+void admission_established(admission_t *admission, const struct sockaddr_storage *_address, admission_ticket_t *ticket)
+{
+    int32_t host;
+
+    admission->connections++;
+    if(admission->connections > admission->connections_peak)
+    {
+        admission->connections_peak = admission->connections;
+    }
+
+    /* Exempt hosts are not tracked, however many websockets they hold */
+    admission_address(_address, ticket->address);
+    host = admission_exempt(admission, ticket->address) ? -1 : admission_host_find(admission, ticket->address, true);
+    ticket->tracked = (host >= 0);
+    if(host >= 0)
+    {
+        admission->hosts[host].connections++;
+    }
+}
+
+void admission_closed(admission_t *admission, const admission_ticket_t *ticket)
+{
+    int32_t host;
+
+    if(admission->connections > 0)
+    {
+        admission->connections--;
+    }
+
+    /* Looked up again, as freeing other hosts may have moved its slot */
+    if(!ticket->tracked || (host = admission_host_find(admission, ticket->address, false)) < 0)
+    {
+        return;
+    }
+    if(--admission->hosts[host].connections == 0)
+    {
+        admission_host_remove(admission, host);
+    }
+}
+
+void admission_print_stats(admission_t *admission)
+{
+    fprintf(stdout, "Admission: %"PRIu32" open (peak %"PRIu32"), %"PRIu64" admitted, %"PRIu64" rejected (%"PRIu64" rate, %"PRIu64" host, %"PRIu64" full)\n",
+        __atomic_load_n(&admission->connections, __ATOMIC_RELAXED),
+        __atomic_load_n(&admission->connections_peak, __ATOMIC_RELAXED),
+        __atomic_load_n(&admission->admitted, __ATOMIC_RELAXED),
+        __atomic_load_n(&admission->rejected_rate, __ATOMIC_RELAXED)
+            + __atomic_load_n(&admission->rejected_host, __ATOMIC_RELAXED)
+            + __atomic_load_n(&admission->rejected_full, __ATOMIC_RELAXED),
+        __atomic_load_n(&admission->rejected_rate, __ATOMIC_RELAXED),
+        __atomic_load_n(&admission->rejected_host, __ATOMIC_RELAXED),
+        __atomic_load_n(&admission->rejected_full, __ATOMIC_RELAXED));
+}
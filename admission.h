@@ -0,0 +1,99 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+
+/* Websocket connection admission control
+ *
+ * After a restart every viewer reconnects at once, and their handshakes compete with frame delivery
+ *  on the one websocket service thread. Each new TCP connection is checked before lws allocates
+ *  anything for it (LWS_CALLBACK_FILTER_NETWORK_CONNECTION), and rejected if:
+ *
+ *  - ADMISSION_CONNECTIONS_MAX websockets are already open
+ *  - its host already has the per-host limit open (ADMISSION_HOST_CONNECTIONS_MAX in main.c, 0 for none)
+ *  - the handshake rate is over ADMISSION_RATE per second, with bursts of up to ADMISSION_BURST
+ *
+ * The limits are checked again on the upgrade to a protocol. Open connections are only counted
+ *  once established, so a host may briefly pass its limit by the handshakes it has in flight, of
+ *  which the rate limit allows few. Rejected browsers retry on their own.
+ *
+ * Hosts are told apart by the TCP peer address, so every viewer behind a reverse proxy (eg. for TLS),
+ *  a NAT or a relay shares one. Loopback and the trusted hosts (ADMISSION_TRUSTED_HOSTS in main.c, a
+ *  list of addresses such as "192.0.2.10,2001:db8::10") are exempt from the per-host limit, and held
+ *  only to the total and the rate. Behind a proxy on another machine, list its address; for a relay
+ *  that serves a club, list the relay's.
+ *
+ * All calls are from the websocket service thread, the counters are read by admission_print_stats().
+ */
+
+#define ADMISSION_RATE                  20
+#define ADMISSION_BURST                 40
+#define ADMISSION_CONNECTIONS_MAX       2000
+#define ADMISSION_TRUSTED_MAX           16
+
+/* Hosts tracked, a power of 2 comfortably above ADMISSION_CONNECTIONS_MAX. Only hosts with open
+ *  websockets hold a slot, so the table stays under half full and lookups short. */
+#define ADMISSION_HOSTS                 4096
+
+typedef enum {
+    ADMISSION_ACCEPT = 0,
+    ADMISSION_REJECT_FULL,
+    ADMISSION_REJECT_HOST,
+    ADMISSION_REJECT_RATE
+} admission_verdict_t;
+
+typedef struct {
+    /* IPv6, or IPv4 mapped into it */
+    uint8_t address[16];
+    uint32_t connections;
+    /* Freed when the host's last websocket closes, see admission_closed() */
+    bool used;
+} admission_host_t;
+
+/* An established websocket's host, kept by its session for admission_closed() */
+typedef struct {
+    uint8_t address[16];
+    bool tracked;
+} admission_ticket_t;
+
+typedef struct {
+    /* Token bucket, in thousandths of a handshake */
+    uint32_t tokens;
+    uint64_t refilled_ms;
+
+    uint32_t connections;
+    uint32_t connections_peak;
+    admission_host_t hosts[ADMISSION_HOSTS];
+
+    /* 0 for no per-host limit */
+    uint32_t host_connections_max;
+    uint8_t trusted[ADMISSION_TRUSTED_MAX][16];
+    uint32_t trusted_count;
+
+    uint64_t admitted;
+    uint64_t rejected_full;
+    uint64_t rejected_host;
+    uint64_t rejected_rate;
+} admission_t;
+
+/* _host_connections_max open websockets per host, 0 for no limit, and _trusted_hosts a comma-separated
+ *  list of addresses exempt from it ("" for none). Returns 1 on success, 0 if an address is invalid. */
+uint8_t admission_init(admission_t *admission, uint32_t _host_connections_max, const char *_trusted_hosts);
+
+/* Check a new TCP connection from _address, taking a handshake from the bucket if accepted */
+admission_verdict_t admission_connect(admission_t *admission, const struct sockaddr_storage *_address);
+
+/* Check the limits again on a protocol upgrade, without taking from the bucket */
+admission_verdict_t admission_upgrade(admission_t *admission, const struct sockaddr_storage *_address);
+
+/* Count an established websocket, filling in *ticket for admission_closed() */
+void admission_established(admission_t *admission, const struct sockaddr_storage *_address, admission_ticket_t *ticket);
+
+/* Release an established websocket, with the ticket admission_established() gave it */
+void admission_closed(admission_t *admission, const admission_ticket_t *ticket);
+
+void admission_print_stats(admission_t *admission);
+
+#endif /* ADMISSION_H */
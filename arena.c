@@ -0,0 +1,118 @@
+#include "arena.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+uint8_t arena_init(arena_t *arena, size_t _size, bool _huge_pages)
+{
+    void *ptr = MAP_FAILED;
+    uintptr_t base;
+
+    memset(arena, 0, sizeof(arena_t));
+
+    /* Round up to whole huge pages so the mapping can be fully backed by them */
+    _size = (_size + ARENA_HUGE_PAGE - 1) & ~((size_t)ARENA_HUGE_PAGE - 1);
+
+    if(_huge_pages)
+    {
+        /* hugetlbfs pages are reserved at mmap() time, so this fails cleanly if the pool is too small */
+        ptr = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(ptr != MAP_FAILED)
+        {
+            arena->pages = ARENA_PAGES_HUGETLB;
+        }
+    }
+
+    if(ptr == MAP_FAILED)
+    {
+        /* Over-map by one huge page so the base can be aligned for transparent huge pages */
+        ptr = mmap(NULL, _size + ARENA_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(ptr == MAP_FAILED)
+        {
+            printf("arena mmap() failed: %s\n", strerror(errno));
+            return 0;
+        }
+
+        base = ((uintptr_t)ptr + ARENA_HUGE_PAGE - 1) & ~((uintptr_t)ARENA_HUGE_PAGE - 1);
+        if(base > (uintptr_t)ptr)
+        {
+            munmap(ptr, base - (uintptr_t)ptr);
+        }
+        munmap((void *)(base + _size), ((uintptr_t)ptr + _size + ARENA_HUGE_PAGE) - (base + _size));
+        ptr = (void *)base;
+
+        arena->pages = ARENA_PAGES_NORMAL;
+        if(_huge_pages && madvise(ptr, _size, MADV_HUGEPAGE) == 0)
+        {
+            arena->pages = ARENA_PAGES_TRANSPARENT_HUGE;
+        }
+    }
+
+    arena->base = ptr;
+    arena->size = _size;
+    arena->used = 0;
+    arena->sealed = false;
+
+    return 1;
+}
+
+void *arena_alloc(arena_t *arena, size_t _size, size_t _alignment)
+{
+    size_t offset;
+
+    if(arena->sealed)
+    {
+        printf("arena_alloc(%zu) after startup refused\n", _size);
+        return NULL;
+    }
+
+    if(_alignment < ARENA_CACHE_LINE)
+    {
+        _alignment = ARENA_CACHE_LINE;
+    }
+    offset = (arena->used + _alignment - 1) & ~(_alignment - 1);
+    /* Pad to a whole cache line so the next allocation never shares one */
+    _size = (_size + ARENA_CACHE_LINE - 1) & ~((size_t)ARENA_CACHE_LINE - 1);
+
+    if(offset + _size > arena->size)
+    {
+        printf("arena exhausted allocating %zu bytes (%zu of %zu used), increase ARENA_SIZE\n", _size, arena->used, arena->size);
+        return NULL;
+    }
+    arena->used = offset + _size;
+
+    /* Fresh anonymous pages are already zero */
+    return arena->base + offset;
+}
+
+void arena_seal(arena_t *arena)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t i;
+    const char *pages_name[] = {
+        [ARENA_PAGES_NORMAL] = "normal pages",
+        [ARENA_PAGES_TRANSPARENT_HUGE] = "transparent huge pages",
+        [ARENA_PAGES_HUGETLB] = "hugetlbfs pages"
+    };
+
+    /* Write to every page in use, contents are unchanged */
+    for(i = 0; i < arena->used; i += page_size)
+    {
+        ((volatile uint8_t *)arena->base)[i] = ((volatile uint8_t *)arena->base)[i];
+    }
+    arena->sealed = true;
+
+    printf("Arena: %zu KiB used of %zu MiB, %s\n", arena->used / 1024, arena->size / (1024*1024), pages_name[arena->pages]);
+}
+
+void arena_free(arena_t *arena)
+{
+    if(arena->base != NULL)
+    {
+        munmap(arena->base, arena->size);
+        arena->base = NULL;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Startup arena allocator
+ *
+ * All pipeline buffers are carved out of one mapping at startup, after which the arena is sealed:
+ * every page in use is faulted in, and any further allocation fails. Allocations are rounded up to
+ * whole cache lines so that no two buffers (or a buffer and its neighbour's lock) share a line.
+ * The mapping can optionally be backed by 2MB huge pages to cut TLB misses on the large buffers.
+ */
+
+#define ARENA_CACHE_LINE    64
+#define ARENA_HUGE_PAGE     (2*1024*1024)
+
+#define CACHE_LINE_ALIGNED  __attribute__((aligned(ARENA_CACHE_LINE)))
+
+typedef enum {
+    ARENA_PAGES_NORMAL = 0,
+    ARENA_PAGES_TRANSPARENT_HUGE,
+    ARENA_PAGES_HUGETLB
+} arena_pages_t;
+
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    arena_pages_t pages;
+    bool sealed;
+} arena_t;
+
+/* Map _size bytes. With _huge_pages, hugetlbfs pages are tried first, then transparent huge pages. Returns 1 on success. */
+uint8_t arena_init(arena_t *arena, size_t _size, bool _huge_pages);
+
+/* Zeroed allocation of at least _size bytes, aligned to _alignment (a power of two, at least a cache line).
+ * Returns NULL if the arena is exhausted or sealed. */
+void *arena_alloc(arena_t *arena, size_t _size, size_t _alignment);
+
+/* Fault in all allocated pages, print usage and refuse any further allocation */
+void arena_seal(arena_t *arena);
+
+void arena_free(arena_t *arena);
+
+#endif /* ARENA_H */
@@ -0,0 +1,323 @@
+#include "capture.h"
+
+#define CAPTURE_PATH_LENGTH     256
+
+uint32_t capture_ring_blocks(uint32_t _seconds, uint32_t _sample_rate, uint32_t _block_samples, uint32_t _min_blocks)
+{
+    uint64_t pre_blocks = (((uint64_t)_seconds * _sample_rate) + _block_samples - 1) / _block_samples;
+    uint64_t blocks = pre_blocks + ((pre_blocks * CAPTURE_HEADROOM_PERCENT) / 100) + _min_blocks;
+    uint32_t count = _min_blocks;
+
+    while(count < blocks)
+    {
+        count *= 2;
+    }
+    return count;
+}
+
+uint8_t capture_init(capture_t *capture, iq_ring_t *ring, const char *_name, uint32_t _seconds, uint32_t _post_seconds, uint32_t _sample_rate)
+{
+    const uint32_t block_samples = ring->block_samples;
+
+    memset(capture, 0, sizeof(capture_t));
+    capture->name = _name;
+    capture->ring = ring;
+    capture->pre_blocks = (((uint64_t)_seconds * _sample_rate) + block_samples - 1) / block_samples;
+    capture->post_blocks = (((uint64_t)_post_seconds * _sample_rate) + block_samples - 1) / block_samples;
+    pthread_mutex_init(&capture->mutex, NULL);
+    pthread_cond_init(&capture->signal, NULL);
+
+    if(capture->pre_blocks + ((capture->pre_blocks * CAPTURE_HEADROOM_PERCENT) / 100) >= ring->block_count)
+    {
+        printf("%s: IQ ring of %d blocks is too short for %ds of capture\n", _name, ring->block_count, _seconds);
+        return 0;
+    }
+
+    if(mkdir(CAPTURE_DIRECTORY, 0755) != 0 && errno != EEXIST)
+    {
+        printf("%s: creating %s failed: %s\n", _name, CAPTURE_DIRECTORY, strerror(errno));
+        return 0;
+    }
+
+    return 1;
+}
+
+bool capture_trigger(capture_t *capture, uint32_t _epoch, uint32_t _freq_hz, uint32_t _sample_rate, const char *_reason)
+{
+    capture_request_t *request = &capture->request;
+
+    pthread_mutex_lock(&capture->mutex);
+    if(capture->running)
+    {
+        pthread_mutex_unlock(&capture->mutex);
+        __atomic_add_fetch(&capture->triggers_ignored, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    request->sequence = iq_ring_head(capture->ring);
+    request->epoch = _epoch;
+    request->freq_hz = _freq_hz;
+    request->sample_rate = _sample_rate;
+    clock_gettime(CLOCK_REALTIME, &request->timestamp);
+    snprintf(request->reason, sizeof(request->reason), "%s", _reason);
+
+    capture->running = true;
+    pthread_cond_signal(&capture->signal);
+    pthread_mutex_unlock(&capture->mutex);
+
+    return true;
+}
+
+/* ISO 8601 UTC, as SigMF's core:datetime */
+static void capture_datetime(const struct timespec *ts, char *buffer, size_t buffer_size)
+{
+    struct tm tm;
+
+    gmtime_r(&ts->tv_sec, &tm);
+    snprintf(buffer, buffer_size, "%04d-%02d-%02dT%02d:%02d:%02d.%09ldZ",
+        tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, ts->tv_nsec);
+}
+
+static bool capture_write(int fd, const uint8_t *data, size_t _length, off_t _offset)
+{
+    ssize_t n;
+
+    while(_length > 0)
+    {
+        n = pwrite(fd, data, _length, _offset);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        _length -= n;
+        _offset += n;
+    }
+    return true;
+}
+
+static uint8_t capture_meta_write(capture_t *capture, const capture_request_t *request, const char *_path,
+    bool _triggered, uint64_t _trigger_sample)
+{
+    const capture_segment_t *segment;
+    char datetime[48];
+    FILE *f;
+    uint32_t i;
+
+    f = fopen(_path, "w");
+    if(f == NULL)
+    {
+        return 0;
+    }
+
+    fprintf(f, "{\n  \"global\": {\n");
+    fprintf(f, "    \"core:datatype\": \"%s\",\n", capture->ring->sample_format == IQ_SAMPLE_INT16 ? "ci16_le" : "cf32_le");
+    fprintf(f, "    \"core:sample_rate\": %"PRIu32",\n", request->sample_rate);
+    fprintf(f, "    \"core:version\": \"1.0.0\",\n");
+    fprintf(f, "    \"core:hw\": \"AirSpy\",\n");
+    fprintf(f, "    \"core:recorder\": \"airspy_fft_ws\",\n");
+    fprintf(f, "    \"core:description\": \"%s\"\n", capture->name);
+    fprintf(f, "  },\n  \"captures\": [\n");
+    for(i = 0; i < capture->segment_count; i++)
+    {
+        segment = &capture->segments[i];
+        capture_datetime(&segment->timestamp, datetime, sizeof(datetime));
+        fprintf(f, "    {\"core:sample_start\": %"PRIu64", \"core:global_index\": %"PRIu64", \"core:frequency\": %"PRIu32", \"core:datetime\": \"%s\"}%s\n",
+            segment->sample_start, segment->sample_index, request->freq_hz, datetime, i + 1 < capture->segment_count ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"annotations\": [\n");
+    if(_triggered)
+    {
+        fprintf(f, "    {\"core:sample_start\": %"PRIu64", \"core:label\": \"trigger\", \"core:comment\": \"%s\"}\n",
+            _trigger_sample, request->reason);
+    }
+    fprintf(f, "  ]\n}\n");
+
+    return fclose(f) == 0;
+}
+
+/* Write the blocks of one capture, from the pre-trigger to the end of the post-trigger */
+static void capture_record(capture_t *capture, const capture_request_t *request)
+{
+    iq_ring_t *ring = capture->ring;
+    const iq_block_t *block;
+    char base[CAPTURE_PATH_LENGTH], path[CAPTURE_PATH_LENGTH + 16];
+    struct tm tm;
+    uint64_t sequence, end, lost = 0, samples = 0, next_index = 0, trigger_sample = 0;
+    size_t bytes;
+    off_t offset = 0;
+    bool direct = true, triggered = false;
+    int fd, flags;
+
+    gmtime_r(&request->timestamp.tv_sec, &tm);
+    snprintf(base, sizeof(base), "%s/%s-%04d%02d%02dT%02d%02d%02dZ", CAPTURE_DIRECTORY, capture->name,
+        tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+
+    /* Straight from the ring to the disk, through the page cache only if O_DIRECT isn't supported here */
+    snprintf(path, sizeof(path), "%s.sigmf-data", base);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if(fd < 0 && errno == EINVAL)
+    {
+        direct = false;
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if(fd < 0)
+    {
+        fprintf(stderr, "Capture %s: opening %s failed: %s\n", capture->name, path, strerror(errno));
+        return;
+    }
+
+    /* Reserve the whole recording up front for sequential extents, it is trimmed to what was written */
+    bytes = (size_t)ring->sample_bytes * 2 * ring->block_samples;
+    fallocate(fd, 0, 0, (off_t)bytes * (capture->pre_blocks + capture->post_blocks));
+
+    capture->segment_count = 0;
+    sequence = request->sequence > capture->pre_blocks ? request->sequence - capture->pre_blocks : 0;
+    end = request->sequence + capture->post_blocks;
+
+    while(sequence < end)
+    {
+        block = iq_ring_read(ring, &sequence, &lost);
+        if(sequence >= end)
+        {
+            break;
+        }
+
+        /* Pre-trigger from an earlier tuning is skipped, a retune after the trigger ends the capture */
+        if(block->epoch != request->epoch)
+        {
+            if(sequence < request->sequence)
+            {
+                sequence++;
+                continue;
+            }
+            break;
+        }
+
+        /* A gap starts a new capture segment */
+        if(capture->segment_count == 0 || block->sample_index != next_index)
+        {
+            if(capture->segment_count == CAPTURE_SEGMENTS_MAX)
+            {
+                break;
+            }
+            capture->segments[capture->segment_count].sample_start = samples;
+            capture->segments[capture->segment_count].sample_index = block->sample_index;
+            capture->segments[capture->segment_count].timestamp = block->timestamp;
+        }
+
+        bytes = (size_t)ring->sample_bytes * 2 * block->sample_count;
+        if(direct && (bytes % CAPTURE_DIRECT_ALIGN) != 0)
+        {
+            flags = fcntl(fd, F_GETFL);
+            fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+            direct = false;
+        }
+        if(!capture_write(fd, block->samples, bytes, offset))
+        {
+            fprintf(stderr, "Capture %s: writing %s failed: %s\n", capture->name, path, strerror(errno));
+            break;
+        }
+
+        /* Overwritten while being written, it is written over by the next block */
+        if(!iq_ring_valid(ring, sequence))
+        {
+            lost++;
+            sequence++;
+            continue;
+        }
+
+        if(capture->segment_count == 0 || block->sample_index != next_index)
+        {
+            capture->segment_count++;
+        }
+        if(!triggered && sequence >= request->sequence)
+        {
+            triggered = true;
+            trigger_sample = samples;
+        }
+        offset += bytes;
+        samples += block->sample_count;
+        next_index = block->sample_index + block->sample_count;
+        __atomic_add_fetch(&capture->blocks_written, 1, __ATOMIC_RELAXED);
+        sequence++;
+    }
+
+    __atomic_add_fetch(&capture->blocks_lost, lost, __ATOMIC_RELAXED);
+    if(ftruncate(fd, offset) != 0 || close(fd) != 0)
+    {
+        fprintf(stderr, "Capture %s: closing %s failed: %s\n", capture->name, path, strerror(errno));
+    }
+
+    if(samples == 0)
+    {
+        unlink(path);
+        fprintf(stdout, "Capture %s: nothing recorded (%s)\n", capture->name, request->reason);
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s.sigmf-meta", base);
+    if(!capture_meta_write(capture, request, path, triggered, trigger_sample))
+    {
+        fprintf(stderr, "Capture %s: writing %s failed\n", capture->name, path);
+    }
+
+    __atomic_add_fetch(&capture->captures, 1, __ATOMIC_RELAXED);
+    fprintf(stdout, "Capture %s: %s, %.2fs from %.2fs before the trigger (%s), %"PRIu64" blocks lost\n", capture->name, base,
+        (double)samples / request->sample_rate, (double)trigger_sample / request->sample_rate, request->reason, lost);
+}
+
+/* Capture Thread */
+static void *thread_capture(void *arg)
+{
+    capture_t *capture = (capture_t *)arg;
+    capture_request_t request;
+
+    while(1)
+    {
+        /* Wait for a trigger */
+        pthread_mutex_lock(&capture->mutex);
+        while(!capture->running)
+        {
+            pthread_cond_wait(&capture->signal, &capture->mutex);
+        }
+        request = capture->request;
+        pthread_mutex_unlock(&capture->mutex);
+
+        capture_record(capture, &request);
+
+        pthread_mutex_lock(&capture->mutex);
+        capture->running = false;
+        pthread_mutex_unlock(&capture->mutex);
+    }
+
+    return NULL;
+}
+
+uint8_t capture_start(capture_t *capture)
+{
+    if(pthread_create(&capture->thread, NULL, thread_capture, capture))
+    {
+        return 0;
+    }
+    return 1;
+}
+
+void capture_print_stats(capture_t *capture)
+{
+    bool running;
+
+    pthread_mutex_lock(&capture->mutex);
+    running = capture->running;
+    pthread_mutex_unlock(&capture->mutex);
+
+    fprintf(stdout, "Capture %s: %"PRIu64" recorded%s, %"PRIu64" triggers ignored, %"PRIu64" blocks written, %"PRIu64" lost\n",
+        capture->name, __atomic_load_n(&capture->captures, __ATOMIC_RELAXED), running ? " (recording)" : "",
+        __atomic_load_n(&capture->triggers_ignored, __ATOMIC_RELAXED),
+        __atomic_load_n(&capture->blocks_written, __ATOMIC_RELAXED),
+        __atomic_load_n(&capture->blocks_lost, __ATOMIC_RELAXED));
+}
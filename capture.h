@@ -0,0 +1,95 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "main.h"
+#include <stdbool.h>
+
+#include "iq_ring.h"
+
+/* IQ capture to disk, with a pre-trigger buffer
+ *
+ * A pipeline with .capture_seconds set sizes its IQ ring (see capture_ring_blocks()) to hold that much
+ *  IQ behind the newest block, so the moments before a trigger are still in memory. On a trigger the
+ *  capture thread, one more consumer of the ring, writes from capture_seconds before it to
+ *  capture_post_seconds after it straight out of the ring's page-aligned blocks: whole blocks per
+ *  write, with O_DIRECT where the filesystem takes it, and no copies. The ring producer never waits
+ *  on a consumer, so neither the AirSpy callback nor the FFT thread ever waits on the disk.
+ *
+ * Each capture is a SigMF recording in CAPTURE_DIRECTORY:
+ *
+ *   <name>-<UTC time>.sigmf-data   the samples as the ring holds them, cf32_le (or ci16_le fixed-point)
+ *   <name>-<UTC time>.sigmf-meta   sample rate and frequency, a capture segment from each gap in the
+ *                                  samples, and the trigger as an annotation with its reason
+ *
+ * A capture covers one tuning: the pre-trigger starts after any retune before the trigger, and a retune
+ *  after it ends the capture. The disk must keep up with the IQ (80MB/s at 10MSPS float): blocks it
+ *  loses to the ring overtaking it leave a gap, recorded as a new capture segment.
+ *
+ * Triggers come from the main thread, an operator's request on the control protocol or a new carrier
+ *  (see pipeline.h). One capture runs at a time, triggers during it are counted and ignored.
+ */
+
+#define CAPTURE_DIRECTORY           "captures"
+/* Ring blocks beyond the pre-trigger, as a percentage of it, for the disk to fall behind by */
+#define CAPTURE_HEADROOM_PERCENT    25
+/* O_DIRECT writes must be multiples of the device's logical block size, at most this */
+#define CAPTURE_DIRECT_ALIGN        4096
+/* Capture segments in the metadata, the capture ends at a gap past this many */
+#define CAPTURE_SEGMENTS_MAX        64
+#define CAPTURE_REASON_LENGTH       64
+
+typedef struct {
+    /* Ring sequence of the first block after the trigger */
+    uint64_t sequence;
+    uint32_t epoch;
+    uint32_t freq_hz;
+    uint32_t sample_rate;
+    struct timespec timestamp;
+    char reason[CAPTURE_REASON_LENGTH];
+} capture_request_t;
+
+typedef struct {
+    /* Sample of the recording it starts at, and that sample's index in the ring */
+    uint64_t sample_start;
+    uint64_t sample_index;
+    struct timespec timestamp;
+} capture_segment_t;
+
+typedef struct {
+    const char *name;
+    iq_ring_t *ring;
+    uint32_t pre_blocks;
+    uint32_t post_blocks;
+
+    /* Trigger from the main thread, running until the capture thread has finished it */
+    pthread_mutex_t mutex;
+    pthread_cond_t signal;
+    bool running;
+    capture_request_t request;
+
+    /* Capture thread */
+    pthread_t thread;
+    capture_segment_t segments[CAPTURE_SEGMENTS_MAX];
+    uint32_t segment_count;
+
+    uint64_t captures;
+    uint64_t triggers_ignored;
+    uint64_t blocks_written;
+    uint64_t blocks_lost;
+} capture_t;
+
+/* Ring blocks (a power of two, at least _min_blocks) to hold _seconds of IQ ahead of a trigger, plus headroom */
+uint32_t capture_ring_blocks(uint32_t _seconds, uint32_t _sample_rate, uint32_t _block_samples, uint32_t _min_blocks);
+
+/* Set up capture from a ring sized by capture_ring_blocks(), and create CAPTURE_DIRECTORY. Returns 1 on success. */
+uint8_t capture_init(capture_t *capture, iq_ring_t *ring, const char *_name, uint32_t _seconds, uint32_t _post_seconds, uint32_t _sample_rate);
+
+/* Start the capture thread. Returns 1 on success. */
+uint8_t capture_start(capture_t *capture);
+
+/* Main thread: capture around the next block, at the tuning given. Returns false if a capture is already running. */
+bool capture_trigger(capture_t *capture, uint32_t _epoch, uint32_t _freq_hz, uint32_t _sample_rate, const char *_reason);
+
+void capture_print_stats(capture_t *capture);
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,295 @@
+#include "carrier_detect.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <math.h>
+
+typedef struct {
+    double freq_hz;
+    double bandwidth_hz;
+    float snr_db;
+} carrier_detection_t;
+
+void carrier_detector_init(carrier_detector_t *cd, float units_per_db)
+{
+    memset(cd, 0, sizeof(carrier_detector_t));
+    cd->units_per_db = units_per_db;
+    cd->next_id = 1;
+    /* Publish the (empty) list on the first frame */
+    cd->changed = true;
+}
+
+void carrier_detector_reset(carrier_detector_t *cd)
+{
+    memset(cd->carriers, 0, sizeof(cd->carriers));
+    cd->carrier_count = 0;
+    cd->changed = true;
+}
+
+/* Measure a segment at its -3dB points */
+static void carrier_measure(const carrier_detector_t *cd, const uint16_t *frame, uint32_t length,
+    uint32_t start, uint32_t end, uint16_t floor_level, double _bin0_hz, double _bin_hz, carrier_detection_t *detection)
+{
+    uint32_t i, a, b;
+    uint16_t peak;
+    float level3;
+    double lower, upper, width;
+    uint64_t sum;
+
+    peak = 0;
+    for(i = start; i <= end; i++)
+    {
+        if(frame[i] > peak)
+        {
+            peak = frame[i];
+        }
+    }
+    level3 = (float)peak - (3.0f * cd->units_per_db);
+
+    a = start;
+    while(a < end && frame[a] < level3)
+    {
+        a++;
+    }
+    b = end;
+    while(b > a && frame[b] < level3)
+    {
+        b--;
+    }
+
+    /* Interpolate the edges between bins */
+    lower = a;
+    if(a > 0 && frame[a-1] < level3 && frame[a] > frame[a-1])
+    {
+        lower = (a - 1) + ((level3 - frame[a-1]) / (double)(frame[a] - frame[a-1]));
+    }
+    upper = b;
+    if(b + 1 < length && frame[b+1] < level3 && frame[b] > frame[b+1])
+    {
+        upper = (b + 1) - ((level3 - frame[b+1]) / (double)(frame[b] - frame[b+1]));
+    }
+    width = upper - lower;
+    if(width < 1.0)
+    {
+        width = 1.0;
+    }
+
+    sum = 0;
+    for(i = a; i <= b; i++)
+    {
+        sum += frame[i];
+    }
+
+    detection->freq_hz = _bin0_hz + (((lower + upper) / 2.0) * _bin_hz);
+    detection->bandwidth_hz = width * _bin_hz;
+    detection->snr_db = (((float)sum / (b - a + 1)) - floor_level) / cd->units_per_db;
+}
+
+static void carrier_remove(carrier_detector_t *cd, uint32_t index)
+{
+    if(cd->carriers[index].reported)
+    {
+        cd->changed = true;
+    }
+    cd->carrier_count--;
+    cd->carriers[index] = cd->carriers[cd->carrier_count];
+}
+
+bool carrier_detector_process(carrier_detector_t *cd, const uint16_t *frame, uint32_t length, uint16_t floor_level, double _bin0_hz, double _bin_hz)
+{
+    carrier_detection_t detections[CARRIER_MAX];
+    uint32_t detection_count;
+    uint32_t i, j, start, end, gap;
+    float threshold;
+    carrier_t *carrier, *best;
+    double tolerance, delta, best_delta;
+    bool changed;
+
+    /* Segment bins above threshold */
+    threshold = floor_level + (CARRIER_THRESHOLD_DB * cd->units_per_db);
+    detection_count = 0;
+    i = 0;
+    while(i < length && detection_count < CARRIER_MAX)
+    {
+        if(frame[i] <= threshold)
+        {
+            i++;
+            continue;
+        }
+
+        start = i;
+        end = i;
+        gap = 0;
+        for(j = i + 1; j < length; j++)
+        {
+            if(frame[j] > threshold)
+            {
+                end = j;
+                gap = 0;
+            }
+            else if(++gap > CARRIER_MERGE_GAP_BINS)
+            {
+                break;
+            }
+        }
+        i = end + 1;
+
+        if((end - start + 1) >= CARRIER_MIN_BINS)
+        {
+            carrier_measure(cd, frame, length, start, end, floor_level, _bin0_hz, _bin_hz, &detections[detection_count]);
+            detection_count++;
+        }
+    }
+
+    /* Match detections to tracked carriers, nearest first */
+    for(i = 0; i < cd->carrier_count; i++)
+    {
+        cd->carriers[i].matched = false;
+    }
+    for(j = 0; j < detection_count; j++)
+    {
+        best = NULL;
+        best_delta = 0;
+        for(i = 0; i < cd->carrier_count; i++)
+        {
+            carrier = &cd->carriers[i];
+            if(carrier->matched)
+            {
+                continue;
+            }
+            tolerance = (fmax(carrier->bandwidth_hz, detections[j].bandwidth_hz) / 4.0) + _bin_hz;
+            delta = fabs(carrier->freq_hz - detections[j].freq_hz);
+            if(delta < tolerance && (best == NULL || delta < best_delta))
+            {
+                best = carrier;
+                best_delta = delta;
+            }
+        }
+
+        if(best != NULL)
+        {
+            best->freq_hz = (best->freq_hz + detections[j].freq_hz) / 2.0;
+            best->bandwidth_hz = (best->bandwidth_hz + detections[j].bandwidth_hz) / 2.0;
+            best->snr_db = (best->snr_db + detections[j].snr_db) / 2.0f;
+            if(best->seen < CARRIER_CONFIRM_FRAMES)
+            {
+                best->seen++;
+            }
+            best->missed = 0;
+            best->matched = true;
+        }
+        else if(cd->carrier_count < CARRIER_MAX)
+        {
+            carrier = &cd->carriers[cd->carrier_count++];
+            memset(carrier, 0, sizeof(carrier_t));
+            carrier->id = cd->next_id++;
+            carrier->freq_hz = detections[j].freq_hz;
+            carrier->bandwidth_hz = detections[j].bandwidth_hz;
+            carrier->snr_db = detections[j].snr_db;
+            carrier->seen = 1;
+            carrier->matched = true;
+        }
+    }
+
+    /* Age out carriers that have gone */
+    i = 0;
+    while(i < cd->carrier_count)
+    {
+        carrier = &cd->carriers[i];
+        if(!carrier->matched && ++carrier->missed > CARRIER_HOLD_FRAMES)
+        {
+            carrier_remove(cd, i);
+            continue;
+        }
+        i++;
+    }
+
+    /* Check whether any confirmed carrier differs from what was last reported */
+    for(i = 0; i < cd->carrier_count; i++)
+    {
+        carrier = &cd->carriers[i];
+        if(carrier->seen < CARRIER_CONFIRM_FRAMES)
+        {
+            continue;
+        }
+        if(!carrier->reported
+            || fabs(carrier->freq_hz - carrier->reported_freq_hz) > _bin_hz
+            || fabs(carrier->bandwidth_hz - carrier->reported_bandwidth_hz) > (CARRIER_REPORT_BW_BINS * _bin_hz)
+            || fabsf(carrier->snr_db - carrier->reported_snr_db) > CARRIER_REPORT_SNR_DB)
+        {
+            cd->changed = true;
+        }
+    }
+
+    changed = cd->changed;
+    if(changed)
+    {
+        for(i = 0; i < cd->carrier_count; i++)
+        {
+            carrier = &cd->carriers[i];
+            if(carrier->seen >= CARRIER_CONFIRM_FRAMES)
+            {
+                if(!carrier->reported)
+                {
+                    cd->appeared++;
+                    cd->appeared_freq_hz = carrier->freq_hz;
+                }
+                carrier->reported = true;
+                carrier->reported_freq_hz = carrier->freq_hz;
+                carrier->reported_bandwidth_hz = carrier->bandwidth_hz;
+                carrier->reported_snr_db = carrier->snr_db;
+            }
+        }
+        cd->changed = false;
+    }
+
+    return changed;
+}
+
+int32_t carrier_detector_json(const carrier_detector_t *cd, char *buffer, size_t buffer_size, uint32_t sequence)
+{
+    const carrier_t *carrier;
+    uint32_t i;
+    size_t length;
+    int n;
+    bool first = true;
+
+    n = snprintf(buffer, buffer_size, "{\"seq\":%"PRIu32",\"carriers\":[", sequence);
+    if(n < 0 || (size_t)n >= buffer_size)
+    {
+        return -1;
+    }
+    length = n;
+
+    for(i = 0; i < cd->carrier_count; i++)
+    {
+        carrier = &cd->carriers[i];
+        if(!carrier->reported)
+        {
+            continue;
+        }
+        n = snprintf(&buffer[length], buffer_size - length, "%s{\"id\":%"PRIu32",\"freq\":%.0f,\"bw\":%.0f,\"snr\":%.1f}",
+            first ? "" : ",",
+            carrier->id,
+            carrier->reported_freq_hz,
+            carrier->reported_bandwidth_hz,
+            carrier->reported_snr_db
+        );
+        if(n < 0 || (size_t)n >= buffer_size - length)
+        {
+            return -1;
+        }
+        length += n;
+        first = false;
+    }
+
+    n = snprintf(&buffer[length], buffer_size - length, "]}");
+    if(n < 0 || (size_t)n >= buffer_size - length)
+    {
+        return -1;
+    }
+    length += n;
+
+    return length;
+}
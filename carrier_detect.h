@@ -0,0 +1,72 @@
+#ifndef CARRIER_DETECT_H
+#define CARRIER_DETECT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Carrier detector
+ *
+ * Runs on each packed output frame: bins above the noise floor by CARRIER_THRESHOLD_DB are
+ * grouped into segments, each segment is measured at its -3dB points for centre frequency,
+ * bandwidth and SNR, and segments are matched against the carriers seen in previous frames.
+ * A carrier is only reported once it has been seen for CARRIER_CONFIRM_FRAMES, and is dropped
+ * after CARRIER_HOLD_FRAMES without a match, so the reported list does not flicker.
+ */
+
+#define CARRIER_MAX                 32
+
+#define CARRIER_THRESHOLD_DB        3.0f
+/* Gaps of up to this many bins below threshold are bridged within one carrier */
+#define CARRIER_MERGE_GAP_BINS      2
+#define CARRIER_MIN_BINS            3
+
+#define CARRIER_CONFIRM_FRAMES      3
+#define CARRIER_HOLD_FRAMES         5
+
+/* Changes smaller than these are not reported to clients */
+#define CARRIER_REPORT_SNR_DB       1.0f
+#define CARRIER_REPORT_BW_BINS      2.0
+
+typedef struct {
+    uint32_t id;
+    double freq_hz;
+    double bandwidth_hz;
+    float snr_db;
+
+    uint32_t seen;
+    uint32_t missed;
+    bool matched;
+
+    /* Values last sent to clients */
+    bool reported;
+    double reported_freq_hz;
+    double reported_bandwidth_hz;
+    float reported_snr_db;
+} carrier_t;
+
+typedef struct {
+    /* Output units per dB of the packed frame */
+    float units_per_db;
+
+    carrier_t carriers[CARRIER_MAX];
+    uint32_t carrier_count;
+    uint32_t next_id;
+    bool changed;
+    /* Carriers reported for the first time, and the frequency of the last */
+    uint32_t appeared;
+    double appeared_freq_hz;
+} carrier_detector_t;
+
+void carrier_detector_init(carrier_detector_t *cd, float units_per_db);
+
+/* Forget all carriers, as after a retune. Carrier ids are not reused. */
+void carrier_detector_reset(carrier_detector_t *cd);
+
+/* Process one frame, bin i being at _bin0_hz + (i * _bin_hz). Returns true if the reported list has changed. */
+bool carrier_detector_process(carrier_detector_t *cd, const uint16_t *frame, uint32_t length, uint16_t floor_level, double _bin0_hz, double _bin_hz);
+
+/* Serialise the reported carrier list as JSON, returns the length written or -1 if it did not fit */
+int32_t carrier_detector_json(const carrier_detector_t *cd, char *buffer, size_t buffer_size, uint32_t sequence);
+
+#endif /* CARRIER_DETECT_H */
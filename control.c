@@ -0,0 +1,155 @@
+#include "control.h"
+#include "json.h"
+
+uint8_t control_init(control_t *control)
+{
+    struct stat st;
+    FILE *f;
+    size_t n;
+
+    memset(control, 0, sizeof(control_t));
+
+    f = fopen(CONTROL_TOKEN_FILENAME, "r");
+    if(f == NULL)
+    {
+        return 0;
+    }
+    if(fstat(fileno(f), &st) == 0 && (st.st_mode & (S_IRWXG | S_IRWXO)) != 0)
+    {
+        fprintf(stderr, "Warning: %s is readable by other users\n", CONTROL_TOKEN_FILENAME);
+    }
+    n = fread(control->token, 1, CONTROL_TOKEN_LENGTH - 1, f);
+    fclose(f);
+
+    /* One line, trailing whitespace ignored */
+    control->token[n] = '\0';
+    control->token[strcspn(control->token, "\r\n")] = '\0';
+    n = strlen(control->token);
+    while(n > 0 && (control->token[n - 1] == ' ' || control->token[n - 1] == '\t'))
+    {
+        control->token[--n] = '\0';
+    }
+
+    if(n < CONTROL_TOKEN_LENGTH_MIN || strchr(control->token, '"') != NULL || strchr(control->token, '\\') != NULL)
+    {
+        fprintf(stderr, "%s must hold a token of at least %d characters, without quotes or backslashes\n",
+            CONTROL_TOKEN_FILENAME, CONTROL_TOKEN_LENGTH_MIN);
+        memset(control, 0, sizeof(control_t));
+        return 0;
+    }
+    control->token_length = n;
+
+    return 1;
+}
+
+/* Compare the whole token whatever the input, so the time taken doesn't tell how much of it matched */
+static bool control_token_match(const control_t *control, const char *token, size_t _length)
+{
+    uint8_t diff = _length != control->token_length;
+    size_t i;
+
+    for(i = 0; i < control->token_length; i++)
+    {
+        diff |= control->token[i] ^ (i < _length ? token[i] : 0);
+    }
+    return diff == 0;
+}
+
+bool control_request_parse(const control_t *control, const char *request, size_t _length, pipeline_tune_t *tune, bool *authorised)
+{
+    char json[CONTROL_REQUEST_LENGTH];
+    const char *token, *end;
+    int64_t value;
+
+    *authorised = false;
+    memset(tune, 0, sizeof(pipeline_tune_t));
+
+    if(control->token_length == 0 || _length >= sizeof(json))
+    {
+        return false;
+    }
+    memcpy(json, request, _length);
+    json[_length] = '\0';
+
+    /* "token":"<secret>" */
+    token = strstr(json, "\"token\"");
+    if(token == NULL || (token = strchr(token + strlen("\"token\""), ':')) == NULL)
+    {
+        return false;
+    }
+    token += strspn(token + 1, " \t") + 1;
+    if(*token != '"' || (end = strchr(token + 1, '"')) == NULL)
+    {
+        return false;
+    }
+    token++;
+    if(!control_token_match(control, token, end - token))
+    {
+        return false;
+    }
+    *authorised = true;
+
+    if(json_integer(json, "freq", &value))
+    {
+        if(value < 0 || value > UINT32_MAX)
+        {
+            return false;
+        }
+        tune->set_freq = true;
+        tune->freq_hz = value;
+    }
+    if(json_integer(json, "rate", &value))
+    {
+        if(value < 0 || value > UINT32_MAX)
+        {
+            return false;
+        }
+        tune->set_sample_rate = true;
+        tune->sample_rate = value;
+    }
+    if(json_integer(json, "gain", &value))
+    {
+        if(value < 0 || value > UINT32_MAX)
+        {
+            return false;
+        }
+        tune->set_gain = true;
+        tune->gain = value;
+    }
+    if(json_integer(json, "biast", &value))
+    {
+        if(value < 0 || value > UINT32_MAX)
+        {
+            return false;
+        }
+        tune->set_biast = true;
+        tune->biast = value;
+    }
+    if(json_integer(json, "capture", &value))
+    {
+        tune->capture = value != 0;
+    }
+
+    return true;
+}
+
+int32_t control_reply(pipeline_t *pipeline, const char *_error, char *buffer, size_t buffer_size)
+{
+    int n;
+
+    if(_error != NULL)
+    {
+        n = snprintf(buffer, buffer_size, "{\"error\":\"%s\"}", _error);
+    }
+    else
+    {
+        n = snprintf(buffer, buffer_size, "{\"epoch\":%"PRIu32",\"freq\":%"PRIu32",\"rate\":%"PRIu32",\"gain\":%"PRIu32",\"biast\":%"PRIu32"}",
+            __atomic_load_n(&pipeline->epoch, __ATOMIC_RELAXED), __atomic_load_n(&pipeline->freq_hz, __ATOMIC_RELAXED),
+            __atomic_load_n(&pipeline->sample_rate, __ATOMIC_RELAXED), pipeline->gain, pipeline->biast);
+    }
+    if(n < 0 || (size_t)n >= buffer_size)
+    {
+        return 0;
+    }
+    return n;
+}
@@ -0,0 +1,48 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "main.h"
+#include <stdbool.h>
+
+#include "pipeline.h"
+
+/* Live control of the AirSpys
+ *
+ * Each AirSpy pipeline serves "<name>.control", which takes retune and gain requests as text:
+ *
+ *   {"token":"<secret>","freq":<Hz>,"rate":<Hz>,"gain":<0-21>,"biast":<0|1>,"capture":<0|1>}
+ *
+ * Any of the settings can be left out. "capture":1 records the IQ around the moment it is applied,
+ *  for a pipeline with capture configured (see capture.h), and retunes nothing by itself. The secret is read at startup from CONTROL_TOKEN_FILENAME,
+ *  without it no control protocol is served. A request with the wrong token closes the connection.
+ *
+ * Changes are applied by the main thread (see pipeline_tune_apply()), and the reply sent once applied:
+ *
+ *   {"epoch":<n>,"freq":<Hz>,"rate":<Hz>,"gain":<n>,"biast":<n>}  or  {"error":"<reason>"}
+ *
+ * No client of any protocol is disconnected. A change of rate is refused while zoom pipelines or IQ
+ *  stream clients depend on the current one. The epoch counts changes: IQ stream frames and shared
+ *  memory slots are flagged as discontinuous at each one, and the FFT averaging, noise floor and
+ *  carrier list start over from it.
+ */
+
+#define CONTROL_TOKEN_FILENAME      ".control_token"
+#define CONTROL_TOKEN_LENGTH        128
+#define CONTROL_TOKEN_LENGTH_MIN    16
+#define CONTROL_REQUEST_LENGTH      256
+
+typedef struct {
+    char token[CONTROL_TOKEN_LENGTH];
+    size_t token_length;
+} control_t;
+
+/* Read the secret. Returns 1 if there is one, and so control is enabled. */
+uint8_t control_init(control_t *control);
+
+/* Parse a request into *tune. Returns false if malformed, *authorised is false if the token didn't match. */
+bool control_request_parse(const control_t *control, const char *request, size_t _length, pipeline_tune_t *tune, bool *authorised);
+
+/* Reply to an applied request with the pipeline's tuning, or _error. Returns the length written. */
+int32_t control_reply(pipeline_t *pipeline, const char *_error, char *buffer, size_t buffer_size);
+
+#endif /* CONTROL_H */
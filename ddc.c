@@ -0,0 +1,203 @@
+#include "ddc.h"
+#include "simd.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/* Float samples are scaled to fixed point ahead of the CIC integrators */
+#define DDC_CIC_INPUT_SCALE     (1 << 20)
+
+#define NCO_LANES   8
+
+uint8_t ddc_configure(ddc_t *ddc, double _offset_hz, uint32_t _sample_rate, uint32_t _decimation)
+{
+    if(_decimation < DDC_FIR_DECIMATION || _decimation % DDC_FIR_DECIMATION != 0
+        || _decimation / DDC_FIR_DECIMATION > DDC_CIC_DECIMATION_MAX)
+    {
+        printf("ddc_configure(): decimation %d must be a multiple of %d, up to %d\n",
+            _decimation, DDC_FIR_DECIMATION, DDC_FIR_DECIMATION * DDC_CIC_DECIMATION_MAX);
+        return 0;
+    }
+
+    ddc->decimation = _decimation;
+    ddc->cic_decimation = _decimation / DDC_FIR_DECIMATION;
+    ddc->cic_gain = 1.0 / (pow(ddc->cic_decimation, DDC_CIC_ORDER) * DDC_CIC_INPUT_SCALE);
+    ddc->phase = 0.0;
+    ddc->phase_step = -2*M_PI * _offset_hz / _sample_rate;
+
+    memset(ddc->integrator, 0, sizeof(ddc->integrator));
+    memset(ddc->comb, 0, sizeof(ddc->comb));
+    ddc->cic_count = 0;
+    ddc->fir_fill = 0;
+    ddc->fir_phase = 0;
+
+    return 1;
+}
+
+uint8_t ddc_init(ddc_t *ddc, arena_t *arena, double _offset_hz, uint32_t _sample_rate, uint32_t _decimation)
+{
+    uint32_t i;
+    double x, w, sum;
+
+    memset(ddc, 0, sizeof(ddc_t));
+
+    ddc->fir_history_length = DDC_FIR_TAPS + DDC_CHUNK_SAMPLES;
+    ddc->mixed = arena_alloc(arena, sizeof(int32_t) * 2 * DDC_CHUNK_SAMPLES, ARENA_CACHE_LINE);
+    ddc->fir_coeffs = arena_alloc(arena, sizeof(float) * 2 * DDC_FIR_TAPS, ARENA_CACHE_LINE);
+    ddc->fir_history = arena_alloc(arena, sizeof(float) * 2 * ddc->fir_history_length, ARENA_CACHE_LINE);
+    if(ddc->mixed == NULL || ddc->fir_coeffs == NULL || ddc->fir_history == NULL)
+    {
+        return 0;
+    }
+
+    /* Blackman-windowed sinc cutting off at half the output rate, normalised to unity gain at 0Hz */
+    sum = 0.0;
+    for(i = 0; i < DDC_FIR_TAPS; i++)
+    {
+        x = ((double)i - ((DDC_FIR_TAPS - 1) / 2.0)) / DDC_FIR_DECIMATION;
+        w = 0.42 - 0.5 * cos(2*M_PI*i / (DDC_FIR_TAPS - 1)) + 0.08 * cos(4*M_PI*i / (DDC_FIR_TAPS - 1));
+        ddc->fir_coeffs[2*i] = (x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x)) * w;
+        sum += ddc->fir_coeffs[2*i];
+    }
+    for(i = 0; i < DDC_FIR_TAPS; i++)
+    {
+        ddc->fir_coeffs[2*i] /= sum;
+        ddc->fir_coeffs[(2*i)+1] = ddc->fir_coeffs[2*i];
+    }
+
+    return ddc_configure(ddc, _offset_hz, _sample_rate, _decimation);
+}
+
+/* Mix _count (up to DDC_CHUNK_SAMPLES) samples down into ddc->mixed, converted to fixed point for the
+ *  CIC here where it vectorises with the mix. Samples within +/-1 stay well inside int32 at DDC_CIC_INPUT_SCALE. */
+static void ddc_mix(ddc_t *ddc, const float *samples, uint32_t _count)
+{
+    float lane_re[NCO_LANES], lane_im[NCO_LANES];
+    float step_re, step_im, t;
+    uint32_t i, k;
+
+    /* Re-seed the lanes from the double phase so float rounding can't accumulate across chunks */
+    for(k = 0; k < NCO_LANES; k++)
+    {
+        lane_re[k] = cos(ddc->phase + (k * ddc->phase_step));
+        lane_im[k] = sin(ddc->phase + (k * ddc->phase_step));
+    }
+    step_re = cos(NCO_LANES * ddc->phase_step);
+    step_im = sin(NCO_LANES * ddc->phase_step);
+
+    for(i = 0; i + NCO_LANES <= _count; i += NCO_LANES)
+    {
+        for(k = 0; k < NCO_LANES; k++)
+        {
+            ddc->mixed[2*(i+k)] = ((samples[2*(i+k)] * lane_re[k]) - (samples[(2*(i+k))+1] * lane_im[k])) * DDC_CIC_INPUT_SCALE;
+            ddc->mixed[(2*(i+k))+1] = ((samples[2*(i+k)] * lane_im[k]) + (samples[(2*(i+k))+1] * lane_re[k])) * DDC_CIC_INPUT_SCALE;
+        }
+        for(k = 0; k < NCO_LANES; k++)
+        {
+            t = (lane_re[k] * step_re) - (lane_im[k] * step_im);
+            lane_im[k] = (lane_re[k] * step_im) + (lane_im[k] * step_re);
+            lane_re[k] = t;
+        }
+    }
+    for(k = 0; i < _count; i++, k++)
+    {
+        ddc->mixed[2*i] = ((samples[2*i] * lane_re[k]) - (samples[(2*i)+1] * lane_im[k])) * DDC_CIC_INPUT_SCALE;
+        ddc->mixed[(2*i)+1] = ((samples[2*i] * lane_im[k]) + (samples[(2*i)+1] * lane_re[k])) * DDC_CIC_INPUT_SCALE;
+    }
+
+    ddc->phase = fmod(ddc->phase + (_count * ddc->phase_step), 2*M_PI);
+}
+
+/* Low-pass the newest DDC_FIR_TAPS samples of the history into one output sample */
+static void ddc_fir(const ddc_t *ddc, float *output)
+{
+    const v8sf_u *x = (const v8sf_u *)&ddc->fir_history[2 * (ddc->fir_fill - DDC_FIR_TAPS)];
+    const v8sf *c = (const v8sf *)ddc->fir_coeffs;
+    v8sf acc = { 0 };
+    uint32_t i;
+
+    for(i = 0; i < (2 * DDC_FIR_TAPS) / V8SF_FLOATS; i++)
+    {
+        acc += x[i] * c[i];
+    }
+
+    /* Even lanes are I, odd lanes Q */
+    output[0] = acc[0] + acc[2] + acc[4] + acc[6];
+    output[1] = acc[1] + acc[3] + acc[5] + acc[7];
+}
+
+uint32_t ddc_process(ddc_t *ddc, const float *samples, uint32_t _count, float *output)
+{
+    const int32_t *mixed = ddc->mixed;
+    v2du integrator[DDC_CIC_ORDER], value, previous;
+    uint32_t i, s, chunk, run, end;
+    uint32_t output_count = 0;
+
+    /* Integrators in registers for the whole call, they change every sample */
+    memcpy(integrator, ddc->integrator, sizeof(integrator));
+
+    while(_count > 0)
+    {
+        chunk = _count < DDC_CHUNK_SAMPLES ? _count : DDC_CHUNK_SAMPLES;
+        ddc_mix(ddc, samples, chunk);
+
+        for(i = 0; i < chunk; )
+        {
+            /* Integrate up to the next decimated sample, or the end of the chunk */
+            run = ddc->cic_decimation - ddc->cic_count;
+            run = run < chunk - i ? run : chunk - i;
+            for(end = i + run; i < end; i++)
+            {
+                value = (v2du){ (uint64_t)(int64_t)mixed[2*i], (uint64_t)(int64_t)mixed[(2*i)+1] };
+                integrator[0] += value;
+                for(s = 1; s < DDC_CIC_ORDER; s++)
+                {
+                    integrator[s] += integrator[s-1];
+                }
+            }
+
+            ddc->cic_count += run;
+            if(ddc->cic_count < ddc->cic_decimation)
+            {
+                continue;
+            }
+            ddc->cic_count = 0;
+
+            /* Combs run at the decimated rate */
+            value = integrator[DDC_CIC_ORDER-1];
+            for(s = 0; s < DDC_CIC_ORDER; s++)
+            {
+                previous = ddc->comb[s];
+                ddc->comb[s] = value;
+                value -= previous;
+            }
+            ddc->fir_history[2 * ddc->fir_fill] = (int64_t)value[0] * ddc->cic_gain;
+            ddc->fir_history[(2 * ddc->fir_fill) + 1] = (int64_t)value[1] * ddc->cic_gain;
+            ddc->fir_fill++;
+
+            if(++ddc->fir_phase == DDC_FIR_DECIMATION)
+            {
+                ddc->fir_phase = 0;
+                if(ddc->fir_fill >= DDC_FIR_TAPS)
+                {
+                    ddc_fir(ddc, &output[2 * output_count]);
+                    output_count++;
+                }
+            }
+
+            /* Keep the last taps - 1 samples at the start of the history */
+            if(ddc->fir_fill == ddc->fir_history_length)
+            {
+                memmove(ddc->fir_history, &ddc->fir_history[2 * (ddc->fir_fill - (DDC_FIR_TAPS - 1))], sizeof(float) * 2 * (DDC_FIR_TAPS - 1));
+                ddc->fir_fill = DDC_FIR_TAPS - 1;
+            }
+        }
+
+        samples += 2 * chunk;
+        _count -= chunk;
+    }
+
+    memcpy(ddc->integrator, integrator, sizeof(integrator));
+    return output_count;
+}
@@ -0,0 +1,68 @@
+#ifndef DDC_H
+#define DDC_H
+
+#include <stdint.h>
+
+#include "arena.h"
+#include "simd.h"
+
+/* Digital down-converter
+ *
+ * Shifts a sub-band of the IQ stream to 0Hz and decimates it for a zoom spectrum:
+ *
+ *  NCO      - complex mix by -offset, 8 lanes at a time, re-seeded from a double phase every chunk,
+ *              converted to fixed point for the CIC
+ *  CIC      - DDC_CIC_ORDER integrator/comb stages decimating by decimation / DDC_FIR_DECIMATION,
+ *              in 64-bit integer arithmetic so the integrators wrap rather than drift, I and Q
+ *              as the two lanes of a vector
+ *  FIR      - DDC_FIR_TAPS windowed-sinc low-pass decimating by DDC_FIR_DECIMATION, cutting off at
+ *              half the output rate, vectorised across the interleaved I/Q history
+ *
+ * Gain through the chain is unity at 0Hz, so levels match the source spectrum. The CIC droops by
+ *  about 1dB at the edges of the output band.
+ */
+
+#define DDC_CIC_ORDER           4
+#define DDC_CIC_DECIMATION_MAX  256
+
+#define DDC_FIR_DECIMATION      4
+#define DDC_FIR_TAPS            128
+
+/* Input samples mixed per NCO re-seed */
+#define DDC_CHUNK_SAMPLES       1024
+
+typedef struct {
+    uint32_t decimation;
+    uint32_t cic_decimation;
+
+    /* NCO, phase in radians */
+    double phase;
+    double phase_step;
+    int32_t *mixed;
+
+    /* CIC state, two's complement wrap-around in uint64, lanes I & Q */
+    v2du integrator[DDC_CIC_ORDER];
+    v2du comb[DDC_CIC_ORDER];
+    uint32_t cic_count;
+    float cic_gain;
+
+    /* FIR, coefficients repeated for I & Q, history of CIC output (interleaved I/Q) */
+    float *fir_coeffs;
+    float *fir_history;
+    uint32_t fir_history_length;
+    uint32_t fir_fill;
+    uint32_t fir_phase;
+} ddc_t;
+
+/* _offset_hz is the centre of the sub-band relative to the input centre frequency,
+ *  _decimation must be a multiple of DDC_FIR_DECIMATION. Returns 1 on success. */
+uint8_t ddc_init(ddc_t *ddc, arena_t *arena, double _offset_hz, uint32_t _sample_rate, uint32_t _decimation);
+
+/* Retune an initialised DDC and clear its filter state, without allocating. Returns 1 on success. */
+uint8_t ddc_configure(ddc_t *ddc, double _offset_hz, uint32_t _sample_rate, uint32_t _decimation);
+
+/* Down-convert _count samples (interleaved IQ), writing up to (_count / decimation) + 1 output samples.
+ * Returns the number of output samples written. */
+uint32_t ddc_process(ddc_t *ddc, const float *samples, uint32_t _count, float *output);
+
+#endif /* DDC_H */
@@ -0,0 +1,131 @@
+#include "fft_fixed.h"
+
+#include <stdio.h>
+#include <math.h>
+
+uint8_t fft_fixed_init(fft_fixed_t *ff, arena_t *arena, const filterbank_t *fb)
+{
+    const uint32_t n = fb->fft_size;
+    uint32_t i, b, length;
+    long q;
+
+    if(n < 2 || n > FFT_FIXED_SIZE_MAX || (n & (n - 1)) != 0)
+    {
+        printf("fft_fixed_init(): FFT size %d is not a power of two up to %d\n", n, FFT_FIXED_SIZE_MAX);
+        return 0;
+    }
+
+    ff->fft_size = n;
+    ff->log2_size = __builtin_ctz(n);
+    ff->taps = fb->taps;
+    length = ff->taps * n;
+
+    ff->coeffs = arena_alloc(arena, sizeof(int16_t) * length, ARENA_CACHE_LINE);
+    ff->bitrev = arena_alloc(arena, sizeof(uint16_t) * n, ARENA_CACHE_LINE);
+    ff->twiddles = arena_alloc(arena, sizeof(int32_t) * n, ARENA_CACHE_LINE);
+    ff->data = arena_alloc(arena, sizeof(int32_t) * 2 * n, ARENA_CACHE_LINE);
+    if(ff->coeffs == NULL || ff->bitrev == NULL || ff->twiddles == NULL || ff->data == NULL)
+    {
+        return 0;
+    }
+
+    /* Window to Q15, the Hann peak of 1.0 saturating */
+    for(i = 0; i < length; i++)
+    {
+        q = lrint(fb->coeffs[2*i] * 32768.0);
+        ff->coeffs[i] = q > INT16_MAX ? INT16_MAX : (q < INT16_MIN ? INT16_MIN : q);
+    }
+
+    for(i = 0; i < n; i++)
+    {
+        ff->bitrev[i] = 0;
+        for(b = 0; b < ff->log2_size; b++)
+        {
+            ff->bitrev[i] |= ((i >> b) & 1) << (ff->log2_size - 1 - b);
+        }
+    }
+
+    for(i = 0; i < n / 2; i++)
+    {
+        ff->twiddles[2*i] = lrint(cos(2*M_PI*i / n) * (1 << 30));
+        ff->twiddles[(2*i)+1] = lrint(-sin(2*M_PI*i / n) * (1 << 30));
+    }
+
+    /* The windowed samples are Q15 and the FFT unscaled, where the float path's power is |X|^2 / N^4 */
+    ff->power_scale = ldexp(1.0, -(30 + (4 * (int)ff->log2_size)));
+
+    return 1;
+}
+
+void fft_fixed_execute(fft_fixed_t *ff, const int16_t *samples)
+{
+    const uint32_t n = ff->fft_size;
+    const int16_t *c = ff->coeffs;
+    const int32_t *w;
+    int32_t *data = ff->data;
+    int32_t *a, *b;
+    int32_t re, im, tr, ti;
+    uint32_t i, j, t, half, stride, start;
+
+    /* Window and fold, each product rounded back to the sample's Q15 */
+    for(i = 0; i < n; i++)
+    {
+        re = 0;
+        im = 0;
+        for(t = 0, j = i; t < ff->taps; t++, j += n)
+        {
+            re += (((int32_t)samples[2*j] * c[j]) + (1 << 14)) >> 15;
+            im += (((int32_t)samples[(2*j)+1] * c[j]) + (1 << 14)) >> 15;
+        }
+        data[2 * ff->bitrev[i]] = re;
+        data[(2 * ff->bitrev[i]) + 1] = im;
+    }
+
+    /* Decimation in time butterflies, from pairs up */
+    for(half = 1, stride = n / 2; half < n; half *= 2, stride /= 2)
+    {
+        for(start = 0; start < n; start += 2 * half)
+        {
+            a = &data[2 * start];
+            b = &data[2 * (start + half)];
+            w = ff->twiddles;
+            for(i = 0; i < half; i++, a += 2, b += 2, w += 2 * stride)
+            {
+                tr = (((int64_t)b[0] * w[0]) - ((int64_t)b[1] * w[1]) + (1 << 29)) >> 30;
+                ti = (((int64_t)b[0] * w[1]) + ((int64_t)b[1] * w[0]) + (1 << 29)) >> 30;
+                b[0] = a[0] - tr;
+                b[1] = a[1] - ti;
+                a[0] += tr;
+                a[1] += ti;
+            }
+        }
+    }
+}
+
+void fft_fixed_accumulate(const fft_fixed_t *ff, uint64_t *power_lo, uint32_t *power_hi)
+{
+    const uint32_t n = ff->fft_size;
+    const int32_t *data = ff->data;
+    uint32_t i, bin;
+    uint64_t power;
+
+    for(i = 0; i < n; i++)
+    {
+        /* Shift DC to the centre */
+        bin = (i + (n / 2)) & (n - 1);
+        power = (uint64_t)((int64_t)data[2*bin] * data[2*bin]) + (uint64_t)((int64_t)data[(2*bin)+1] * data[(2*bin)+1]);
+
+        power_lo[i] += power;
+        power_hi[i] += power_lo[i] < power;
+    }
+}
+
+void fft_fixed_power(const fft_fixed_t *ff, const uint64_t *power_lo, const uint32_t *power_hi, double *power)
+{
+    uint32_t i;
+
+    for(i = 0; i < ff->fft_size; i++)
+    {
+        power[i] = (ldexp(power_hi[i], 64) + power_lo[i]) * ff->power_scale;
+    }
+}
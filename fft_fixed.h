@@ -0,0 +1,55 @@
+#ifndef FFT_FIXED_H
+#define FFT_FIXED_H
+
+#include <stdint.h>
+
+#include "arena.h"
+#include "filterbank.h"
+
+/* Fixed-point FFT thread path, for hosts without a fast FPU
+ *
+ * Takes int16 IQ (as AIRSPY_SAMPLE_INT16_IQ, full scale +/-32768 being +/-1.0 of the float samples) and
+ *  produces the same power spectrum as the float path, in integers throughout:
+ *
+ *  - the filterbank's window (folded for WOLA) is applied in Q15, writing each frame out in bit-reversed order
+ *  - an in-place radix-2 FFT over int32 with Q30 twiddles, unscaled: the window's gain of at most N/2 keeps
+ *    every stage within 31 bits for N up to FFT_FIXED_SIZE_MAX
+ *  - power is taken as a uint64 and summed into 96 bits (a 64 bit low and 32 bit high word per bin),
+ *    enough for 2^32 frames at full scale
+ *
+ * Only fft_fixed_power(), on the main thread, goes back to floating point. The power reads within a few
+ *  hundredths of a dB of the float path's for the same input, see selftest.h.
+ */
+
+#define FFT_FIXED_SIZE_MAX      32768
+
+typedef struct {
+    uint32_t fft_size;
+    uint32_t log2_size;
+    uint32_t taps;
+    /* Window, taps * fft_size Q15 coefficients */
+    int16_t *coeffs;
+    /* Bit-reversed index of each sample of a frame */
+    uint16_t *bitrev;
+    /* exp(-2*pi*i*k/N) for k < N/2, Q30, interleaved cos / sin */
+    int32_t *twiddles;
+    /* Frame being transformed, fft_size * 2 (I & Q) */
+    int32_t *data;
+
+    /* Float path power of one unit of integer power, 2^-(30 + 4*log2_size) */
+    double power_scale;
+} fft_fixed_t;
+
+/* Quantise the (initialised) filterbank's window and set up the FFT. Returns 1 on success. */
+uint8_t fft_fixed_init(fft_fixed_t *ff, arena_t *arena, const filterbank_t *fb);
+
+/* Window (and fold) the frame starting at samples (interleaved int16 IQ), and transform it */
+void fft_fixed_execute(fft_fixed_t *ff, const int16_t *samples);
+
+/* Add the power of the last frame into power_lo / power_hi (fft_size each, DC centred) */
+void fft_fixed_accumulate(const fft_fixed_t *ff, uint64_t *power_lo, uint32_t *power_hi);
+
+/* Convert summed power to the float path's, linear and relative to full scale */
+void fft_fixed_power(const fft_fixed_t *ff, const uint64_t *power_lo, const uint32_t *power_hi, double *power);
+
+#endif /* FFT_FIXED_H */
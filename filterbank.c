@@ -0,0 +1,125 @@
+#include "filterbank.h"
+#include "simd.h"
+
+#include <stdio.h>
+#include <math.h>
+
+#define FILTERBANK_TAPS_MAX     16
+
+static double prototype(filterbank_type_t type, uint32_t i, uint32_t _length, uint32_t _fft_size)
+{
+    double x, w;
+
+    if(type == FILTERBANK_WOLA)
+    {
+        /* Sinc with its first nulls one bin apart, under a Blackman window for low sidelobes */
+        x = ((double)i - ((double)(_length - 1) / 2.0)) / _fft_size;
+        w = 0.42 - 0.5 * cos(2*M_PI*i / (_length - 1)) + 0.08 * cos(4*M_PI*i / (_length - 1));
+        return (x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x)) * w;
+    }
+
+    return 0.5 * (1.0 - cos(2*M_PI*(((double)i)/_fft_size)));
+}
+
+uint8_t filterbank_init(filterbank_t *fb, arena_t *arena, filterbank_type_t type, uint32_t _fft_size, uint32_t _taps)
+{
+    uint32_t i, length;
+    double sum;
+
+    /* Each frame must be a whole number of vectors */
+    if((2 * _fft_size) % V8SF_FLOATS != 0)
+    {
+        printf("filterbank_init(): FFT size %d is not a multiple of %d\n", _fft_size, (int)V8SF_FLOATS / 2);
+        return 0;
+    }
+
+    fb->type = type;
+    fb->fft_size = _fft_size;
+    if(type == FILTERBANK_WOLA)
+    {
+        if(_taps < 2 || _taps > FILTERBANK_TAPS_MAX)
+        {
+            printf("filterbank_init(): %d taps out of range (2 - %d)\n", _taps, FILTERBANK_TAPS_MAX);
+            return 0;
+        }
+        fb->taps = _taps;
+    }
+    else
+    {
+        fb->taps = 1;
+    }
+    length = fb->taps * _fft_size;
+
+    fb->coeffs = arena_alloc(arena, sizeof(float) * 2 * length, ARENA_CACHE_LINE);
+    fb->folded = arena_alloc(arena, sizeof(float) * 2 * _fft_size, ARENA_CACHE_LINE);
+    if(fb->coeffs == NULL || fb->folded == NULL)
+    {
+        return 0;
+    }
+
+    /* Normalise to the coherent gain of the Hann window (sum N/2) */
+    sum = 0.0;
+    for(i = 0; i < length; i++)
+    {
+        sum += prototype(type, i, length, _fft_size);
+    }
+    for(i = 0; i < length; i++)
+    {
+        fb->coeffs[2*i] = prototype(type, i, length, _fft_size) * ((_fft_size / 2.0) / sum);
+        fb->coeffs[(2*i)+1] = fb->coeffs[2*i];
+    }
+
+    return 1;
+}
+
+uint32_t filterbank_frames(const filterbank_t *fb, uint32_t _sample_count, uint32_t _hop)
+{
+    if(_sample_count < fb->taps * fb->fft_size || _hop == 0)
+    {
+        return 0;
+    }
+    return ((_sample_count - (fb->taps * fb->fft_size)) / _hop) + 1;
+}
+
+void filterbank_prefilter(const filterbank_t *fb, const float *samples, fftw_complex *fft_in)
+{
+    const uint32_t vectors = (2 * fb->fft_size) / V8SF_FLOATS;
+    const v8sf_u *x = (const v8sf_u *)samples;
+    const v8sf *c = (const v8sf *)fb->coeffs;
+    v8sf *folded = (v8sf *)fb->folded;
+    double *out = (double *)fft_in;
+    uint32_t i, t;
+
+    /* First tap initialises the frame, the rest are accumulated onto it */
+    for(i = 0; i < vectors; i++)
+    {
+        folded[i] = x[i] * c[i];
+    }
+    for(t = 1; t < fb->taps; t++)
+    {
+        x += vectors;
+        c += vectors;
+        for(i = 0; i < vectors; i++)
+        {
+            folded[i] += x[i] * c[i];
+        }
+    }
+
+    /* Widen to FFTW's interleaved double complex */
+    for(i = 0; i < 2 * fb->fft_size; i++)
+    {
+        out[i] = fb->folded[i];
+    }
+}
+
+const char *filterbank_name(const filterbank_t *fb)
+{
+    switch(fb->type)
+    {
+        case FILTERBANK_WOLA:
+            return "wola";
+        case FILTERBANK_HANN:
+        default:
+            return "hann";
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef FILTERBANK_H
+#define FILTERBANK_H
+
+#include <stdint.h>
+#include <fftw3.h>
+
+#include "arena.h"
+
+/* FFT prefilter / spectral estimator
+ *
+ * Each FFT frame is windowed (and for WOLA, folded) from the IQ before the FFT:
+ *
+ *  FILTERBANK_HANN - a plain N-point Hann window. The original estimator.
+ *  FILTERBANK_WOLA - weighted overlap-add polyphase filterbank. A windowed-sinc prototype filter
+ *                    spanning taps * N samples is applied and the taps are summed into one N-point
+ *                    frame, giving each bin a flat top and steep skirts.
+ *
+ * The hop between frames is chosen by the caller (see pipeline_config_t overlap).
+ *
+ * Both are normalised to the Hann window's coherent gain, so a carrier reads the same level on either;
+ *  the noise floor differs with the noise bandwidth of each bin, which the floor AGC takes out.
+ * Coefficients are stored once per I and Q sample so the prefilter runs as a straight vector multiply-add.
+ */
+
+typedef enum {
+    FILTERBANK_HANN = 0,
+    FILTERBANK_WOLA
+} filterbank_type_t;
+
+typedef struct {
+    filterbank_type_t type;
+    uint32_t fft_size;
+    /* Frame length is taps * fft_size samples */
+    uint32_t taps;
+    /* Prototype filter, taps * fft_size * 2 floats (I & Q) */
+    float *coeffs;
+    /* Folded frame, fft_size * 2 floats (I & Q) */
+    float *folded;
+} filterbank_t;
+
+/* Allocate and compute the prototype filter, _taps is ignored for FILTERBANK_HANN. Returns 1 on success. */
+uint8_t filterbank_init(filterbank_t *fb, arena_t *arena, filterbank_type_t type, uint32_t _fft_size, uint32_t _taps);
+
+/* Number of complete frames in a block of _sample_count samples, starting _hop samples apart */
+uint32_t filterbank_frames(const filterbank_t *fb, uint32_t _sample_count, uint32_t _hop);
+
+/* Window and fold the frame starting at samples (interleaved IQ) into fft_in */
+void filterbank_prefilter(const filterbank_t *fb, const float *samples, fftw_complex *fft_in);
+
+const char *filterbank_name(const filterbank_t *fb);
+
+#endif /* FILTERBANK_H */
@@ -0,0 +1,33 @@
+#include "floor_estimator.h"
+
+uint32_t floor_estimator_percentile(const floor_estimator_t *fe, uint32_t _percentile)
+{
+    uint32_t bucket;
+    uint32_t rank, cumulative;
+
+    if(fe->count == 0)
+    {
+        return 0;
+    }
+
+    /* Rank of the target bin, counting from 1 */
+    rank = ((uint64_t)fe->count * _percentile) / 100;
+    if(rank == 0)
+    {
+        rank = 1;
+    }
+
+    cumulative = 0;
+    for(bucket = 0; bucket < FLOOR_HIST_BUCKETS; bucket++)
+    {
+        if(cumulative + fe->hist[bucket] >= rank)
+        {
+            /* Interpolate linearly within the bucket */
+            return (bucket << FLOOR_HIST_BUCKET_SHIFT)
+                + (uint32_t)(((uint64_t)(rank - cumulative) << FLOOR_HIST_BUCKET_SHIFT) / fe->hist[bucket]);
+        }
+        cumulative += fe->hist[bucket];
+    }
+
+    return (FLOOR_HIST_BUCKETS << FLOOR_HIST_BUCKET_SHIFT) - 1;
+}
@@ -0,0 +1,45 @@
+#ifndef FLOOR_ESTIMATOR_H
+#define FLOOR_ESTIMATOR_H
+
+#include <stdint.h>
+#include <string.h>
+
+/* Histogram-based noise floor estimator
+ *
+ * Bins are added one at a time as they are scaled, each costing a single bucket increment.
+ * The floor is then read back as a low percentile of the histogram, so that a deep null or
+ * a single spur can no longer drag the whole display around as the old minimum search did.
+ * Reading the percentile walks a fixed number of buckets, independent of FFT_SIZE.
+ */
+
+/* Bucket width of 1024 output units (~0.11 dB at FFT_SCALE 9e3), covering 0 - 2^21 */
+#define FLOOR_HIST_BUCKET_SHIFT     10
+#define FLOOR_HIST_BUCKETS          2048
+
+typedef struct {
+    uint32_t hist[FLOOR_HIST_BUCKETS];
+    uint32_t count;
+} floor_estimator_t;
+
+static inline void floor_estimator_reset(floor_estimator_t *fe)
+{
+    memset(fe->hist, 0, sizeof(fe->hist));
+    fe->count = 0;
+}
+
+static inline void floor_estimator_add(floor_estimator_t *fe, uint32_t value)
+{
+    uint32_t bucket = value >> FLOOR_HIST_BUCKET_SHIFT;
+
+    if(bucket >= FLOOR_HIST_BUCKETS)
+    {
+        bucket = FLOOR_HIST_BUCKETS - 1;
+    }
+    fe->hist[bucket]++;
+    fe->count++;
+}
+
+/* Returns the value below which _percentile % of the added bins lie, 0 if nothing was added */
+uint32_t floor_estimator_percentile(const floor_estimator_t *fe, uint32_t _percentile);
+
+#endif /* FLOOR_ESTIMATOR_H */
@@ -0,0 +1,112 @@
+#include "iq_ring.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+uint8_t iq_ring_init(iq_ring_t *ring, arena_t *arena, uint32_t _block_count, uint32_t _block_samples, iq_sample_format_t _format)
+{
+    uint32_t i;
+    uint32_t sample_bytes = _format == IQ_SAMPLE_INT16 ? sizeof(int16_t) : sizeof(float);
+    size_t page_size = sysconf(_SC_PAGESIZE);
+
+    if(_block_count < 2 || (_block_count & (_block_count - 1)) != 0)
+    {
+        printf("iq_ring_init(): block count %d is not a power of two (2 or more)\n", _block_count);
+        return 0;
+    }
+
+    ring->blocks = arena_alloc(arena, sizeof(iq_block_t) * _block_count, ARENA_CACHE_LINE);
+    if(ring->blocks == NULL)
+    {
+        return 0;
+    }
+    for(i = 0; i < _block_count; i++)
+    {
+        ring->blocks[i].samples = arena_alloc(arena, sample_bytes * 2 * _block_samples, page_size);
+        if(ring->blocks[i].samples == NULL)
+        {
+            return 0;
+        }
+    }
+
+    ring->block_count = _block_count;
+    ring->block_samples = _block_samples;
+    ring->sample_format = _format;
+    ring->sample_bytes = sample_bytes;
+    ring->head = 0;
+    ring->sample_index = 0;
+    pthread_mutex_init(&ring->mutex, NULL);
+    pthread_cond_init(&ring->signal, NULL);
+
+    return 1;
+}
+
+void iq_ring_write(iq_ring_t *ring, const void *samples, uint32_t sample_count, const struct timespec *timestamp, uint32_t _epoch)
+{
+    uint64_t head = ring->head;
+    iq_block_t *block = &ring->blocks[head & (ring->block_count - 1)];
+
+    if(sample_count > ring->block_samples)
+    {
+        sample_count = ring->block_samples;
+    }
+
+    memcpy(block->samples, samples, ring->sample_bytes * 2 * sample_count);
+    block->sequence = head;
+    block->sample_index = ring->sample_index;
+    block->timestamp = *timestamp;
+    block->sample_count = sample_count;
+    block->epoch = _epoch;
+    ring->sample_index += sample_count;
+
+    /* Publish the block */
+    pthread_mutex_lock(&ring->mutex);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&ring->signal);
+    pthread_mutex_unlock(&ring->mutex);
+}
+
+const iq_block_t *iq_ring_read(iq_ring_t *ring, uint64_t *sequence, uint64_t *skipped)
+{
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if(*sequence >= head)
+    {
+        /* Wait for signalled input */
+        pthread_mutex_lock(&ring->mutex);
+        while(*sequence >= (head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)))
+        {
+            pthread_cond_wait(&ring->signal, &ring->mutex);
+        }
+        pthread_mutex_unlock(&ring->mutex);
+    }
+
+    /* Block *sequence is overwritten once the producer reaches *sequence + block_count,
+     *  if we're that far behind, skip to the middle of the ring to leave some headroom */
+    if(head - *sequence >= ring->block_count)
+    {
+        *skipped += (head - (ring->block_count / 2)) - *sequence;
+        *sequence = head - (ring->block_count / 2);
+    }
+
+    return &ring->blocks[*sequence & (ring->block_count - 1)];
+}
+
+bool iq_ring_valid(iq_ring_t *ring, uint64_t _sequence)
+{
+    /* The producer is writing block 'head', so _sequence is intact while head < _sequence + block_count */
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) < _sequence + ring->block_count;
+}
+
+uint64_t iq_ring_head(iq_ring_t *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+uint64_t iq_ring_backlog(iq_ring_t *ring, uint64_t _sequence)
+{
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    return head > _sequence ? head - _sequence : 0;
+}
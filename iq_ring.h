@@ -0,0 +1,72 @@
+#ifndef IQ_RING_H
+#define IQ_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "arena.h"
+
+/* IQ sample ring
+ *
+ * Single producer (the libairspy callback), any number of consumers each holding their own block
+ * sequence number. The producer never waits: a consumer that falls more than the ring behind skips
+ * forward and is told how many blocks it lost. Block sample buffers are page aligned in the arena.
+ * Samples are float, or int16 for a fixed-point pipeline (see fft_fixed.h), which only its FFT thread reads.
+ */
+
+typedef enum {
+    IQ_SAMPLE_FLOAT32 = 0,
+    IQ_SAMPLE_INT16
+} iq_sample_format_t;
+
+typedef struct {
+    uint64_t sequence;
+    /* Index of the first sample since the start of the stream */
+    uint64_t sample_index;
+    /* CLOCK_REALTIME of the first sample */
+    struct timespec timestamp;
+    uint32_t sample_count;
+    /* Tuning epoch of the source (see pipeline_tune_request()), samples of different epochs are not continuous */
+    uint32_t epoch;
+    /* Interleaved I/Q, of the ring's sample format */
+    void *samples;
+} CACHE_LINE_ALIGNED iq_block_t;
+
+typedef struct {
+    iq_block_t *blocks;
+    uint32_t block_count;
+    uint32_t block_samples;
+    iq_sample_format_t sample_format;
+    /* Bytes per I or Q */
+    uint32_t sample_bytes;
+
+    /* Number of blocks written, only the producer writes it */
+    uint64_t head CACHE_LINE_ALIGNED;
+    uint64_t sample_index;
+
+    pthread_mutex_t mutex CACHE_LINE_ALIGNED;
+    pthread_cond_t signal;
+} iq_ring_t;
+
+/* _block_count must be a power of two. Returns 1 on success. */
+uint8_t iq_ring_init(iq_ring_t *ring, arena_t *arena, uint32_t _block_count, uint32_t _block_samples, iq_sample_format_t _format);
+
+/* Producer: copy a block of samples into the ring and wake consumers */
+void iq_ring_write(iq_ring_t *ring, const void *samples, uint32_t sample_count, const struct timespec *timestamp, uint32_t _epoch);
+
+/* Consumer: wait for block *sequence. If it has already been overwritten, *sequence is moved forward
+ *  and the number of blocks lost is added to *skipped. */
+const iq_block_t *iq_ring_read(iq_ring_t *ring, uint64_t *sequence, uint64_t *skipped);
+
+/* Consumer: true if block _sequence has not been overwritten, call after use to validate what was read */
+bool iq_ring_valid(iq_ring_t *ring, uint64_t _sequence);
+
+/* Sequence of the next block to be written, where a consumer joining a running ring starts */
+uint64_t iq_ring_head(iq_ring_t *ring);
+
+/* Number of blocks written but not yet read by a consumer at _sequence */
+uint64_t iq_ring_backlog(iq_ring_t *ring, uint64_t _sequence);
+
+#endif /* IQ_RING_H */
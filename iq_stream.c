@@ -0,0 +1,396 @@
+#include "iq_stream.h"
+#include "json.h"
+
+typedef struct {
+    uint64_t sample_index;
+    uint32_t sample_rate;
+    int32_t offset_hz;
+    uint32_t sample_count;
+    uint8_t format;
+    uint8_t exponent;
+    uint16_t flags;
+} iq_frame_header_t;
+
+_Static_assert(sizeof(iq_frame_header_t) == IQ_STREAM_HEADER_LENGTH, "IQ frame header is not packed");
+
+#define IQ_STREAM_REQUEST_LENGTH    256
+
+uint8_t iq_streams_init(iq_streams_t *streams, arena_t *arena, iq_ring_t *ring, uint32_t _sample_rate)
+{
+    iq_subscription_t *subscription;
+    uint32_t i, j;
+    /* The DDC decimates by at least DDC_FIR_DECIMATION, plus one for a sample carried between blocks */
+    uint32_t frame_samples = (ring->block_samples / DDC_FIR_DECIMATION) + 1;
+
+    memset(streams, 0, sizeof(iq_streams_t));
+    streams->ring = ring;
+    streams->sample_rate = _sample_rate;
+    pthread_mutex_init(&streams->mutex, NULL);
+
+    for(i = 0; i < IQ_STREAM_SUBSCRIPTIONS_MAX; i++)
+    {
+        subscription = &streams->subscriptions[i];
+        if(!ddc_init(&subscription->ddc, arena, 0, _sample_rate, DDC_FIR_DECIMATION))
+        {
+            return 0;
+        }
+        subscription->ddc_output = arena_alloc(arena, sizeof(float) * 2 * frame_samples, ARENA_CACHE_LINE);
+        if(subscription->ddc_output == NULL)
+        {
+            return 0;
+        }
+        for(j = 0; j < IQ_STREAM_FRAMES; j++)
+        {
+            subscription->frames[j] = arena_alloc(arena,
+                LWS_PRE + IQ_STREAM_HEADER_LENGTH + (sizeof(int16_t) * 2 * frame_samples), ARENA_CACHE_LINE);
+            if(subscription->frames[j] == NULL)
+            {
+                return 0;
+            }
+        }
+        pthread_mutex_init(&subscription->mutex, NULL);
+    }
+
+    streams->send_frame = arena_alloc(arena, LWS_PRE + IQ_STREAM_HEADER_LENGTH + (sizeof(int16_t) * 2 * frame_samples), ARENA_CACHE_LINE);
+    if(streams->send_frame == NULL)
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+uint32_t iq_subscription_rate(const iq_streams_t *streams, const iq_subscription_t *subscription)
+{
+    return streams->sample_rate / subscription->decimation;
+}
+
+/* Scale and pack the DDC output into the next frame */
+static void iq_frame_pack(const iq_streams_t *streams, iq_subscription_t *subscription, uint32_t _count)
+{
+    uint32_t slot = subscription->frame_head & (IQ_STREAM_FRAMES - 1);
+    uint8_t *frame = &subscription->frames[slot][LWS_PRE];
+    const float *samples = subscription->ddc_output;
+    int16_t *output16 = (int16_t *)&frame[IQ_STREAM_HEADER_LENGTH];
+    int8_t *output8 = (int8_t *)&frame[IQ_STREAM_HEADER_LENGTH];
+    iq_frame_header_t header;
+    float peak = 0.0f, full_scale, scale;
+    int32_t exponent;
+    uint32_t i;
+
+    for(i = 0; i < 2 * _count; i++)
+    {
+        peak = fmaxf(peak, fabsf(samples[i]));
+    }
+
+    /* Largest power of two scaling that keeps the peak within the format */
+    full_scale = subscription->format == IQ_FORMAT_INT8 ? 127.0f : 32767.0f;
+    exponent = peak > 0.0f ? (int32_t)floorf(log2f(full_scale / peak)) : 0;
+    if(exponent < 0)
+    {
+        exponent = 0;
+    }
+    else if(exponent > 63)
+    {
+        exponent = 63;
+    }
+    scale = ldexpf(1.0f, exponent);
+
+    if(subscription->format == IQ_FORMAT_INT8)
+    {
+        for(i = 0; i < 2 * _count; i++)
+        {
+            output8[i] = lrintf(samples[i] * scale);
+        }
+    }
+    else
+    {
+        for(i = 0; i < 2 * _count; i++)
+        {
+            output16[i] = lrintf(samples[i] * scale);
+        }
+    }
+
+    header.sample_index = subscription->sample_index;
+    header.sample_rate = iq_subscription_rate(streams, subscription);
+    header.offset_hz = subscription->offset_hz;
+    header.sample_count = _count;
+    header.format = subscription->format;
+    header.exponent = exponent;
+    header.flags = subscription->discontinuity ? IQ_FLAG_DISCONTINUITY : 0;
+    memcpy(frame, &header, IQ_STREAM_HEADER_LENGTH);
+
+    subscription->frame_lengths[slot] = IQ_STREAM_HEADER_LENGTH
+        + ((subscription->format == IQ_FORMAT_INT8 ? sizeof(int8_t) : sizeof(int16_t)) * 2 * _count);
+}
+
+/* IQ Thread */
+static void *thread_iq(void *arg)
+{
+    iq_streams_t *streams = (iq_streams_t *)arg;
+    iq_subscription_t *subscription;
+    const iq_block_t *block;
+    uint64_t sequence, skipped;
+    uint32_t i, count, epoch = 0;
+    bool lost, retuned;
+
+    /* The source is already running, start from its next block */
+    sequence = iq_ring_head(streams->ring);
+    skipped = 0;
+
+    while(1)
+    {
+        /* Wait for the next block of IQ */
+        block = iq_ring_read(streams->ring, &sequence, &streams->blocks_skipped);
+        lost = streams->blocks_skipped != skipped;
+        retuned = block->epoch != epoch;
+        epoch = block->epoch;
+
+        for(i = 0; i < IQ_STREAM_SUBSCRIPTIONS_MAX; i++)
+        {
+            subscription = &streams->subscriptions[i];
+
+            pthread_mutex_lock(&subscription->mutex);
+            if(subscription->active)
+            {
+                if(!subscription->configured)
+                {
+                    ddc_configure(&subscription->ddc, subscription->offset_hz, streams->sample_rate, subscription->decimation);
+                    subscription->sample_index = 0;
+                    subscription->discontinuity = false;
+                    subscription->configured = true;
+                }
+                else if(retuned)
+                {
+                    /* The source frequency may have changed under the DDC, its rate only with no subscriptions */
+                    ddc_configure(&subscription->ddc, subscription->offset_hz,
+                        __atomic_load_n(&streams->sample_rate, __ATOMIC_RELAXED), subscription->decimation);
+                    subscription->discontinuity = true;
+                }
+                else if(lost)
+                {
+                    subscription->discontinuity = true;
+                }
+
+                count = ddc_process(&subscription->ddc, block->samples, block->sample_count, subscription->ddc_output);
+                if(count > 0)
+                {
+                    iq_frame_pack(streams, subscription, count);
+                    __atomic_store_n(&subscription->frame_head, subscription->frame_head + 1, __ATOMIC_RELEASE);
+                    subscription->sample_index += count;
+                    subscription->discontinuity = false;
+                }
+            }
+            pthread_mutex_unlock(&subscription->mutex);
+        }
+
+        /* Count the block as lost if the source lapped us while we were reading it */
+        if(!iq_ring_valid(streams->ring, sequence))
+        {
+            streams->blocks_skipped++;
+        }
+        skipped = streams->blocks_skipped;
+        sequence++;
+    }
+
+    return NULL;
+}
+
+uint8_t iq_streams_start(iq_streams_t *streams)
+{
+    if(pthread_create(&streams->thread, NULL, thread_iq, streams))
+    {
+        return 0;
+    }
+    return 1;
+}
+
+iq_subscription_t *iq_streams_subscribe(iq_streams_t *streams, int32_t _offset_hz, uint32_t _bandwidth_hz, uint8_t _format, const char **error)
+{
+    iq_subscription_t *subscription = NULL;
+    uint32_t i, decimation, rate;
+
+    if(_format != IQ_FORMAT_INT16 && _format != IQ_FORMAT_INT8)
+    {
+        *error = "unknown format";
+        return NULL;
+    }
+    if(_bandwidth_hz == 0)
+    {
+        *error = "no bandwidth";
+        return NULL;
+    }
+
+    /* Decimate as far as the bandwidth allows, in the steps the DDC supports */
+    decimation = streams->sample_rate / (_bandwidth_hz * IQ_STREAM_OVERSAMPLE);
+    decimation -= decimation % DDC_FIR_DECIMATION;
+    if(decimation < DDC_FIR_DECIMATION)
+    {
+        decimation = DDC_FIR_DECIMATION;
+    }
+    else if(decimation > DDC_FIR_DECIMATION * DDC_CIC_DECIMATION_MAX)
+    {
+        decimation = DDC_FIR_DECIMATION * DDC_CIC_DECIMATION_MAX;
+    }
+    rate = streams->sample_rate / decimation;
+
+    if(rate > IQ_STREAM_RATE_MAX)
+    {
+        *error = "bandwidth over limit";
+        return NULL;
+    }
+    /* In 64 bits, the parser lets through INT32_MIN */
+    if((uint64_t)llabs((int64_t)_offset_hz) + (rate / 2) > streams->sample_rate / 2)
+    {
+        *error = "outside of band";
+        return NULL;
+    }
+
+    pthread_mutex_lock(&streams->mutex);
+
+    if(streams->rate_changing)
+    {
+        pthread_mutex_unlock(&streams->mutex);
+        *error = "sample rate changing";
+        return NULL;
+    }
+    if(streams->clients >= IQ_STREAM_CLIENTS_MAX)
+    {
+        pthread_mutex_unlock(&streams->mutex);
+        *error = "too many IQ clients";
+        return NULL;
+    }
+
+    /* Share an identical subscription */
+    for(i = 0; i < IQ_STREAM_SUBSCRIPTIONS_MAX; i++)
+    {
+        if(streams->subscriptions[i].active
+            && streams->subscriptions[i].offset_hz == _offset_hz
+            && streams->subscriptions[i].decimation == decimation
+            && streams->subscriptions[i].format == _format)
+        {
+            subscription = &streams->subscriptions[i];
+            break;
+        }
+    }
+
+    /* Otherwise set up a free one */
+    for(i = 0; subscription == NULL && i < IQ_STREAM_SUBSCRIPTIONS_MAX; i++)
+    {
+        if(!streams->subscriptions[i].active)
+        {
+            subscription = &streams->subscriptions[i];
+
+            pthread_mutex_lock(&subscription->mutex);
+            subscription->offset_hz = _offset_hz;
+            subscription->decimation = decimation;
+            subscription->format = _format;
+            subscription->clients = 0;
+            subscription->configured = false;
+            subscription->active = true;
+            pthread_mutex_unlock(&subscription->mutex);
+        }
+    }
+
+    if(subscription == NULL)
+    {
+        pthread_mutex_unlock(&streams->mutex);
+        *error = "no free IQ subscriptions";
+        return NULL;
+    }
+
+    subscription->clients++;
+    streams->clients++;
+
+    pthread_mutex_unlock(&streams->mutex);
+
+    return subscription;
+}
+
+void iq_streams_unsubscribe(iq_streams_t *streams, iq_subscription_t *subscription)
+{
+    pthread_mutex_lock(&streams->mutex);
+
+    streams->clients--;
+    if(--subscription->clients == 0)
+    {
+        pthread_mutex_lock(&subscription->mutex);
+        subscription->active = false;
+        pthread_mutex_unlock(&subscription->mutex);
+    }
+
+    pthread_mutex_unlock(&streams->mutex);
+}
+
+bool iq_streams_rate_change_begin(iq_streams_t *streams)
+{
+    bool allowed;
+
+    pthread_mutex_lock(&streams->mutex);
+    allowed = (streams->clients == 0);
+    streams->rate_changing = allowed;
+    pthread_mutex_unlock(&streams->mutex);
+
+    return allowed;
+}
+
+void iq_streams_rate_change_end(iq_streams_t *streams, uint32_t _sample_rate)
+{
+    pthread_mutex_lock(&streams->mutex);
+    __atomic_store_n(&streams->sample_rate, _sample_rate, __ATOMIC_RELAXED);
+    streams->rate_changing = false;
+    pthread_mutex_unlock(&streams->mutex);
+}
+
+bool iq_subscription_copy(iq_subscription_t *subscription, uint64_t *sequence, uint8_t *frame, uint32_t *length)
+{
+    uint64_t head = subscription->frame_head;
+
+    if(*sequence >= head)
+    {
+        return false;
+    }
+
+    /* Too far behind, drop to the newest frame (the client sees the gap in the sample index) */
+    if(head - *sequence > IQ_STREAM_FRAMES / 2)
+    {
+        *sequence = head - 1;
+    }
+
+    *length = subscription->frame_lengths[*sequence & (IQ_STREAM_FRAMES - 1)];
+    memcpy(&frame[LWS_PRE], &subscription->frames[*sequence & (IQ_STREAM_FRAMES - 1)][LWS_PRE], *length);
+    (*sequence)++;
+
+    return true;
+}
+
+bool iq_stream_request_parse(const char *request, size_t _length, int32_t *offset_hz, uint32_t *bandwidth_hz, uint8_t *format)
+{
+    char json[IQ_STREAM_REQUEST_LENGTH], format_name[8];
+    int64_t offset, bandwidth;
+
+    if(_length >= sizeof(json))
+    {
+        return false;
+    }
+    memcpy(json, request, _length);
+    json[_length] = '\0';
+
+    if(!json_integer(json, "offset", &offset) || !json_integer(json, "bandwidth", &bandwidth)
+        || offset < INT32_MIN || offset > INT32_MAX || bandwidth < 0 || bandwidth > UINT32_MAX)
+    {
+        return false;
+    }
+    *offset_hz = offset;
+    *bandwidth_hz = bandwidth;
+
+    /* Optional, defaults to int16, an unknown one is refused on subscribing */
+    *format = IQ_FORMAT_INT16;
+    if(json_string(json, "format", format_name, sizeof(format_name)))
+    {
+        *format = strcmp(format_name, "int16") == 0 ? IQ_FORMAT_INT16
+            : (strcmp(format_name, "int8") == 0 ? IQ_FORMAT_INT8 : IQ_FORMAT_UNKNOWN);
+    }
+
+    return true;
+}
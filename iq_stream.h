@@ -0,0 +1,122 @@
+#ifndef IQ_STREAM_H
+#define IQ_STREAM_H
+
+#include "main.h"
+#include <stdbool.h>
+
+#include "arena.h"
+#include "iq_ring.h"
+#include "ddc.h"
+
+/* Decimated IQ streams for remote demodulation
+ *
+ * A client asks for a sub-band by offset from the pipeline centre and bandwidth. Each distinct
+ * request (same offset, decimation and format) is a subscription with its own DDC, shared by every
+ * client that asked for it. One IQ thread per pipeline runs all active subscriptions over each block
+ * of the ring, and packs the output into a short ring of frames that the websocket thread drains.
+ *
+ * Frames are little-endian binary:
+ *
+ *   0  uint64  sample index of the first sample, counted in the decimated stream since it was set up
+ *   8  uint32  sample rate (Hz)
+ *  12  int32   offset from the pipeline centre frequency (Hz)
+ *  16  uint32  sample count (complex samples)
+ *  20  uint8   format, IQ_FORMAT_INT16 or IQ_FORMAT_INT8
+ *  21  uint8   exponent, each value is scaled by 2^-exponent
+ *  22  uint16  flags, IQ_FLAG_DISCONTINUITY if samples were lost from the source, or it retuned, before this frame
+ *  24  int16[2*count] or int8[2*count], interleaved I/Q
+ *
+ * The exponent is chosen per frame so the largest value fills the format (block floating point),
+ *  which lets int8 carry weak signals at a quarter of the bytes of float. A client that falls behind
+ *  skips frames, which shows as a jump in the sample index.
+ */
+
+#define IQ_STREAM_SUBSCRIPTIONS_MAX 4
+#define IQ_STREAM_CLIENTS_MAX       16
+/* Highest sample rate served to one client */
+#define IQ_STREAM_RATE_MAX          1000000
+/* Output rate relative to the requested bandwidth, for the DDC's transition band */
+#define IQ_STREAM_OVERSAMPLE        1.25
+
+#define IQ_STREAM_FRAMES            16
+#define IQ_STREAM_HEADER_LENGTH     24
+
+/* Requested as "format":"int16" or "int8", anything else is parsed as IQ_FORMAT_UNKNOWN and refused */
+#define IQ_FORMAT_UNKNOWN           0
+#define IQ_FORMAT_INT16             1
+#define IQ_FORMAT_INT8              2
+
+#define IQ_FLAG_DISCONTINUITY       0x0001
+
+typedef struct {
+    /* Set by subscribers under the streams mutex */
+    bool active;
+    int32_t offset_hz;
+    uint32_t decimation;
+    uint8_t format;
+    uint32_t clients;
+
+    /* IQ thread only */
+    bool configured;
+    ddc_t ddc;
+    float *ddc_output;
+    uint64_t sample_index;
+    bool discontinuity;
+
+    /* Frames, LWS_PRE + header + samples each */
+    uint8_t *frames[IQ_STREAM_FRAMES];
+    uint32_t frame_lengths[IQ_STREAM_FRAMES];
+    uint64_t frame_head;
+    pthread_mutex_t mutex CACHE_LINE_ALIGNED;
+} iq_subscription_t;
+
+typedef struct {
+    iq_ring_t *ring;
+    uint32_t sample_rate;
+
+    iq_subscription_t subscriptions[IQ_STREAM_SUBSCRIPTIONS_MAX];
+    uint32_t clients;
+    /* New subscriptions are refused while the source changes sample rate */
+    bool rate_changing;
+    pthread_mutex_t mutex;
+
+    pthread_t thread;
+    uint64_t blocks_skipped;
+
+    /* The websocket thread's copy of the frame it is sending, LWS_PRE + header + samples */
+    uint8_t *send_frame;
+} iq_streams_t;
+
+/* Allocate the subscriptions for a source ring. Returns 1 on success. */
+uint8_t iq_streams_init(iq_streams_t *streams, arena_t *arena, iq_ring_t *ring, uint32_t _sample_rate);
+
+/* Start the IQ thread. Returns 1 on success. */
+uint8_t iq_streams_start(iq_streams_t *streams);
+
+/* Subscribe to a sub-band, sharing an existing subscription if one matches.
+ *  Returns NULL with *error set if the request is invalid or a limit has been reached. */
+iq_subscription_t *iq_streams_subscribe(iq_streams_t *streams, int32_t _offset_hz, uint32_t _bandwidth_hz, uint8_t _format, const char **error);
+
+void iq_streams_unsubscribe(iq_streams_t *streams, iq_subscription_t *subscription);
+
+/* Before the source changes sample rate: refused (returns false) while any client is subscribed, as
+ *  each subscription's decimation and band edge were checked at the current rate. Otherwise new
+ *  subscriptions are refused until iq_streams_rate_change_end(). */
+bool iq_streams_rate_change_begin(iq_streams_t *streams);
+
+/* After the change, at the source's new _sample_rate (or the old one if it failed) */
+void iq_streams_rate_change_end(iq_streams_t *streams, uint32_t _sample_rate);
+
+/* With subscription->mutex held: copy the next frame for a client at *sequence into frame (LWS_PRE
+ *  first, as send_frame), skipping ahead if it has fallen too far behind. Returns false if there is
+ *  nothing new. */
+bool iq_subscription_copy(iq_subscription_t *subscription, uint64_t *sequence, uint8_t *frame, uint32_t *length);
+
+/* Parse a client request, {"offset":<Hz>,"bandwidth":<Hz>,"format":"int16"|"int8"}, the format
+ *  int16 if left out. Returns false if malformed. */
+bool iq_stream_request_parse(const char *request, size_t _length, int32_t *offset_hz, uint32_t *bandwidth_hz, uint8_t *format);
+
+/* Output sample rate of a subscription */
+uint32_t iq_subscription_rate(const iq_streams_t *streams, const iq_subscription_t *subscription);
+
+#endif /* IQ_STREAM_H */
@@ -0,0 +1,51 @@
+#include "json.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool json_integer(const char *json, const char *_key, int64_t *value)
+{
+    char pattern[32];
+    const char *p;
+    char *end;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\"", _key);
+    p = strstr(json, pattern);
+    if(p == NULL || (p = strchr(p + strlen(pattern), ':')) == NULL)
+    {
+        return false;
+    }
+    *value = strtoll(p + 1, &end, 10);
+    return end != p + 1;
+}
+
+bool json_string(const char *json, const char *_key, char *value, size_t _size)
+{
+    char pattern[32];
+    const char *p, *end;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\"", _key);
+    for(p = strstr(json, pattern); p != NULL; p = strstr(p, pattern))
+    {
+        p += strlen(pattern);
+        p += strspn(p, " \t\r\n");
+        if(*p == ':')
+        {
+            break;
+        }
+    }
+    if(p == NULL)
+    {
+        return false;
+    }
+
+    value[0] = '\0';
+    p += 1 + strspn(p + 1, " \t\r\n");
+    if(*p == '"' && (end = strchr(p + 1, '"')) != NULL && (size_t)(end - (p + 1)) < _size)
+    {
+        memcpy(value, p + 1, end - (p + 1));
+        value[end - (p + 1)] = '\0';
+    }
+    return true;
+}
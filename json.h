@@ -0,0 +1,18 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Fields of the flat JSON objects clients send as requests (already NUL terminated), without escapes */
+
+/* Find the integer value of "_key":. Returns true with *value set if the key is present with an integer. */
+bool json_integer(const char *json, const char *_key, int64_t *value);
+
+/* Find the string value of "_key":, the key being followed by a colon so a value equal to it is not
+ *  taken for it. Returns false if the key is absent, otherwise true with the string copied into value,
+ *  or value set to "" if it is not a string shorter than _size. */
+bool json_string(const char *json, const char *_key, char *value, size_t _size);
+
+#endif /* JSON_H */
@@ -0,0 +1,226 @@
+#include "line_profile.h"
+
+#define LINE_PROFILE_PATH_LENGTH    256
+#define LINE_PROFILE_LINE_LENGTH    128
+
+static void line_profile_path(uint64_t _serial, uint32_t _sample_rate, char *path, size_t _path_size)
+{
+    snprintf(path, _path_size, "%s/%016"PRIX64"-%"PRIu32".txt", LINE_PROFILE_DIRECTORY, _serial, _sample_rate);
+}
+
+uint8_t line_profile_load(uint64_t _serial, uint32_t _sample_rate, float *points, uint32_t *point_count)
+{
+    char path[LINE_PROFILE_PATH_LENGTH], line[LINE_PROFILE_LINE_LENGTH];
+    uint64_t serial = 0;
+    uint32_t sample_rate = 0, count = 0, n = 0;
+    char *end;
+    double value;
+    FILE *f;
+
+    line_profile_path(_serial, _sample_rate, path, sizeof(path));
+    f = fopen(path, "r");
+    if(f == NULL)
+    {
+        return 0;
+    }
+
+    while(fgets(line, sizeof(line), f) != NULL)
+    {
+        if(line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+        if(sscanf(line, "serial %"SCNx64, &serial) == 1
+            || sscanf(line, "sample_rate %"SCNu32, &sample_rate) == 1
+            || sscanf(line, "points %"SCNu32, &count) == 1)
+        {
+            continue;
+        }
+
+        value = strtod(line, &end);
+        if(end == line || count == 0 || n == count || n == LINE_PROFILE_POINTS_MAX
+            || !isfinite(value) || fabs(value) > LINE_PROFILE_CORRECTION_MAX_DB)
+        {
+            break;
+        }
+        points[n++] = value;
+    }
+    fclose(f);
+
+    if(serial != _serial || sample_rate != _sample_rate || count < 2 || count > LINE_PROFILE_POINTS_MAX || n != count)
+    {
+        fprintf(stderr, "%s is not a valid line profile for this device and rate\n", path);
+        return 0;
+    }
+
+    *point_count = count;
+    return 1;
+}
+
+uint8_t line_profile_save(uint64_t _serial, uint32_t _sample_rate, const float *points, uint32_t _point_count)
+{
+    char path[LINE_PROFILE_PATH_LENGTH], temp_path[LINE_PROFILE_PATH_LENGTH + 8];
+    uint32_t i;
+    FILE *f;
+
+    if(mkdir(LINE_PROFILE_DIRECTORY, 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "Creating %s failed: %s\n", LINE_PROFILE_DIRECTORY, strerror(errno));
+        return 0;
+    }
+
+    /* Written aside and renamed over, so a running instance never reads half a profile */
+    line_profile_path(_serial, _sample_rate, path, sizeof(path));
+    snprintf(temp_path, sizeof(temp_path), "%s.new", path);
+    f = fopen(temp_path, "w");
+    if(f == NULL)
+    {
+        fprintf(stderr, "Opening %s failed: %s\n", temp_path, strerror(errno));
+        return 0;
+    }
+
+    fprintf(f, "# airspy_fft_ws line profile, dB added to each point, lowest frequency first\n");
+    fprintf(f, "serial %016"PRIX64"\n", _serial);
+    fprintf(f, "sample_rate %"PRIu32"\n", _sample_rate);
+    fprintf(f, "points %"PRIu32"\n", _point_count);
+    for(i = 0; i < _point_count; i++)
+    {
+        fprintf(f, "%.6f\n", points[i]);
+    }
+
+    if(fclose(f) != 0 || rename(temp_path, path) != 0)
+    {
+        fprintf(stderr, "Writing %s failed: %s\n", path, strerror(errno));
+        unlink(temp_path);
+        return 0;
+    }
+
+    return 1;
+}
+
+void line_profile_interpolate(const float *points, uint32_t _point_count, double *values, uint32_t _fft_size,
+    double _scale, double _offset)
+{
+    /* Points per bin, and the point at the centre of bin 0: bin _fft_size/2 is point _point_count/2 */
+    const double step = (double)_point_count / _fft_size;
+    double x, frac, sum;
+    int32_t lo, hi, k;
+    uint32_t i;
+
+    for(i = 0; i < _fft_size; i++)
+    {
+        x = (((double)i - (_fft_size / 2)) * step) + (_point_count / 2);
+
+        if(step <= 1.0)
+        {
+            /* Finer bins than points, linear between the two either side */
+            if(x <= 0.0)
+            {
+                values[i] = _offset + (_scale * points[0]);
+                continue;
+            }
+            if(x >= _point_count - 1)
+            {
+                values[i] = _offset + (_scale * points[_point_count - 1]);
+                continue;
+            }
+            lo = (int32_t)x;
+            frac = x - lo;
+            values[i] = _offset + (_scale * ((points[lo] * (1.0 - frac)) + (points[lo + 1] * frac)));
+        }
+        else
+        {
+            /* Wider bins than points, the mean of the points the bin covers */
+            lo = (int32_t)ceil(x - (step / 2));
+            hi = (int32_t)ceil(x + (step / 2));
+            lo = lo < 0 ? 0 : lo;
+            hi = hi > (int32_t)_point_count ? (int32_t)_point_count : hi;
+
+            sum = 0.0;
+            for(k = lo; k < hi; k++)
+            {
+                sum += points[k];
+            }
+            values[i] = _offset + (_scale * (sum / (hi - lo)));
+        }
+    }
+}
+
+/* Median of _count values, partly reordering them */
+static float line_profile_median(float *values, uint32_t _count)
+{
+    const int32_t k = _count / 2;
+    int32_t lo = 0, hi = _count - 1, i, j;
+    float pivot, t;
+
+    /* Wirth's selection */
+    while(lo < hi)
+    {
+        pivot = values[k];
+        i = lo;
+        j = hi;
+        do
+        {
+            while(values[i] < pivot)
+            {
+                i++;
+            }
+            while(pivot < values[j])
+            {
+                j--;
+            }
+            if(i <= j)
+            {
+                t = values[i];
+                values[i] = values[j];
+                values[j] = t;
+                i++;
+                j--;
+            }
+        } while(i <= j);
+
+        if(j < k)
+        {
+            lo = i;
+        }
+        if(k < i)
+        {
+            hi = j;
+        }
+    }
+    return values[k];
+}
+
+void line_profile_measure(const double *power, uint64_t _frames, uint32_t _fft_size, uint32_t _first, uint32_t _count,
+    float *points, float *scratch)
+{
+    float *level_db = scratch;
+    float *window = &scratch[_fft_size];
+    uint32_t width, i, lo, hi;
+    float reference;
+
+    for(i = 0; i < _fft_size; i++)
+    {
+        level_db[i] = 10.0 * log10((power[i] / _frames) + 1.0e-20);
+    }
+
+    /* Passband shape, the running median of the levels (shorter at the edges) */
+    width = ((_fft_size * LINE_PROFILE_MEDIAN_PERCENT) / 100) | 1;
+    width = width < 3 ? 3 : width;
+    for(i = 0; i < _fft_size; i++)
+    {
+        lo = i > width / 2 ? i - (width / 2) : 0;
+        hi = i + (width / 2) + 1 < _fft_size ? i + (width / 2) + 1 : _fft_size;
+        memcpy(window, &level_db[lo], sizeof(float) * (hi - lo));
+        points[i] = line_profile_median(window, hi - lo);
+    }
+
+    /* Level across the output bins to correct to */
+    memcpy(window, &points[_first], sizeof(float) * _count);
+    reference = line_profile_median(window, _count);
+
+    for(i = 0; i < _fft_size; i++)
+    {
+        points[i] = fminf(fmaxf(reference - points[i], -LINE_PROFILE_CORRECTION_MAX_DB), LINE_PROFILE_CORRECTION_MAX_DB);
+    }
+}
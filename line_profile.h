@@ -0,0 +1,54 @@
+#ifndef LINE_PROFILE_H
+#define LINE_PROFILE_H
+
+#include "main.h"
+#include <stdbool.h>
+
+/* Passband (line) compensation profiles
+ *
+ * The AirSpy's filters and converter leave the noise floor sloping and rippling by a dB or two across
+ *  the band. A line profile is the correction for one device at one sample rate, measured rather than
+ *  typed in: run with -c over a terminated input, or over a band without wide carriers for long
+ *  enough that the average settles. The mean power of each FFT bin is smoothed with a running median,
+ *  which rejects carriers (with their skirts) narrower than half of it, and the correction brings each
+ *  bin up or down to the median of the output bins. Strong carriers wider than that bend the profile,
+ *  the range of corrections printed on saving shows it.
+ *
+ * Profiles are text files in LINE_PROFILE_DIRECTORY, "<serial>-<sample rate>.txt":
+ *
+ *   # comment
+ *   serial 644064DC2354AACD
+ *   sample_rate 10000000
+ *   points 1024
+ *   0.566667
+ *   ..             dB added to each point, lowest frequency first, the tuned frequency at points/2
+ *
+ * A profile applies at any FFT size: the points are interpolated to a smaller bin spacing, or
+ *  averaged over a wider one, and the result folded into the per-bin offset of the dB scaling, so
+ *  packing a frame costs the same with or without one.
+ */
+
+#define LINE_PROFILE_DIRECTORY          "line_profiles"
+#define LINE_PROFILE_POINTS_MAX         65536
+/* Width of the running median over the measured bins, as a percentage of the FFT size */
+#define LINE_PROFILE_MEDIAN_PERCENT     1
+/* Corrections are clipped to this, beyond it the bin is outside the passband, not ripple in it */
+#define LINE_PROFILE_CORRECTION_MAX_DB  12.0
+
+/* Load the profile of device _serial at _sample_rate into points (LINE_PROFILE_POINTS_MAX).
+ *  Returns 1 with *point_count set, or 0 if there is none or it is invalid. */
+uint8_t line_profile_load(uint64_t _serial, uint32_t _sample_rate, float *points, uint32_t *point_count);
+
+/* Save _point_count points as the profile of device _serial at _sample_rate. Returns 1 on success. */
+uint8_t line_profile_save(uint64_t _serial, uint32_t _sample_rate, const float *points, uint32_t _point_count);
+
+/* Resample a profile to _fft_size bins, into values[i] = _offset + (_scale * correction in dB) */
+void line_profile_interpolate(const float *points, uint32_t _point_count, double *values, uint32_t _fft_size,
+    double _scale, double _offset);
+
+/* Measure a profile from the power summed over _frames FFTs of _fft_size bins, the correction taken
+ *  from the median of bins _first to _first + _count. scratch holds 2 * _fft_size floats. */
+void line_profile_measure(const double *power, uint64_t _frames, uint32_t _fft_size, uint32_t _first, uint32_t _count,
+    float *points, float *scratch);
+
+#endif /* LINE_PROFILE_H */
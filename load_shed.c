@@ -0,0 +1,90 @@
+#include "load_shed.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Smoothing of the measured processing time, per block */
+#define LOAD_SHED_BUSY_SMOOTH   0.875
+
+uint8_t load_shed_init(load_shed_t *ls, const uint32_t *_work, uint32_t _level_count, uint64_t _budget_ns, uint32_t _restore_blocks)
+{
+    uint32_t i;
+
+    memset(ls, 0, sizeof(load_shed_t));
+
+    if(_level_count < 1 || _level_count > LOAD_SHED_LEVELS_MAX)
+    {
+        printf("load_shed_init(): %d levels out of range (1 - %d)\n", _level_count, LOAD_SHED_LEVELS_MAX);
+        return 0;
+    }
+    for(i = 0; i < _level_count; i++)
+    {
+        if(_work[i] == 0)
+        {
+            printf("load_shed_init(): level %d has no work\n", i);
+            return 0;
+        }
+        ls->work[i] = _work[i];
+    }
+    ls->level_count = _level_count;
+    ls->budget_ns = _budget_ns;
+    ls->restore_blocks = _restore_blocks;
+
+    return 1;
+}
+
+static void load_shed_set(load_shed_t *ls, uint32_t _level)
+{
+    /* Rescale the smoothed time to the new level's work so the restore prediction stays valid */
+    ls->busy_ns = (ls->busy_ns * ls->work[_level]) / ls->work[ls->level];
+    ls->level = _level;
+    ls->hold = LOAD_SHED_HOLD_BLOCKS;
+    ls->calm = 0;
+    ls->changes++;
+}
+
+bool load_shed_update(load_shed_t *ls, uint64_t _busy_ns, uint64_t _backlog)
+{
+    double predicted_ns;
+
+    ls->busy_ns = (ls->busy_ns * LOAD_SHED_BUSY_SMOOTH) + (_busy_ns * (1.0 - LOAD_SHED_BUSY_SMOOTH));
+
+    if(ls->hold > 0)
+    {
+        ls->hold--;
+    }
+
+    /* Shed load */
+    if(ls->level + 1 < ls->level_count
+        && ls->hold == 0
+        && (_backlog >= LOAD_SHED_BACKLOG || ls->busy_ns > (ls->budget_ns * LOAD_SHED_DEGRADE)))
+    {
+        load_shed_set(ls, ls->level + 1);
+        return true;
+    }
+
+    /* Restore once the next level up would fit comfortably, for long enough */
+    if(ls->level > 0)
+    {
+        predicted_ns = (ls->busy_ns * ls->work[ls->level - 1]) / ls->work[ls->level];
+        if(_backlog == 0 && predicted_ns < (ls->budget_ns * LOAD_SHED_RESTORE))
+        {
+            if(++ls->calm >= ls->restore_blocks)
+            {
+                load_shed_set(ls, ls->level - 1);
+                return true;
+            }
+        }
+        else
+        {
+            ls->calm = 0;
+        }
+    }
+
+    return false;
+}
+
+bool load_shed_overloaded(const load_shed_t *ls, uint64_t _backlog)
+{
+    return ls->level + 1 >= ls->level_count && _backlog >= LOAD_SHED_BACKLOG;
+}
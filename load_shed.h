@@ -0,0 +1,54 @@
+#ifndef LOAD_SHED_H
+#define LOAD_SHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Deadline-aware load shedding
+ *
+ * Each block of IQ must be processed within its own duration or the consumer falls behind and the
+ * ring starts overwriting blocks under it. The consumer runs at one of a number of quality levels,
+ * level 0 being full quality and each further level doing less work per block. After every block the
+ * controller is told how long the block took and how many blocks are waiting behind it:
+ *
+ *  - the level is dropped when the smoothed processing time passes LOAD_SHED_DEGRADE of the budget,
+ *     or as soon as a backlog builds up
+ *  - the level is restored once the work of the next level up would be predicted to fit within
+ *     LOAD_SHED_RESTORE of the budget, continuously for restore_blocks blocks
+ *
+ * The gap between the two thresholds and the restore delay keep the level from oscillating.
+ */
+
+#define LOAD_SHED_LEVELS_MAX        8
+
+#define LOAD_SHED_DEGRADE           0.80
+#define LOAD_SHED_RESTORE           0.50
+/* Blocks waiting in the ring at which the level is dropped straight away */
+#define LOAD_SHED_BACKLOG           2
+/* Blocks after a change before the next drop, to let the measured time settle at the new level */
+#define LOAD_SHED_HOLD_BLOCKS       8
+
+typedef struct {
+    /* Relative work per block at each level, decreasing */
+    uint32_t work[LOAD_SHED_LEVELS_MAX];
+    uint32_t level_count;
+    uint64_t budget_ns;
+    uint32_t restore_blocks;
+
+    uint32_t level;
+    double busy_ns;
+    uint32_t hold;
+    uint32_t calm;
+    uint64_t changes;
+} load_shed_t;
+
+/* _work[] gives the relative cost of a block at each of _level_count levels. Returns 1 on success. */
+uint8_t load_shed_init(load_shed_t *ls, const uint32_t *_work, uint32_t _level_count, uint64_t _budget_ns, uint32_t _restore_blocks);
+
+/* Report a processed block, returns true if the level has changed */
+bool load_shed_update(load_shed_t *ls, uint64_t _busy_ns, uint64_t _backlog);
+
+/* True if at the lowest level with a backlog still building, so whole blocks should be dropped */
+bool load_shed_overloaded(const load_shed_t *ls, uint64_t _backlog);
+
+#endif /* LOAD_SHED_H */
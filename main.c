@@ -1,4 +1,11 @@
 #include "main.h"
+#include "realtime.h"
+#include "arena.h"
+#include "pipeline.h"
+#include "relay.h"
+#include "control.h"
+#include "admission.h"
+#include "selftest.h"
 #include <float.h>
 
 /*** Remember to talk to Rob M0DTS about his minitiune click software before making changes! ***/
@@ -6,9 +13,17 @@
 #define WS_PORT         7681
 #define WS_INTERVAL         250
 #define WS_INTERVAL_FAST    100
+/* Each frame is the mean power over this long, a multiple of its interval (see pipeline.h) */
+#define FFT_WINDOW          250
+#define FFT_WINDOW_FAST     100
 
 #define FFT_SIZE        1024
-#define FFT_TIME_SMOOTH 0.9995f // 0.0 - 1.0
+
+/* Spectral estimator: FILTERBANK_HANN, or FILTERBANK_WOLA for sharper carrier edges (see filterbank.h) */
+#define FFT_ESTIMATOR       FILTERBANK_HANN
+#define FFT_ESTIMATOR_TAPS  4
+/* FFT frame overlap in %: 0, 50 or 75. Shed automatically under CPU pressure, see load_shed.h */
+#define FFT_OVERLAP         50
 
 #define AIRSPY_FREQ     745000000
 
@@ -16,19 +31,128 @@
 
 #define AIRSPY_SERIAL	0x644064DC2354AACD // WB
 
+/* Thread CPU affinity, as a CPU list such as "2-3" or "0,2" ("" leaves the thread on all CPUs) */
+#define CPU_AFFINITY_MAIN       ""
+#define CPU_AFFINITY_AIRSPY     "" // libairspy USB transfer & sample conversion threads
+#define CPU_AFFINITY_FFT        ""
+#define CPU_AFFINITY_WS         ""
+
+/* SCHED_FIFO priority (1-99), 0 leaves the thread on the default scheduler */
+#define SCHED_FIFO_PRIORITY_AIRSPY  0
+#define SCHED_FIFO_PRIORITY_FFT     0
+
+/* Open websockets per host, 0 for no limit. A browser opens one per protocol, a relay one per protocol
+ *  of each pipeline (see admission.h) */
+#define ADMISSION_HOST_CONNECTIONS_MAX  32
+/* Hosts exempt from the per-host limit besides loopback, eg. "192.0.2.10,2001:db8::10" for a reverse
+ *  proxy or relay in front that all its viewers share */
+#define ADMISSION_TRUSTED_HOSTS         ""
+
+/* Lock all memory, the pipeline buffers are pre-faulted when the arena is sealed */
+//#define MEMORY_LOCK
+
+/* Pipeline buffer arena, optionally backed by 2MB huge pages */
+#define ARENA_SIZE      (64*1024*1024)
+//#define ARENA_HUGEPAGES
+
+/** Pipelines, one per AirSpy **/
+static const pipeline_config_t pipeline_configs[] = {
+    {
+        .name = "wb",
+        .legacy_protocols = true,
+        .serial = AIRSPY_SERIAL,
+        .freq_hz = AIRSPY_FREQ,
+        .sample_rate = AIRSPY_SAMPLE,
+        .biast = 0,
+        .linearity_gain = 12,
+        .sensitivity_gain = 10,
+        .fft_size = FFT_SIZE,
+        .estimator = FFT_ESTIMATOR,
+        .estimator_taps = FFT_ESTIMATOR_TAPS,
+        .overlap = FFT_OVERLAP,
+        .iq_stream = true,
+        .shm_spectrum = true,
+        /* eg. keep 2s of IQ and record it with 8s more on request or a new carrier (raise ARENA_SIZE by 256MB)
+        .capture_seconds = 2,
+        .capture_post_seconds = 8,
+        .capture_on_carrier = true,
+        */
+        .cpu_affinity_airspy = CPU_AFFINITY_AIRSPY,
+        .cpu_affinity_fft = CPU_AFFINITY_FFT,
+        .fifo_priority_airspy = SCHED_FIFO_PRIORITY_AIRSPY,
+        .fifo_priority_fft = SCHED_FIFO_PRIORITY_FFT,
+    },
+    /* eg. a second AirSpy on the narrowband transponder, served as "nb.fft" etc.
+    {
+        .name = "nb",
+        .serial = 0x0000000000000000,
+        .freq_hz = 739675000,
+        .sample_rate = 3000000,
+        .linearity_gain = 12,
+        .sensitivity_gain = 10,
+        .fft_size = 4096,
+        .estimator = FILTERBANK_WOLA,
+        .estimator_taps = 4,
+        .overlap = 0,
+        .cpu_affinity_airspy = "",
+        .cpu_affinity_fft = "",
+    },
+    */
+    /* eg. a zoom on the wideband beacon from "wb", 2.5MSPS with 2.4kHz bins, served as "bcn.fft" etc.
+    {
+        .name = "bcn",
+        .source = "wb",
+        .freq_hz = 741500000,
+        .decimation = 4,
+        .fft_size = 1024,
+        .estimator = FILTERBANK_WOLA,
+        .estimator_taps = 4,
+        .overlap = 50,
+        .cpu_affinity_airspy = "",
+        .cpu_affinity_fft = "",
+    },
+    */
+};
+#define PIPELINES_COUNT (sizeof(pipeline_configs) / sizeof(pipeline_configs[0]))
+
+pipeline_t pipelines[PIPELINES_COUNT];
+
+/* Find an initialised pipeline by name, for zoom sources */
+static pipeline_t *pipeline_find(const char *name, uint32_t _count)
+{
+    uint32_t i;
+
+    for(i = 0; name != NULL && i < _count; i++)
+    {
+        if(strcmp(pipelines[i].config->name, name) == 0)
+        {
+            return &pipelines[i];
+        }
+    }
+    return NULL;
+}
+
+/** Pipeline buffers, all allocated from the arena at startup **/
+arena_t arena;
+
+/** Relay mode (-r), pipeline outputs are fed from an upstream instance **/
+static bool relay_mode = false;
+static relay_t relay;
+
+/** Live control, enabled by a token file **/
+static bool control_enabled = false;
+static control_t control;
+
+/** Admission control of new websocket connections **/
+static admission_t admission;
+
 /** LWS Vars **/
 int max_poll_elements;
 int debug_level = 3;
 volatile int force_exit = 0;
 struct lws_context *context;
-uint32_t lws_count_fft = 0;
-uint32_t lws_count_fft_fast = 0;
-uint32_t lws_count_fft_m0dtslivetune = 0;
-uint32_t lws_count_fft_f5oeoplutofw = 0;
-uint32_t lws_count_fft_ea7kirsatcontroller = 0;
 #define STDOUT_INTERVAL_CONNCOUNT 30*1000
 
-pthread_t fftThread;
 pthread_t wsThread;
 
 static void sleep_ms(uint32_t _duration)
@@ -44,434 +168,355 @@ static void sleep_ms(uint32_t _duration)
     }
 }
 
-/** AirSpy Vars **/
-struct airspy_device* device = NULL;
-/* Sample type -> 32bit Complex Float */
-enum airspy_sample_type sample_type_val = AIRSPY_SAMPLE_FLOAT32_IQ;
-/* Sample rate */
-uint32_t sample_rate_val = AIRSPY_SAMPLE;
-/* DC Bias Tee -> 0 (disabled) */
-uint32_t biast_val = 0;
-/* Linear Gain */
-#define LINEAR
-uint32_t linearity_gain_val = 12; // MAX=21
-/* Sensitive Gain */
-//#define SENSITIVE
-uint32_t sensitivity_gain_val = 10; // MAX=21
-/* Frequency */
-uint32_t freq_hz = AIRSPY_FREQ;
-
-double hanning_window_const[FFT_SIZE];
-
-int airspy_rx(airspy_transfer_t* transfer);
-
-#define FLOAT32_EL_SIZE_BYTE (4)
-fftw_complex* fft_in;
-fftw_complex*   fft_out;
-fftw_plan   fft_plan;
-
-static const char *fftw_wisdom_filename = ".fftw_wisdom";
-
-void setup_fft(void)
-{
-    int i;
-    /* Set up FFTW */
-    fft_in = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * FFT_SIZE);
-    fft_out = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * FFT_SIZE);
-    i = fftw_import_wisdom_from_filename(fftw_wisdom_filename);
-    if(i == 0)
-    {
-        fprintf(stdout, "Computing plan...");
-	fflush(stdout);
-    }
-    fft_plan = fftw_plan_dft_1d(FFT_SIZE, fft_in, fft_out, FFTW_FORWARD, FFTW_EXHAUSTIVE);
-    if(i == 0)
-    {
-        fftw_export_wisdom_to_filename(fftw_wisdom_filename);
-    }
-}
-
-static void close_airspy(void)
-{
-    int result;
-    
-    /* De-init AirSpy device */
-    if(device != NULL)
-    {
-	    result = airspy_stop_rx(device);
-	    if( result != AIRSPY_SUCCESS ) {
-		    printf("airspy_stop_rx() failed: %s (%d)\n", airspy_error_name(result), result);
-	    }
-
-	    result = airspy_close(device);
-	    if( result != AIRSPY_SUCCESS ) 
-	    {
-		    printf("airspy_close() failed: %s (%d)\n", airspy_error_name(result), result);
-	    }
-	
-	    airspy_exit();
-    }
-}
-
-static void close_fftw(void)
-{
-    /* De-init fftw */
-    fftw_free(fft_in);
-    fftw_free(fft_out);
-    fftw_destroy_plan(fft_plan);
-    fftw_forget_wisdom();
-}
-
-static uint8_t setup_airspy()
-{
-    int result;
-
-    result = airspy_init();
-    if( result != AIRSPY_SUCCESS ) {
-	    printf("airspy_init() failed: %s (%d)\n", airspy_error_name(result), result);
-	    return 0;
-    }
-    #ifdef AIRSPY_SERIAL
-    	result = airspy_open_sn(&device, AIRSPY_SERIAL);
-    #else
-    	result = airspy_open(&device);
-    #endif
-    if( result != AIRSPY_SUCCESS ) {
-	    printf("airspy_open() failed: %s (%d)\n", airspy_error_name(result), result);
-	    airspy_exit();
-	    return 0;
-    }
-
-    result = airspy_set_sample_type(device, sample_type_val);
-    if (result != AIRSPY_SUCCESS) {
-	    printf("airspy_set_sample_type() failed: %s (%d)\n", airspy_error_name(result), result);
-	    airspy_close(device);
-	    airspy_exit();
-	    return 0;
-    }
-
-    result = airspy_set_samplerate(device, sample_rate_val);
-    if (result != AIRSPY_SUCCESS) {
-	    printf("airspy_set_samplerate() failed: %s (%d)\n", airspy_error_name(result), result);
-	    airspy_close(device);
-	    airspy_exit();
-	    return 0;
-    }
-
-    result = airspy_set_rf_bias(device, biast_val);
-    if( result != AIRSPY_SUCCESS ) {
-	    printf("airspy_set_rf_bias() failed: %s (%d)\n", airspy_error_name(result), result);
-	    airspy_close(device);
-	    airspy_exit();
-	    return 0;
-    }
-
-    #ifdef LINEAR
-	    result =  airspy_set_linearity_gain(device, linearity_gain_val);
-	    if( result != AIRSPY_SUCCESS ) {
-		    printf("airspy_set_linearity_gain() failed: %s (%d)\n", airspy_error_name(result), result);
-	    }
-    #elif defined SENSITIVE
-	    result =  airspy_set_sensitivity_gain(device, sensitivity_gain_val);
-	    if( result != AIRSPY_SUCCESS ) {
-		    printf("airspy_set_sensitivity_gain() failed: %s (%d)\n", airspy_error_name(result), result);
-	    }
-    #endif
-
-    result = airspy_start_rx(device, airspy_rx, NULL);
-    if( result != AIRSPY_SUCCESS ) {
-	    printf("airspy_start_rx() failed: %s (%d)\n", airspy_error_name(result), result);
-	    airspy_close(device);
-	    airspy_exit();
-	    return 0;
-    }
+/* Each lws protocol serves one websocket output of a pipeline, several protocols may share an output */
+typedef struct {
+	websocket_output_t *output;
+	enum lws_write_protocol write_protocol;
+	/* IQ protocols only */
+	iq_streams_t *iq_streams;
+	/* Control protocols only */
+	pipeline_t *pipeline;
+	uint32_t connections;
+} websocket_protocol_t;
 
-    result = airspy_set_freq(device, freq_hz);
-    if( result != AIRSPY_SUCCESS ) {
-	    printf("airspy_set_freq() failed: %s (%d)\n", airspy_error_name(result), result);
-	    airspy_close(device);
-	    airspy_exit();
-	    return 0;
-    }
-    
-    return 1;
-}
+typedef struct websocket_user_session_t websocket_user_session_t;
 
-/* transfer->sample_count is normally 65536 */
-#define	AIRSPY_BUFFER_COPY_SIZE	65536
+#define WEBSOCKET_REPLY_LENGTH  160
 
-typedef struct {
-	uint32_t index;
-	uint32_t size;
-	char data[AIRSPY_BUFFER_COPY_SIZE * FLOAT32_EL_SIZE_BYTE];
-	pthread_mutex_t mutex;
-	pthread_cond_t 	signal;
-} rf_buffer_t;
-
-rf_buffer_t rf_buffer = {
-	.index = 0,
-	.size = 0,
-	.mutex = PTHREAD_MUTEX_INITIALIZER,
-	.signal = PTHREAD_COND_INITIALIZER,
-	.data = { 0 }
+struct websocket_user_session_t {
+    websocket_user_session_t *websocket_user_session_list;
+	struct lws *wsi;
+	uint32_t last_sequence_id;
+	/* IQ protocols only */
+	iq_subscription_t *iq_subscription;
+	uint64_t iq_sequence;
+	uint8_t reply[LWS_PRE + WEBSOCKET_REPLY_LENGTH];
+	uint32_t reply_length;
+	/* Control protocols only, change waiting to be applied */
+	uint32_t control_ticket;
+	/* Host in admission_t */
+	admission_ticket_t admission_ticket;
 };
 
-/* Airspy RX Callback, this is called by a new thread within libairspy */
-int airspy_rx(airspy_transfer_t* transfer)
-{    
-    if(transfer->samples != NULL && transfer->sample_count >= AIRSPY_BUFFER_COPY_SIZE)
-    {
-        pthread_mutex_lock(&rf_buffer.mutex);
-        rf_buffer.index = 0;
-        memcpy(
-            rf_buffer.data,
-            transfer->samples,
-            (AIRSPY_BUFFER_COPY_SIZE * FLOAT32_EL_SIZE_BYTE)
-        );
-        /* Double size as we're running half overlap on the FFTs, but then minus one so we don't overrun the end */
-        rf_buffer.size = (2 * (AIRSPY_BUFFER_COPY_SIZE / (FFT_SIZE * 2))) - 1;
-        pthread_cond_signal(&rf_buffer.signal);
-        pthread_mutex_unlock(&rf_buffer.mutex);
-    }
-	return 0;
-}
-
 typedef struct {
-	float data[FFT_SIZE];
-	pthread_mutex_t mutex;
-} fft_buffer_t;
-
-fft_buffer_t fft_buffer = {
-	.mutex = PTHREAD_MUTEX_INITIALIZER,
-};
+	struct lws_context *context;
+	struct lws_vhost *vhost;
+	const struct lws_protocols *protocol;
+	websocket_user_session_t *websocket_user_session_list;
+} websocket_vhost_session_t;
 
-/* FFT Thread */
-void *thread_fft(void *dummy)
+/* Admission control, common to all server protocols (see admission.h). Returns non-zero to reject the connection. */
+static int websocket_admission(struct lws *wsi, enum lws_callback_reasons reason, websocket_user_session_t *user_session, void *in)
 {
-    (void) dummy;
-    int             i, offset;
-    fftw_complex    pt;
-    double           pwr, lpwr;
-
-	double pwr_scale = 1.0 / ((float)FFT_SIZE * (float)FFT_SIZE);
-
-    while(1)
-    {
-    	/* Lock input buffer */
-    	pthread_mutex_lock(&rf_buffer.mutex);
-
-    	if(rf_buffer.index == rf_buffer.size)
-    	{
-	    	/* Wait for signalled input */
-	    	pthread_cond_wait(&rf_buffer.signal, &rf_buffer.mutex);
-    	}
-
-    	/* Move forward half an FFT length, giving half an FFT of overlap */
-    	offset = (rf_buffer.index * FFT_SIZE * 2) / 2;
-
-    	/* Copy data out of rf buffer into fft_input buffer */
-    	for (i = 0; i < FFT_SIZE; i++)
-	    {
-	        fft_in[i][0] = ((float*)rf_buffer.data)[offset+(2*i)] * hanning_window_const[i];
-	        fft_in[i][1] = ((float*)rf_buffer.data)[offset+(2*i)+1] * hanning_window_const[i];
-	    }
-
-	    rf_buffer.index++;
-
-	    /* Unlock input buffer */
-    	pthread_mutex_unlock(&rf_buffer.mutex);
-
-    	/* Run FFT */
-    	fftw_execute(fft_plan);
-
-    	/* Lock output buffer */
-    	pthread_mutex_lock(&fft_buffer.mutex);
-
-    	for (i = 0; i < FFT_SIZE; i++)
-	    {
-	        /* shift, normalize and convert to dBFS */
-	        if (i < FFT_SIZE / 2)
-	        {
-	            pt[0] = fft_out[FFT_SIZE / 2 + i][0] / FFT_SIZE;
-	            pt[1] = fft_out[FFT_SIZE / 2 + i][1] / FFT_SIZE;
-	        }
-	        else
-	        {
-	            pt[0] = fft_out[i - FFT_SIZE / 2][0] / FFT_SIZE;
-	            pt[1] = fft_out[i - FFT_SIZE / 2][1] / FFT_SIZE;
-	        }
-	        pwr = pwr_scale * ((pt[0] * pt[0]) + (pt[1] * pt[1]));
-	        lpwr = 10.f * log10(pwr + 1.0e-20);
-	        
-	        fft_buffer.data[i] = (lpwr * (1.f - FFT_TIME_SMOOTH)) + (fft_buffer.data[i] * FFT_TIME_SMOOTH);
-	    }
-
-	    /* Unlock output buffer */
-    	pthread_mutex_unlock(&fft_buffer.mutex);
-    }
+	struct sockaddr_storage address;
+	socklen_t address_length = sizeof(address);
+	int fd;
 
-}
+	switch (reason)
+	{
+		case LWS_CALLBACK_FILTER_NETWORK_CONNECTION:
+			/* Only the accepted socket exists yet, wsi is the listening one */
+			fd = (int)(intptr_t)in;
+			break;
 
-#define WEBSOCKET_OUTPUT_LENGTH	4096
-typedef struct {
-	uint8_t buffer[LWS_PRE+WEBSOCKET_OUTPUT_LENGTH];
-	uint32_t length;
-	uint32_t sequence_id;
-	pthread_mutex_t mutex;
-} websocket_output_t;
-
-websocket_output_t websocket_output = {
-	.length = 0,
-	.sequence_id = 0,
-	.mutex = PTHREAD_MUTEX_INITIALIZER
-};
+		case LWS_CALLBACK_FILTER_PROTOCOL_CONNECTION:
+		case LWS_CALLBACK_ESTABLISHED:
+			fd = lws_get_socket_fd(wsi);
+			break;
 
-websocket_output_t websocket_output_fast = {
-    .length = 0,
-    .sequence_id = 0,
-    .mutex = PTHREAD_MUTEX_INITIALIZER
-};
+		case LWS_CALLBACK_CLOSED:
+			admission_closed(&admission, &user_session->admission_ticket);
+			return 0;
 
+		default:
+			return 0;
+	}
 
-/* OLD
-#define FFT_OFFSET  85
-#define FFT_SCALE   3000.0
+	memset(&address, 0, sizeof(address));
+	if(getpeername(fd, (struct sockaddr *)&address, &address_length) != 0)
+	{
+		address.ss_family = AF_UNSPEC;
+	}
 
+	if(reason == LWS_CALLBACK_ESTABLISHED)
+	{
+		admission_established(&admission, &address, &user_session->admission_ticket);
+		return 0;
+	}
+	if(reason == LWS_CALLBACK_FILTER_NETWORK_CONNECTION)
+	{
+		return admission_connect(&admission, &address) != ADMISSION_ACCEPT;
+	}
+	return admission_upgrade(&admission, &address) != ADMISSION_ACCEPT;
+}
 
-#define FLOOR_TARGET    8500
-#define FLOOR_TIME_SMOOTH 0.995
-*/
+static int websocket_http(struct lws *wsi, const char *uri);
 
-#define FFT_PRESCALE 3.0
+int callback_fft(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
+{
+    (void)len;
+    
+	int32_t n;
+	websocket_user_session_t *user_session = (websocket_user_session_t *)user;
+	websocket_protocol_t *websocket_protocol = (websocket_protocol_t *)lws_get_protocol(wsi)->user;
+	websocket_output_t *websocket_output;
 
-#define FFT_OFFSET  (150)
-#define FFT_SCALE   (9e3)
+	websocket_vhost_session_t *vhost_session =
+			(websocket_vhost_session_t *)
+			lws_protocol_vh_priv_get(lws_get_vhost(wsi),
+					lws_get_protocol(wsi));
 
+	if(websocket_admission(wsi, reason, user_session, in) != 0)
+	{
+		return -1;
+	}
 
-#define FLOOR_TARGET	(FFT_PRESCALE * 47000)
-#define FLOOR_TIME_SMOOTH 0.995
+	switch (reason)
+	{
+		case LWS_CALLBACK_PROTOCOL_INIT:
+			vhost_session = lws_protocol_vh_priv_zalloc(lws_get_vhost(wsi),
+					lws_get_protocol(wsi),
+					sizeof(websocket_vhost_session_t));
+			vhost_session->context = lws_get_context(wsi);
+			vhost_session->protocol = lws_get_protocol(wsi);
+			vhost_session->vhost = lws_get_vhost(wsi);
+			break;
 
-#define FLOOR_OFFSET    (FFT_PRESCALE * 38000)
+		case LWS_CALLBACK_ESTABLISHED:
+			/* add ourselves to the list of live pss held in the vhd */
+			lws_ll_fwd_insert(
+				user_session,
+				websocket_user_session_list,
+				vhost_session->websocket_user_session_list
+			);
+			user_session->wsi = wsi;
+			/* Update connection count */
+			websocket_protocol->connections++;
+			break;
 
-static uint32_t lowest_smooth = FLOOR_TARGET;
+		case LWS_CALLBACK_CLOSED:
+			/* remove our closing pss from the list of live pss */
+			lws_ll_fwd_remove(
+				websocket_user_session_t,
+				websocket_user_session_list,
+				user_session,
+				vhost_session->websocket_user_session_list
+			);
+			/* Update connection count */
+			websocket_protocol->connections--;
+			break;
 
-static uint32_t fft_output_data[FFT_SIZE];
-void fft_to_buffer(websocket_output_t *_websocket_output)
-{
-	int32_t i, j;
-    uint32_t lowest;
-    int32_t offset;
-	uint16_t *websocket_output_buffer_ptr;
 
-    /* Create and append data points */
-    i = 0;
-    //uint32_t min = 0xFFFFFFFF, max = 0;
-    //float fmin = FLT_MAX, fmax = -FLT_MAX; 
+		case LWS_CALLBACK_SERVER_WRITEABLE:
+			/* Write output data, if data exists */
+			websocket_output = websocket_protocol->output;
+			pthread_mutex_lock(&websocket_output->mutex);
+			if(websocket_output->length != 0 && user_session->last_sequence_id != websocket_output->sequence_id)
+			{
+				n = lws_write(wsi, (unsigned char*)&websocket_output->buffer[LWS_PRE], websocket_output->length, websocket_protocol->write_protocol);
+				if (!n)
+				{
+					pthread_mutex_unlock(&websocket_output->mutex);
+					lwsl_err("ERROR %d writing to socket\n", n);
+					return -1;
+				}
+				user_session->last_sequence_id = websocket_output->sequence_id;
+			}
+			pthread_mutex_unlock(&websocket_output->mutex);
+			
+			break;
 
-    /* Lock FFT output buffer for reading */
-    pthread_mutex_lock(&fft_buffer.mutex);
+		case LWS_CALLBACK_RECEIVE:
+			/* Not expecting to receive anything */
+			break;
 
-    for(j=(FFT_SIZE*0.05);j<(FFT_SIZE*0.95);j++)
-    {
-        fft_output_data[i] = (uint32_t)(FFT_SCALE * (fft_buffer.data[j] + FFT_OFFSET)) + (FFT_PRESCALE*fft_line_compensation[j]);
-        //if(fft_buffer.data[j] > fmax) fmax = fft_buffer.data[j];
-        //if(fft_buffer.data[j] < fmin) fmin = fft_buffer.data[j];
+		case LWS_CALLBACK_HTTP:
+			/* Plain HTTP is served by the first protocol */
+			return websocket_http(wsi, (const char *)in);
+		
+		default:
+			break;
+	}
 
-        //if(fft_output_data[i]  > max) max = fft_output_data[i] ;
-        //if(fft_output_data[i]  < min) min = fft_output_data[i] ;
+	return 0;
+}
 
 
-        i++;
-    }
+/* Decimated IQ, the client subscribes by sending a request (see iq_stream.h) */
+int callback_iq(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
+{
+	int32_t n;
+	websocket_user_session_t *user_session = (websocket_user_session_t *)user;
+	websocket_protocol_t *websocket_protocol = (websocket_protocol_t *)lws_get_protocol(wsi)->user;
+	iq_subscription_t *subscription;
+	const char *error = NULL;
+	int32_t offset_hz;
+	uint32_t bandwidth_hz;
+	uint8_t format;
+	uint8_t *frame;
+	uint32_t length;
+	bool more, found;
 
-    /* Unlock FFT output buffer */
-    pthread_mutex_unlock(&fft_buffer.mutex);
+	websocket_vhost_session_t *vhost_session =
+			(websocket_vhost_session_t *)
+			lws_protocol_vh_priv_get(lws_get_vhost(wsi),
+					lws_get_protocol(wsi));
 
-    //printf("min: %"PRIu32"\n", min);
-    //printf("max: %"PRIu32"\n", max);
-    //printf("fmin: %f\n", fmin);
-    //printf("fmax: %f\n", fmax);
+	if(websocket_admission(wsi, reason, user_session, in) != 0)
+	{
+		return -1;
+	}
 
-   	/* Calculate noise floor */
-   	lowest = 0xFFFFFFFF;
-   	for(j = (FFT_SIZE*0.05); j < i - (FFT_SIZE*0.1); j++)
-    {
-    	if(fft_output_data[j] < lowest)
-    	{
-    		lowest = fft_output_data[j];
-    	}
-    }
-    lowest_smooth = (lowest * (1.f - FLOOR_TIME_SMOOTH)) + (lowest_smooth * FLOOR_TIME_SMOOTH);
+	switch (reason)
+	{
+		case LWS_CALLBACK_PROTOCOL_INIT:
+			vhost_session = lws_protocol_vh_priv_zalloc(lws_get_vhost(wsi),
+					lws_get_protocol(wsi),
+					sizeof(websocket_vhost_session_t));
+			vhost_session->context = lws_get_context(wsi);
+			vhost_session->protocol = lws_get_protocol(wsi);
+			vhost_session->vhost = lws_get_vhost(wsi);
+			break;
 
-    /* Compensate for noise floor */
-    offset = (FLOOR_TARGET) - lowest_smooth;
-    //printf("lowest: %d, lowest_smooth: %d, offset: %d\n", lowest, lowest_smooth, offset);
+		case LWS_CALLBACK_ESTABLISHED:
+			lws_ll_fwd_insert(
+				user_session,
+				websocket_user_session_list,
+				vhost_session->websocket_user_session_list
+			);
+			user_session->wsi = wsi;
+			user_session->iq_subscription = NULL;
+			user_session->reply_length = 0;
+			websocket_protocol->connections++;
+			break;
 
-    for(j = 0; j < i; j++)
-    {
-        /* Add noise-floor AGC offset (can be negative) */
-        fft_output_data[j] += offset;
+		case LWS_CALLBACK_CLOSED:
+			if(user_session->iq_subscription != NULL)
+			{
+				iq_streams_unsubscribe(websocket_protocol->iq_streams, user_session->iq_subscription);
+				user_session->iq_subscription = NULL;
+			}
+			lws_ll_fwd_remove(
+				websocket_user_session_t,
+				websocket_user_session_list,
+				user_session,
+				vhost_session->websocket_user_session_list
+			);
+			websocket_protocol->connections--;
+			break;
 
-        /* Subtract viewport floor offset and set to zero if underflow */
-        if(__builtin_usub_overflow(fft_output_data[j], (uint32_t)FLOOR_OFFSET, &fft_output_data[j]))
-        {
-            fft_output_data[j] = 0;
-        }
+		case LWS_CALLBACK_RECEIVE:
+			/* Any request replaces the current subscription, even a malformed one, a bandwidth of 0 just ends it */
+			if(user_session->iq_subscription != NULL)
+			{
+				iq_streams_unsubscribe(websocket_protocol->iq_streams, user_session->iq_subscription);
+				user_session->iq_subscription = NULL;
+			}
+			if(!lws_is_first_fragment(wsi) || !lws_is_final_fragment(wsi)
+				|| !iq_stream_request_parse((const char *)in, len, &offset_hz, &bandwidth_hz, &format))
+			{
+				error = "malformed request";
+			}
+			else if(bandwidth_hz > 0)
+			{
+				user_session->iq_subscription = iq_streams_subscribe(websocket_protocol->iq_streams, offset_hz, bandwidth_hz, format, &error);
+			}
 
-        /* Divide output by FFT_PRESCALE to scale for uint16_t */
-        fft_output_data[j] /= FFT_PRESCALE;
+			subscription = user_session->iq_subscription;
+			if(error != NULL)
+			{
+				n = snprintf((char *)&user_session->reply[LWS_PRE], WEBSOCKET_REPLY_LENGTH, "{\"error\":\"%s\"}", error);
+			}
+			else if(subscription != NULL)
+			{
+				user_session->iq_sequence = __atomic_load_n(&subscription->frame_head, __ATOMIC_ACQUIRE);
+				n = snprintf((char *)&user_session->reply[LWS_PRE], WEBSOCKET_REPLY_LENGTH,
+					"{\"offset\":%d,\"rate\":%d,\"decimation\":%d,\"format\":\"%s\"}",
+					subscription->offset_hz, iq_subscription_rate(websocket_protocol->iq_streams, subscription),
+					subscription->decimation, subscription->format == IQ_FORMAT_INT8 ? "int8" : "int16");
+			}
+			else
+			{
+				n = snprintf((char *)&user_session->reply[LWS_PRE], WEBSOCKET_REPLY_LENGTH, "{\"rate\":0}");
+			}
+			user_session->reply_length = n;
+			lws_callback_on_writable(wsi);
+			break;
 
-        /* Catch data overflow */
-        if(fft_output_data[j] > 0xFFFF)
-        {
-            fft_output_data[j] = 0xFFFF;
-        }
-    }
+		case LWS_CALLBACK_SERVER_WRITEABLE:
+			/* Reply to a request first */
+			if(user_session->reply_length != 0)
+			{
+				n = lws_write(wsi, &user_session->reply[LWS_PRE], user_session->reply_length, LWS_WRITE_TEXT);
+				user_session->reply_length = 0;
+				if (n < 0)
+				{
+					lwsl_err("ERROR %d writing to socket\n", n);
+					return -1;
+				}
+				lws_callback_on_writable(wsi);
+				break;
+			}
 
-    /* Lock websocket output buffer for writing */
-    pthread_mutex_lock(&_websocket_output->mutex);
-    websocket_output_buffer_ptr = (uint16_t *)&_websocket_output->buffer[LWS_PRE];
+			subscription = user_session->iq_subscription;
+			if(subscription == NULL)
+			{
+				break;
+			}
 
-    /* Copy data into websocket output buffer */
-    for(j = 0; j < i; j++)
-    {
-        websocket_output_buffer_ptr[j] = fft_output_data[j];
-    }
+			/* One frame per callback, asking for another while there are more. It is copied out so the
+			 *  IQ thread isn't held up by the socket write. */
+			n = 0;
+			frame = websocket_protocol->iq_streams->send_frame;
+			pthread_mutex_lock(&subscription->mutex);
+			found = iq_subscription_copy(subscription, &user_session->iq_sequence, frame, &length);
+			more = user_session->iq_sequence < subscription->frame_head;
+			pthread_mutex_unlock(&subscription->mutex);
+			if(found)
+			{
+				n = lws_write(wsi, &frame[LWS_PRE], length, LWS_WRITE_BINARY);
+			}
+			if (n < 0)
+			{
+				lwsl_err("ERROR %d writing to socket\n", n);
+				return -1;
+			}
+			/* A slow client is left to skip frames rather than queue them */
+			if(more && !lws_send_pipe_choked(wsi))
+			{
+				lws_callback_on_writable(wsi);
+			}
+			break;
 
-    _websocket_output->length = 2*i;
-    _websocket_output->sequence_id++;
+		default:
+			break;
+	}
 
-	pthread_mutex_unlock(&_websocket_output->mutex);
+	return 0;
 }
 
-typedef struct websocket_user_session_t websocket_user_session_t;
-
-struct websocket_user_session_t {
-    websocket_user_session_t *websocket_user_session_list;
-	struct lws *wsi;
-	uint32_t last_sequence_id;
-};
-
-typedef struct {
-	struct lws_context *context;
-	struct lws_vhost *vhost;
-	const struct lws_protocols *protocol;
-	websocket_user_session_t *websocket_user_session_list;
-} websocket_vhost_session_t;
 
-int callback_fft(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
+/* Live retune and gain control, see control.h */
+int callback_control(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
 {
-    (void)in;
-    (void)len;
-    
 	int32_t n;
 	websocket_user_session_t *user_session = (websocket_user_session_t *)user;
+	websocket_protocol_t *websocket_protocol = (websocket_protocol_t *)lws_get_protocol(wsi)->user;
+	pipeline_tune_t tune;
+	const char *error = NULL;
+	uint32_t ticket;
+	bool authorised = true;
 
 	websocket_vhost_session_t *vhost_session =
 			(websocket_vhost_session_t *)
 			lws_protocol_vh_priv_get(lws_get_vhost(wsi),
 					lws_get_protocol(wsi));
 
+	if(websocket_admission(wsi, reason, user_session, in) != 0)
+	{
+		return -1;
+	}
+
 	switch (reason)
 	{
 		case LWS_CALLBACK_PROTOCOL_INIT:
@@ -484,60 +529,74 @@ int callback_fft(struct lws *wsi, enum lws_callback_reasons reason, void *user,
 			break;
 
 		case LWS_CALLBACK_ESTABLISHED:
-			/* add ourselves to the list of live pss held in the vhd */
 			lws_ll_fwd_insert(
 				user_session,
 				websocket_user_session_list,
 				vhost_session->websocket_user_session_list
 			);
 			user_session->wsi = wsi;
-            /* Update connection count */
-            n = 0;
-            lws_start_foreach_ll(websocket_user_session_t *, ___pss, vhost_session->websocket_user_session_list) {
-                n++;
-            } lws_end_foreach_ll(___pss, websocket_user_session_list);
-            lws_count_fft = n;
+			user_session->reply_length = 0;
+			user_session->control_ticket = 0;
+			websocket_protocol->connections++;
 			break;
 
 		case LWS_CALLBACK_CLOSED:
-			/* remove our closing pss from the list of live pss */
 			lws_ll_fwd_remove(
 				websocket_user_session_t,
 				websocket_user_session_list,
 				user_session,
 				vhost_session->websocket_user_session_list
 			);
-            /* Update connection count */
-            n = 0;
-            lws_start_foreach_ll(websocket_user_session_t *, ___pss, vhost_session->websocket_user_session_list) {
-                n++;
-            } lws_end_foreach_ll(___pss, websocket_user_session_list);
-            lws_count_fft = n;
+			websocket_protocol->connections--;
+			break;
+
+		case LWS_CALLBACK_RECEIVE:
+			if(!lws_is_first_fragment(wsi) || !lws_is_final_fragment(wsi)
+				|| !control_request_parse(&control, (const char *)in, len, &tune, &authorised))
+			{
+				/* Make guessing the token cost a new connection each time */
+				if(!authorised)
+				{
+					lwsl_notice("Control: unauthorised request on %s, closing\n", lws_get_protocol(wsi)->name);
+					return -1;
+				}
+				error = "malformed request";
+			}
+			else
+			{
+				/* The reply waits until the main thread has applied the change */
+				ticket = pipeline_tune_request(websocket_protocol->pipeline, &tune, &error);
+				if(ticket != 0)
+				{
+					user_session->control_ticket = ticket;
+					break;
+				}
+			}
+			user_session->reply_length = control_reply(websocket_protocol->pipeline, error,
+				(char *)&user_session->reply[LWS_PRE], WEBSOCKET_REPLY_LENGTH);
+			lws_callback_on_writable(wsi);
 			break;
 
-
 		case LWS_CALLBACK_SERVER_WRITEABLE:
-			/* Write output data, if data exists */
-			pthread_mutex_lock(&websocket_output.mutex);
-			if(websocket_output.length != 0 && user_session->last_sequence_id != websocket_output.sequence_id)
+			if(user_session->control_ticket != 0 && user_session->reply_length == 0
+				&& (int32_t)(pipeline_tune_completed(websocket_protocol->pipeline, &error) - user_session->control_ticket) >= 0)
 			{
-				n = lws_write(wsi, (unsigned char*)&websocket_output.buffer[LWS_PRE], websocket_output.length, LWS_WRITE_BINARY);
-				if (!n)
+				user_session->reply_length = control_reply(websocket_protocol->pipeline, error,
+					(char *)&user_session->reply[LWS_PRE], WEBSOCKET_REPLY_LENGTH);
+				user_session->control_ticket = 0;
+			}
+			if(user_session->reply_length != 0)
+			{
+				n = lws_write(wsi, &user_session->reply[LWS_PRE], user_session->reply_length, LWS_WRITE_TEXT);
+				user_session->reply_length = 0;
+				if (n < 0)
 				{
-					pthread_mutex_unlock(&websocket_output.mutex);
 					lwsl_err("ERROR %d writing to socket\n", n);
 					return -1;
 				}
-				user_session->last_sequence_id = websocket_output.sequence_id;
 			}
-			pthread_mutex_unlock(&websocket_output.mutex);
-			
 			break;
 
-		case LWS_CALLBACK_RECEIVE:
-			/* Not expecting to receive anything */
-			break;
-		
 		default:
 			break;
 	}
@@ -545,396 +604,307 @@ int callback_fft(struct lws *wsi, enum lws_callback_reasons reason, void *user,
 	return 0;
 }
 
-int callback_fft_modtslivetune(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
+
+/* Upstream client connections of relay mode, see relay.h */
+int callback_relay(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
 {
-    (void)in;
-    (void)len;
-    
-    int32_t n;
-    websocket_user_session_t *user_session = (websocket_user_session_t *)user;
+	(void)user;
 
-    websocket_vhost_session_t *vhost_session =
-            (websocket_vhost_session_t *)
-            lws_protocol_vh_priv_get(lws_get_vhost(wsi),
-                    lws_get_protocol(wsi));
+	int32_t n = relay_callback(&relay, wsi, reason, in, len);
 
-    switch (reason)
-    {
-        case LWS_CALLBACK_PROTOCOL_INIT:
-            vhost_session = lws_protocol_vh_priv_zalloc(lws_get_vhost(wsi),
-                    lws_get_protocol(wsi),
-                    sizeof(websocket_vhost_session_t));
-            vhost_session->context = lws_get_context(wsi);
-            vhost_session->protocol = lws_get_protocol(wsi);
-            vhost_session->vhost = lws_get_vhost(wsi);
-            break;
-
-        case LWS_CALLBACK_ESTABLISHED:
-            /* add ourselves to the list of live pss held in the vhd */
-            lws_ll_fwd_insert(
-                user_session,
-                websocket_user_session_list,
-                vhost_session->websocket_user_session_list
-            );
-            user_session->wsi = wsi;
-            /* Update connection count */
-            n = 0;
-            lws_start_foreach_ll(websocket_user_session_t *, ___pss, vhost_session->websocket_user_session_list) {
-                n++;
-            } lws_end_foreach_ll(___pss, websocket_user_session_list);
-            lws_count_fft_m0dtslivetune = n;
-            break;
-
-        case LWS_CALLBACK_CLOSED:
-            /* remove our closing pss from the list of live pss */
-            lws_ll_fwd_remove(
-                websocket_user_session_t,
-                websocket_user_session_list,
-                user_session,
-                vhost_session->websocket_user_session_list
-            );
-            /* Update connection count */
-            n = 0;
-            lws_start_foreach_ll(websocket_user_session_t *, ___pss, vhost_session->websocket_user_session_list) {
-                n++;
-            } lws_end_foreach_ll(___pss, websocket_user_session_list);
-            lws_count_fft_m0dtslivetune = n;
-            break;
-
-
-        case LWS_CALLBACK_SERVER_WRITEABLE:
-            /* Write output data, if data exists */
-            pthread_mutex_lock(&websocket_output.mutex);
-            if(websocket_output.length != 0 && user_session->last_sequence_id != websocket_output.sequence_id)
-            {
-                n = lws_write(wsi, (unsigned char*)&websocket_output.buffer[LWS_PRE], websocket_output.length, LWS_WRITE_BINARY);
-                if (!n)
-                {
-                    pthread_mutex_unlock(&websocket_output.mutex);
-                    lwsl_err("ERROR %d writing to socket\n", n);
-                    return -1;
-                }
-                user_session->last_sequence_id = websocket_output.sequence_id;
-            }
-            pthread_mutex_unlock(&websocket_output.mutex);
-            
-            break;
-
-        case LWS_CALLBACK_RECEIVE:
-            /* Not expecting to receive anything */
-            break;
-        
-        default:
-            break;
-    }
+	/* Count established upstream connections against the relay protocol */
+	if(reason == LWS_CALLBACK_CLIENT_ESTABLISHED || reason == LWS_CALLBACK_CLIENT_CLOSED
+		|| reason == LWS_CALLBACK_CLIENT_CONNECTION_ERROR)
+	{
+		((websocket_protocol_t *)relay.protocol->user)->connections = relay_connected_count(&relay);
+	}
 
-    return 0;
+	return n;
 }
 
-int callback_fft_f5oeoplutofw(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
+#define WEBSOCKET_PROTOCOLS_MAX         64
+#define WEBSOCKET_PROTOCOL_NAME_LENGTH  48
+
+/* list of supported protocols and callbacks, built from the pipelines at startup */
+static struct lws_protocols protocols[WEBSOCKET_PROTOCOLS_MAX + 1]; /* + terminator */
+static websocket_protocol_t websocket_protocols[WEBSOCKET_PROTOCOLS_MAX];
+static char websocket_protocol_names[WEBSOCKET_PROTOCOLS_MAX][WEBSOCKET_PROTOCOL_NAME_LENGTH];
+static uint32_t websocket_protocols_count = 0;
+
+/* Snapshot of an output over plain HTTP, for clients polling every few seconds
+ *
+ *   GET /<protocol>, eg. /fft, /wb.fft_fast or /wb.carriers
+ *
+ * returns the protocol's latest frame as its websocket clients get it. The ETag is the frame's sequence
+ *  (prefixed with the daemon's start time, so a restart doesn't repeat them) and If-None-Match is
+ *  answered with 304, so a caching proxy in front can serve any number of pollers.
+ */
+#define WEBSOCKET_HTTP_HEADERS_LENGTH   512
+/* Cache-Control max-age, whole seconds covering at least one WS_INTERVAL */
+#define WEBSOCKET_HTTP_MAX_AGE          ((WS_INTERVAL + 999) / 1000)
+
+static uint8_t *websocket_http_buffer;
+static uint32_t websocket_http_buffer_size;
+static uint32_t websocket_http_start_time;
+
+static int websocket_http(struct lws *wsi, const char *uri)
 {
-    (void)in;
-    (void)len;
-    
-    int32_t n;
-    websocket_user_session_t *user_session = (websocket_user_session_t *)user;
+	const struct lws_protocols *protocol = NULL;
+	websocket_output_t *websocket_output;
+	char etag[32];
+	char cache_control[32];
+	char if_none_match[128];
+	uint8_t *start = &websocket_http_buffer[LWS_PRE];
+	uint8_t *p = start;
+	uint8_t *end = &websocket_http_buffer[websocket_http_buffer_size];
+	uint32_t i;
+	int n;
+	bool modified;
+
+	for(i = 0; protocols[i].name != NULL; i++)
+	{
+		if(websocket_protocols[i].output != NULL && uri[0] == '/' && strcmp(&uri[1], protocols[i].name) == 0)
+		{
+			protocol = &protocols[i];
+			break;
+		}
+	}
+	if(protocol == NULL)
+	{
+		if(lws_return_http_status(wsi, HTTP_STATUS_NOT_FOUND, NULL))
+		{
+			return -1;
+		}
+		return lws_http_transaction_completed(wsi) ? -1 : 0;
+	}
+	websocket_output = websocket_protocols[i].output;
 
-    websocket_vhost_session_t *vhost_session =
-            (websocket_vhost_session_t *)
-            lws_protocol_vh_priv_get(lws_get_vhost(wsi),
-                    lws_get_protocol(wsi));
+	if_none_match[0] = '\0';
+	if(lws_hdr_total_length(wsi, WSI_TOKEN_HTTP_IF_NONE_MATCH) < (int)sizeof(if_none_match))
+	{
+		lws_hdr_copy(wsi, if_none_match, sizeof(if_none_match), WSI_TOKEN_HTTP_IF_NONE_MATCH);
+	}
+	snprintf(cache_control, sizeof(cache_control), "public, max-age=%d", WEBSOCKET_HTTP_MAX_AGE);
 
-    switch (reason)
-    {
-        case LWS_CALLBACK_PROTOCOL_INIT:
-            vhost_session = lws_protocol_vh_priv_zalloc(lws_get_vhost(wsi),
-                    lws_get_protocol(wsi),
-                    sizeof(websocket_vhost_session_t));
-            vhost_session->context = lws_get_context(wsi);
-            vhost_session->protocol = lws_get_protocol(wsi);
-            vhost_session->vhost = lws_get_vhost(wsi);
-            break;
-
-        case LWS_CALLBACK_ESTABLISHED:
-            /* add ourselves to the list of live pss held in the vhd */
-            lws_ll_fwd_insert(
-                user_session,
-                websocket_user_session_list,
-                vhost_session->websocket_user_session_list
-            );
-            user_session->wsi = wsi;
-            /* Update connection count */
-            n = 0;
-            lws_start_foreach_ll(websocket_user_session_t *, ___pss, vhost_session->websocket_user_session_list) {
-                n++;
-            } lws_end_foreach_ll(___pss, websocket_user_session_list);
-            lws_count_fft_f5oeoplutofw = n;
-            break;
-
-        case LWS_CALLBACK_CLOSED:
-            /* remove our closing pss from the list of live pss */
-            lws_ll_fwd_remove(
-                websocket_user_session_t,
-                websocket_user_session_list,
-                user_session,
-                vhost_session->websocket_user_session_list
-            );
-            /* Update connection count */
-            n = 0;
-            lws_start_foreach_ll(websocket_user_session_t *, ___pss, vhost_session->websocket_user_session_list) {
-                n++;
-            } lws_end_foreach_ll(___pss, websocket_user_session_list);
-            lws_count_fft_f5oeoplutofw = n;
-            break;
-
-
-        case LWS_CALLBACK_SERVER_WRITEABLE:
-            /* Write output data, if data exists */
-            pthread_mutex_lock(&websocket_output.mutex);
-            if(websocket_output.length != 0 && user_session->last_sequence_id != websocket_output.sequence_id)
-            {
-                n = lws_write(wsi, (unsigned char*)&websocket_output.buffer[LWS_PRE], websocket_output.length, LWS_WRITE_BINARY);
-                if (!n)
-                {
-                    pthread_mutex_unlock(&websocket_output.mutex);
-                    lwsl_err("ERROR %d writing to socket\n", n);
-                    return -1;
-                }
-                user_session->last_sequence_id = websocket_output.sequence_id;
-            }
-            pthread_mutex_unlock(&websocket_output.mutex);
-            
-            break;
-
-        case LWS_CALLBACK_RECEIVE:
-            /* Not expecting to receive anything */
-            break;
-        
-        default:
-            break;
-    }
+	/* Headers and frame go out in one write, so the ETag always matches the frame */
+	pthread_mutex_lock(&websocket_output->mutex);
+	if(websocket_output->length == 0)
+	{
+		pthread_mutex_unlock(&websocket_output->mutex);
+		if(lws_return_http_status(wsi, HTTP_STATUS_SERVICE_UNAVAILABLE, NULL))
+		{
+			return -1;
+		}
+		return lws_http_transaction_completed(wsi) ? -1 : 0;
+	}
+	snprintf(etag, sizeof(etag), "\"%08x-%u\"", websocket_http_start_time, websocket_output->sequence_id);
+	/* Also matches within a list, or a weak W/ validator */
+	modified = (strstr(if_none_match, etag) == NULL);
+
+	if(lws_add_http_common_headers(wsi, modified ? HTTP_STATUS_OK : HTTP_STATUS_NOT_MODIFIED,
+			websocket_protocols[i].write_protocol == LWS_WRITE_TEXT ? "application/json" : "application/octet-stream",
+			modified ? websocket_output->length : 0, &p, end)
+		|| lws_add_http_header_by_token(wsi, WSI_TOKEN_HTTP_ETAG, (unsigned char *)etag, strlen(etag), &p, end)
+		|| lws_add_http_header_by_token(wsi, WSI_TOKEN_HTTP_CACHE_CONTROL, (unsigned char *)cache_control, strlen(cache_control), &p, end)
+		|| lws_add_http_header_by_name(wsi, (unsigned char *)"access-control-allow-origin:", (unsigned char *)"*", 1, &p, end)
+		|| lws_finalize_http_header(wsi, &p, end))
+	{
+		pthread_mutex_unlock(&websocket_output->mutex);
+		return -1;
+	}
+	if(modified)
+	{
+		/* Sized at startup for the largest output */
+		memcpy(p, &websocket_output->buffer[LWS_PRE], websocket_output->length);
+		p += websocket_output->length;
+	}
+	pthread_mutex_unlock(&websocket_output->mutex);
 
-    return 0;
+	n = lws_write(wsi, start, p - start, LWS_WRITE_HTTP_HEADERS);
+	if(n < 0)
+	{
+		return -1;
+	}
+	return lws_http_transaction_completed(wsi) ? -1 : 0;
 }
 
-int callback_fft_ea7kirsatcontroller(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
+/* Room for the headers and the largest output of any pipeline */
+static uint8_t websocket_http_setup(arena_t *arena)
 {
-    (void)in;
-    (void)len;
-    
-    int32_t n;
-    websocket_user_session_t *user_session = (websocket_user_session_t *)user;
+	uint32_t i;
+	uint32_t size = 0;
 
-    websocket_vhost_session_t *vhost_session =
-            (websocket_vhost_session_t *)
-            lws_protocol_vh_priv_get(lws_get_vhost(wsi),
-                    lws_get_protocol(wsi));
+	/* All outputs of a pipeline are the same size */
+	for(i = 0; i < PIPELINES_COUNT; i++)
+	{
+		if(pipelines[i].output_fft.size > size)
+		{
+			size = pipelines[i].output_fft.size;
+		}
+	}
 
-    switch (reason)
-    {
-        case LWS_CALLBACK_PROTOCOL_INIT:
-            vhost_session = lws_protocol_vh_priv_zalloc(lws_get_vhost(wsi),
-                    lws_get_protocol(wsi),
-                    sizeof(websocket_vhost_session_t));
-            vhost_session->context = lws_get_context(wsi);
-            vhost_session->protocol = lws_get_protocol(wsi);
-            vhost_session->vhost = lws_get_vhost(wsi);
-            break;
-
-        case LWS_CALLBACK_ESTABLISHED:
-            /* add ourselves to the list of live pss held in the vhd */
-            lws_ll_fwd_insert(
-                user_session,
-                websocket_user_session_list,
-                vhost_session->websocket_user_session_list
-            );
-            user_session->wsi = wsi;
-            /* Update connection count */
-            n = 0;
-            lws_start_foreach_ll(websocket_user_session_t *, ___pss, vhost_session->websocket_user_session_list) {
-                n++;
-            } lws_end_foreach_ll(___pss, websocket_user_session_list);
-            lws_count_fft_ea7kirsatcontroller = n;
-            break;
-
-        case LWS_CALLBACK_CLOSED:
-            /* remove our closing pss from the list of live pss */
-            lws_ll_fwd_remove(
-                websocket_user_session_t,
-                websocket_user_session_list,
-                user_session,
-                vhost_session->websocket_user_session_list
-            );
-            /* Update connection count */
-            n = 0;
-            lws_start_foreach_ll(websocket_user_session_t *, ___pss, vhost_session->websocket_user_session_list) {
-                n++;
-            } lws_end_foreach_ll(___pss, websocket_user_session_list);
-            lws_count_fft_ea7kirsatcontroller = n;
-            break;
-
-
-        case LWS_CALLBACK_SERVER_WRITEABLE:
-            /* Write output data, if data exists */
-            pthread_mutex_lock(&websocket_output.mutex);
-            if(websocket_output.length != 0 && user_session->last_sequence_id != websocket_output.sequence_id)
-            {
-                n = lws_write(wsi, (unsigned char*)&websocket_output.buffer[LWS_PRE], websocket_output.length, LWS_WRITE_BINARY);
-                if (!n)
-                {
-                    pthread_mutex_unlock(&websocket_output.mutex);
-                    lwsl_err("ERROR %d writing to socket\n", n);
-                    return -1;
-                }
-                user_session->last_sequence_id = websocket_output.sequence_id;
-            }
-            pthread_mutex_unlock(&websocket_output.mutex);
-            
-            break;
-
-        case LWS_CALLBACK_RECEIVE:
-            /* Not expecting to receive anything */
-            break;
-        
-        default:
-            break;
-    }
+	websocket_http_buffer_size = LWS_PRE + WEBSOCKET_HTTP_HEADERS_LENGTH + size;
+	websocket_http_buffer = arena_alloc(arena, websocket_http_buffer_size, ARENA_CACHE_LINE);
+	websocket_http_start_time = time(NULL);
 
-    return 0;
+	return websocket_http_buffer != NULL;
 }
 
-int callback_fft_fast(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
+static websocket_protocol_t *websocket_protocol_add(const char *_namespace, const char *name, lws_callback_function *callback,
+	websocket_output_t *output, enum lws_write_protocol write_protocol)
 {
-    (void)in;
-    (void)len;
+	uint32_t i = websocket_protocols_count;
 
-    int32_t n;
-    websocket_user_session_t *user_session = (websocket_user_session_t *)user;
+	if(i >= WEBSOCKET_PROTOCOLS_MAX)
+	{
+		fprintf(stderr, "Too many websocket protocols, increase WEBSOCKET_PROTOCOLS_MAX\n");
+		return NULL;
+	}
 
-    websocket_vhost_session_t *vhost_session =
-            (websocket_vhost_session_t *)
-            lws_protocol_vh_priv_get(lws_get_vhost(wsi),
-                    lws_get_protocol(wsi));
+	/* Subprotocol names are HTTP tokens, so the namespace separator is '.' rather than '/' */
+	if(_namespace != NULL)
+	{
+		snprintf(websocket_protocol_names[i], WEBSOCKET_PROTOCOL_NAME_LENGTH, "%s.%s", _namespace, name);
+	}
+	else
+	{
+		snprintf(websocket_protocol_names[i], WEBSOCKET_PROTOCOL_NAME_LENGTH, "%s", name);
+	}
 
-    switch (reason)
-    {
-        case LWS_CALLBACK_PROTOCOL_INIT:
-            vhost_session = lws_protocol_vh_priv_zalloc(lws_get_vhost(wsi),
-                    lws_get_protocol(wsi),
-                    sizeof(websocket_vhost_session_t));
-            vhost_session->context = lws_get_context(wsi);
-            vhost_session->protocol = lws_get_protocol(wsi);
-            vhost_session->vhost = lws_get_vhost(wsi);
-            break;
-
-        case LWS_CALLBACK_ESTABLISHED:
-            /* add ourselves to the list of live pss held in the vhd */
-            lws_ll_fwd_insert(
-                user_session,
-                websocket_user_session_list,
-                vhost_session->websocket_user_session_list
-            );
-            user_session->wsi = wsi;
-            /* Update connection count */
-            n = 0;
-            lws_start_foreach_ll(websocket_user_session_t *, ___pss, vhost_session->websocket_user_session_list) {
-                n++;
-            } lws_end_foreach_ll(___pss, websocket_user_session_list);
-            lws_count_fft_fast = n;
-            break;
-
-        case LWS_CALLBACK_CLOSED:
-            /* remove our closing pss from the list of live pss */
-            lws_ll_fwd_remove(
-                websocket_user_session_t,
-                websocket_user_session_list,
-                user_session,
-                vhost_session->websocket_user_session_list
-            );
-            /* Update connection count */
-            n = 0;
-            lws_start_foreach_ll(websocket_user_session_t *, ___pss, vhost_session->websocket_user_session_list) {
-                n++;
-            } lws_end_foreach_ll(___pss, websocket_user_session_list);
-            lws_count_fft_fast = n;
-            break;
-
-
-        case LWS_CALLBACK_SERVER_WRITEABLE:
-            /* Write output data, if data exists */
-            pthread_mutex_lock(&websocket_output_fast.mutex);
-            if(websocket_output_fast.length != 0 && user_session->last_sequence_id != websocket_output_fast.sequence_id)
-            {
-                n = lws_write(wsi, (unsigned char*)&websocket_output_fast.buffer[LWS_PRE], websocket_output_fast.length, LWS_WRITE_BINARY);
-                if (!n)
-                {
-                    pthread_mutex_unlock(&websocket_output_fast.mutex);
-                    lwsl_err("ERROR %d writing to socket\n", n);
-                    return -1;
-                }
-                user_session->last_sequence_id = websocket_output_fast.sequence_id;
-            }
-            pthread_mutex_unlock(&websocket_output_fast.mutex);
-            
-            break;
-
-        case LWS_CALLBACK_RECEIVE:
-            /* Not expecting to receive anything */
-            break;
-        
-        default:
-            break;
-    }
+	websocket_protocols[i].output = output;
+	websocket_protocols[i].write_protocol = write_protocol;
+	websocket_protocols[i].iq_streams = NULL;
+	websocket_protocols[i].pipeline = NULL;
+	websocket_protocols[i].connections = 0;
 
-    return 0;
+	protocols[i].name = websocket_protocol_names[i];
+	protocols[i].callback = callback;
+	protocols[i].per_session_data_size = sizeof(websocket_user_session_t);
+	protocols[i].rx_buffer_size = 4096;
+	protocols[i].user = &websocket_protocols[i];
+
+	websocket_protocols_count++;
+	return &websocket_protocols[i];
 }
 
-enum demo_protocols {
-	PROTOCOL_FFT,
-    PROTOCOL_FFT_M0DTSLIVETUNE,
-    PROTOCOL_FFT_F5OEOPLUTOFW,
-    PROTOCOL_FFT_EA7KIRSATCONTROLLER,
-    PROTOCOL_FFT_FAST,
-	NOP
-};
+static uint8_t websocket_protocols_setup(void)
+{
+	pipeline_t *pipeline;
+	websocket_protocol_t *websocket_protocol;
+	uint32_t i;
 
-/* list of supported protocols and callbacks */
-static struct lws_protocols protocols[] = {
+	for(i = 0; i < PIPELINES_COUNT; i++)
 	{
-		.name = "fft",
-		.callback = callback_fft,
-		.per_session_data_size = 128,
-		.rx_buffer_size = 4096,
-	},
-    {
-        .name = "fft_m0dtslivetune",
-        .callback = callback_fft_modtslivetune,
-        .per_session_data_size = 128,
-        .rx_buffer_size = 4096,
-    },
-    {
-        .name = "fft_f5oeoplutofw",
-        .callback = callback_fft_f5oeoplutofw,
-        .per_session_data_size = 128,
-        .rx_buffer_size = 4096,
-    },
-    {
-        .name = "fft_ea7kirsatcontroller",
-        .callback = callback_fft_ea7kirsatcontroller,
-        .per_session_data_size = 128,
-        .rx_buffer_size = 4096,
-    },
-    {
-        .name = "fft_fast",
-        .callback = callback_fft_fast,
-        .per_session_data_size = 128,
-        .rx_buffer_size = 4096,
-    },
+		pipeline = &pipelines[i];
+		if(pipeline->config->legacy_protocols)
+		{
+			if(!websocket_protocol_add(NULL, "fft", callback_fft, &pipeline->output_fft, LWS_WRITE_BINARY)
+				|| !websocket_protocol_add(NULL, "fft_m0dtslivetune", callback_fft, &pipeline->output_fft, LWS_WRITE_BINARY)
+				|| !websocket_protocol_add(NULL, "fft_f5oeoplutofw", callback_fft, &pipeline->output_fft, LWS_WRITE_BINARY)
+				|| !websocket_protocol_add(NULL, "fft_ea7kirsatcontroller", callback_fft, &pipeline->output_fft, LWS_WRITE_BINARY)
+				|| !websocket_protocol_add(NULL, "fft_fast", callback_fft, &pipeline->output_fft_fast, LWS_WRITE_BINARY)
+				|| !websocket_protocol_add(NULL, "carriers", callback_fft, &pipeline->output_carriers, LWS_WRITE_TEXT))
+			{
+				return 0;
+			}
+		}
+		if(!websocket_protocol_add(pipeline->config->name, "fft", callback_fft, &pipeline->output_fft, LWS_WRITE_BINARY)
+			|| !websocket_protocol_add(pipeline->config->name, "fft_fast", callback_fft, &pipeline->output_fft_fast, LWS_WRITE_BINARY)
+			|| !websocket_protocol_add(pipeline->config->name, "carriers", callback_fft, &pipeline->output_carriers, LWS_WRITE_TEXT)
+			|| !websocket_protocol_add(pipeline->config->name, "fft_v2", callback_fft, &pipeline->output_fft_v2.output, LWS_WRITE_BINARY)
+			|| !websocket_protocol_add(pipeline->config->name, "fft_fast_v2", callback_fft, &pipeline->output_fft_fast_v2.output, LWS_WRITE_BINARY))
+		{
+			return 0;
+		}
+		/* IQ needs the samples, so isn't relayed */
+		if(pipeline->config->iq_stream && !pipeline->relayed)
+		{
+			websocket_protocol = websocket_protocol_add(pipeline->config->name, "iq", callback_iq, NULL, LWS_WRITE_BINARY);
+			if(websocket_protocol == NULL)
+			{
+				return 0;
+			}
+			websocket_protocol->iq_streams = &pipeline->iq_streams;
+		}
+		/* Zoom pipelines follow their source's tuning */
+		if(control_enabled && !pipeline->relayed && pipeline->source == NULL)
+		{
+			websocket_protocol = websocket_protocol_add(pipeline->config->name, "control", callback_control, NULL, LWS_WRITE_TEXT);
+			if(websocket_protocol == NULL)
+			{
+				return 0;
+			}
+			websocket_protocol->pipeline = pipeline;
+		}
+	}
+
+	/* Client side only, the relay rejects any downstream connection asking for it */
+	if(relay_mode && websocket_protocol_add(NULL, "airspy_fft_ws.relay", callback_relay, NULL, LWS_WRITE_BINARY) == NULL)
 	{
-		/* terminator */
-		0
+		return 0;
 	}
-};
+
+	/* terminator */
+	memset(&protocols[websocket_protocols_count], 0, sizeof(struct lws_protocols));
+
+	return 1;
+}
+
+/* Trigger send on all websockets of all protocols serving this output */
+static void websocket_output_written(websocket_output_t *output)
+{
+	uint32_t i;
+
+	for(i = 0; i < websocket_protocols_count; i++)
+	{
+		if(websocket_protocols[i].output == output)
+		{
+			lws_callback_on_writable_all_protocol(context, &protocols[i]);
+		}
+	}
+}
+
+/* Relay mode: trigger send for each output with a new frame from upstream */
+static void websocket_relay_written(void)
+{
+	uint32_t i;
+
+	for(i = 0; i < relay.stream_count; i++)
+	{
+		if(relay_stream_updated(&relay.streams[i]))
+		{
+			websocket_output_written(relay.streams[i].output);
+		}
+	}
+}
+
+/* Trigger send on the control protocol of a pipeline, for clients waiting on a change just applied */
+static void websocket_control_written(pipeline_t *pipeline)
+{
+	uint32_t i;
+
+	for(i = 0; i < websocket_protocols_count; i++)
+	{
+		if(websocket_protocols[i].pipeline == pipeline)
+		{
+			lws_callback_on_writable_all_protocol(context, &protocols[i]);
+		}
+	}
+}
+
+/* Trigger send on IQ protocols with clients, each client then drains its queued frames */
+static void websocket_iq_written(void)
+{
+	uint32_t i;
+
+	for(i = 0; i < websocket_protocols_count; i++)
+	{
+		if(websocket_protocols[i].iq_streams != NULL && websocket_protocols[i].connections > 0)
+		{
+			lws_callback_on_writable_all_protocol(context, &protocols[i]);
+		}
+	}
+}
 
 int lws_err = 0;
 /* Websocket Service Thread */
@@ -958,15 +928,85 @@ void sighandler(int sig)
 	lws_cancel_service(context);
 }
 
-int main(int argc, char **argv)
+static void usage(const char *name)
 {
-	(void) argc;
-	(void) argv;
+	fprintf(stderr, "Usage: %s [-p port] [-r upstream_host[:port]] [-c seconds] [-t] [-b]\n", name);
+	fprintf(stderr, "  -p  Websocket server port (default %d)\n", WS_PORT);
+	fprintf(stderr, "  -r  Relay mode: re-serve the pipelines of an upstream instance instead of running AirSpys\n");
+	fprintf(stderr, "  -c  Measure the passband of each AirSpy pipeline over this long, save it as the device's\n");
+	fprintf(stderr, "      line profile and exit. Best over a terminated input, see line_profile.h\n");
+	fprintf(stderr, "  -t  Run the DSP self-test against synthetic IQ and exit\n");
+	fprintf(stderr, "  -b  Run the DSP benchmarks and exit\n");
+}
 
+int main(int argc, char **argv)
+{
 	struct lws_context_creation_info info;
 	struct timeval tv;
-	unsigned int ms, oldms = 0, oldms_fast = 0, oldms_conn_count = 0;
-	int i;
+	unsigned int ms, oldms_conn_count = 0, oldms_calibrate = 0;
+	uint32_t i, j, published;
+	pipeline_t *pipeline;
+	int result;
+	int opt;
+	int port = WS_PORT;
+	const char *upstream = NULL;
+	bool selftest = false, benchmark = false, failed = false;
+	int calibrate_seconds = 0;
+
+	while((opt = getopt(argc, argv, "p:r:c:tbh")) != -1)
+	{
+		switch(opt)
+		{
+			case 'p':
+				port = atoi(optarg);
+				if(port <= 0 || port > 65535)
+				{
+					fprintf(stderr, "Invalid port '%s'\n", optarg);
+					return -1;
+				}
+				break;
+			case 'r':
+				upstream = optarg;
+				break;
+			case 'c':
+				calibrate_seconds = atoi(optarg);
+				if(calibrate_seconds <= 0)
+				{
+					fprintf(stderr, "Invalid calibration time '%s'\n", optarg);
+					return -1;
+				}
+				break;
+			case 't':
+				selftest = true;
+				break;
+			case 'b':
+				benchmark = true;
+				break;
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : -1;
+		}
+	}
+
+	if(upstream != NULL && calibrate_seconds > 0)
+	{
+		fprintf(stderr, "A relay has no AirSpys to calibrate\n");
+		return -1;
+	}
+
+	if(upstream != NULL)
+	{
+		if(!relay_init(&relay, upstream, WS_PORT))
+		{
+			return -1;
+		}
+		relay_mode = true;
+	}
+	else if(!selftest && !benchmark)
+	{
+		control_enabled = control_init(&control);
+		fprintf(stdout, "Live control %s (%s).\n", control_enabled ? "enabled" : "disabled", CONTROL_TOKEN_FILENAME);
+	}
 
 	signal(SIGINT, sighandler);
 
@@ -978,7 +1018,7 @@ int main(int argc, char **argv)
 	lws_set_log_level(debug_level, lwsl_emit_syslog);
 
 	memset(&info, 0, sizeof info);
-	info.port = WS_PORT;
+	info.port = port;
 	info.iface = NULL;
 	info.protocols = protocols;
 	info.gid = -1;
@@ -987,15 +1027,99 @@ int main(int argc, char **argv)
 	info.options = LWS_SERVER_OPTION_VALIDATE_UTF8;
 	info.timeout_secs = 5;
 
-	fprintf(stdout, "Initialising FFT (%d bin).. ", FFT_SIZE);
+	realtime_init();
+#ifdef MEMORY_LOCK
+	fprintf(stdout, "Locking memory.. ");
 	fflush(stdout);
-	setup_fft();
-	for(i=0; i<FFT_SIZE; i++)
+	if(realtime_memory_lock())
 	{
-		hanning_window_const[i] = 0.5 * (1.0 - cos(2*M_PI*(((double)i)/FFT_SIZE)));
+		fprintf(stdout, "Done.\n");
+	}
+#endif
+
+#ifdef ARENA_HUGEPAGES
+	if(!arena_init(&arena, ARENA_SIZE, true))
+#else
+	if(!arena_init(&arena, ARENA_SIZE, false))
+#endif
+	{
+		fprintf(stderr, "Arena init failed.\n");
+		return -1;
+	}
+
+	if(selftest || benchmark)
+	{
+		if(selftest && !selftest_run(&arena))
+		{
+			return 1;
+		}
+		if(benchmark && !selftest_benchmark(&arena))
+		{
+			return 1;
+		}
+		return 0;
+	}
+
+	for(i = 0; i < PIPELINES_COUNT && !relay_mode; i++)
+	{
+		fprintf(stdout, "Initialising FFT for %s (%d bin).. ", pipeline_configs[i].name, pipeline_configs[i].fft_size);
+		fflush(stdout);
+		pipeline = &pipelines[i];
+		/* Carriers are detected on the fast stage, as often as they always were */
+		if(!pipeline_init(pipeline, &pipeline_configs[i], pipeline_find(pipeline_configs[i].source, i), &arena)
+			|| !pipeline_stage_add(pipeline, &arena, WS_INTERVAL, FFT_WINDOW,
+				&pipeline->output_fft, &pipeline->output_fft_v2, NULL)
+			|| !pipeline_stage_add(pipeline, &arena, WS_INTERVAL_FAST, FFT_WINDOW_FAST,
+				&pipeline->output_fft_fast, &pipeline->output_fft_fast_v2, &pipeline->output_carriers))
+		{
+			fprintf(stderr, "FFT init failed.\n");
+			return -1;
+		}
+		if(calibrate_seconds > 0 && pipeline->source == NULL && !pipeline_calibrate_init(pipeline, &arena))
+		{
+			fprintf(stderr, "Calibration init failed.\n");
+			return -1;
+		}
+		fprintf(stdout, "Done.\n");
+	}
+
+	for(i = 0; i < PIPELINES_COUNT && relay_mode; i++)
+	{
+		fprintf(stdout, "Initialising relay of %s from %s:%d.. ", pipeline_configs[i].name, relay.host, relay.port);
+		fflush(stdout);
+		pipeline = &pipelines[i];
+		if(!pipeline_init_relay(pipeline, &pipeline_configs[i], &arena)
+			|| !relay_stream_add(&relay, &arena, pipeline->config->name, "fft", &pipeline->output_fft)
+			|| !relay_stream_add(&relay, &arena, pipeline->config->name, "fft_fast", &pipeline->output_fft_fast)
+			|| !relay_stream_add(&relay, &arena, pipeline->config->name, "carriers", &pipeline->output_carriers)
+			|| !relay_stream_add(&relay, &arena, pipeline->config->name, "fft_v2", &pipeline->output_fft_v2.output)
+			|| !relay_stream_add(&relay, &arena, pipeline->config->name, "fft_fast_v2", &pipeline->output_fft_fast_v2.output))
+		{
+			fprintf(stderr, "Relay init failed.\n");
+			return -1;
+		}
+		fprintf(stdout, "Done.\n");
+	}
+
+	if(!websocket_http_setup(&arena))
+	{
+		fprintf(stderr, "HTTP snapshot buffer allocation failed.\n");
+		return -1;
+	}
+
+	/* No pipeline allocations after this point */
+	arena_seal(&arena);
+
+	if(!websocket_protocols_setup())
+	{
+		return -1;
 	}
-	fprintf(stdout, "Done.\n");
 	
+	if(!admission_init(&admission, ADMISSION_HOST_CONNECTIONS_MAX, ADMISSION_TRUSTED_HOSTS))
+	{
+		return -1;
+	}
+
 	fprintf(stdout, "Initialising Websocket Server (LWS %d) on port %d.. ",LWS_LIBRARY_VERSION_NUMBER,info.port);
 	fflush(stdout);
 	context = lws_create_context(&info);
@@ -1004,24 +1128,24 @@ int main(int argc, char **argv)
 		lwsl_err("LWS init failed\n");
 		return -1;
 	}
-	
-	fprintf(stdout, "Initialising AirSpy (%.01fMSPS, %.03fMHz).. ",(float)sample_rate_val/1000000,(float)freq_hz/1000000);
-	fflush(stdout);
-	if(!setup_airspy())
-	{
-	    fprintf(stderr, "AirSpy init failed.\n");
-		return -1;
-	}
 	fprintf(stdout, "Done.\n");
-	
-	fprintf(stdout, "Starting FFT Thread.. ");
-	if (pthread_create(&fftThread, NULL, thread_fft, NULL))
+
+	if(!relay_mode)
 	{
-		fprintf(stderr, "Error creating FFT thread\n");
-		return -1;
+		result = airspy_init();
+		if( result != AIRSPY_SUCCESS ) {
+			printf("airspy_init() failed: %s (%d)\n", airspy_error_name(result), result);
+			return -1;
+		}
+
+		for(i = 0; i < PIPELINES_COUNT; i++)
+		{
+			if(!pipeline_start(&pipelines[i]))
+			{
+				return -1;
+			}
+		}
 	}
-	pthread_setname_np(fftThread, "FFT Calculation");
-	fprintf(stdout, "Done.\n");
 
     fprintf(stdout, "Starting Websocket Service Thread.. ");
     if (pthread_create(&wsThread, NULL, thread_ws, NULL))
@@ -1031,8 +1155,17 @@ int main(int argc, char **argv)
     }
     pthread_setname_np(wsThread, "Websocket Srv");
     fprintf(stdout, "Done.\n");
+    realtime_thread_apply(wsThread, "Websocket Srv", CPU_AFFINITY_WS, 0);
+
+    realtime_thread_apply(pthread_self(), "Main", CPU_AFFINITY_MAIN, 0);
 
 	fprintf(stdout, "Server running.\n");
+	if(calibrate_seconds > 0)
+	{
+		fprintf(stdout, "Measuring line profiles for %ds..\n", calibrate_seconds);
+		gettimeofday(&tv, NULL);
+		oldms_calibrate = (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+	}
 	fflush(stdout);
 
 	while (!(lws_err < 0) && !force_exit)
@@ -1040,40 +1173,85 @@ int main(int argc, char **argv)
 		gettimeofday(&tv, NULL);
 
 		ms = (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
-		if ((ms - oldms) > WS_INTERVAL)
-		{
-			/* Copy latest FFT data to WS Output Buffer */
-			fft_to_buffer(&websocket_output);
 
-			/* Trigger send on all websockets */
-			lws_callback_on_writable_all_protocol(context, &protocols[PROTOCOL_FFT]);
-            lws_callback_on_writable_all_protocol(context, &protocols[PROTOCOL_FFT_M0DTSLIVETUNE]);
-            lws_callback_on_writable_all_protocol(context, &protocols[PROTOCOL_FFT_F5OEOPLUTOFW]);
-            lws_callback_on_writable_all_protocol(context, &protocols[PROTOCOL_FFT_EA7KIRSATCONTROLLER]);
+		/* Retunes are applied here, so libairspy's USB control transfers never hold up the websocket thread */
+		for(i = 0; i < PIPELINES_COUNT && control_enabled; i++)
+		{
+			if(pipeline_tune_apply(&pipelines[i]))
+			{
+				websocket_control_written(&pipelines[i]);
+			}
+		}
 
-			/* Reset timer */
-			oldms = ms;
+		if (relay_mode)
+		{
+			/* Frames arrive from upstream at its own rate, so are fanned out as they land */
+			websocket_relay_written();
 		}
-        if ((ms - oldms_fast) > WS_INTERVAL_FAST)
-        {
-            /* Copy latest FFT data to WS Output Buffer */
-            fft_to_buffer(&websocket_output_fast);
+		else
+		{
+			for(i = 0; i < PIPELINES_COUNT; i++)
+			{
+				pipeline = &pipelines[i];
 
-            /* Trigger send on all websockets */
-            lws_callback_on_writable_all_protocol(context, &protocols[PROTOCOL_FFT_FAST]);
+				/* Each stage packs and publishes its own frame when due */
+				published = pipeline_stages_run(pipeline, ms);
+				for(j = 0; j < pipeline->stage_count; j++)
+				{
+					if(!(published & (1U << j)))
+					{
+						continue;
+					}
+					if(pipeline->stages[j].output != NULL)
+					{
+						websocket_output_written(pipeline->stages[j].output);
+					}
+					if(pipeline->stages[j].frame_output != NULL)
+					{
+						websocket_output_written(&pipeline->stages[j].frame_output->output);
+					}
+					if(pipeline->stages[j].carriers_output != NULL)
+					{
+						websocket_output_written(pipeline->stages[j].carriers_output);
+					}
+				}
+			}
+		}
+        /* IQ frames are produced every block, so are sent on every tick */
+        websocket_iq_written();
 
-            /* Reset timer */
-            oldms_fast = ms;
+        /* Calibration run done, save the profiles measured and exit */
+        if(calibrate_seconds > 0 && (ms - oldms_calibrate) >= (unsigned int)calibrate_seconds * 1000)
+        {
+            for(i = 0; i < PIPELINES_COUNT; i++)
+            {
+                if(pipelines[i].calibration_power != NULL && !pipeline_calibrate_save(&pipelines[i]))
+                {
+                    failed = true;
+                }
+            }
+            force_exit = 1;
+            lws_cancel_service(context);
         }
+
         if ((ms - oldms_conn_count) > STDOUT_INTERVAL_CONNCOUNT)
         {
-            fprintf(stdout, "Connections: fft: %d, fft_m0dtslivetune: %d, fft_f5oeoplutofw: %d, fft_ea7kirsatcontroller: %d, fft_fast: %d\n",
-                lws_count_fft,
-                lws_count_fft_m0dtslivetune,
-                lws_count_fft_f5oeoplutofw,
-                lws_count_fft_ea7kirsatcontroller,
-                lws_count_fft_fast
-            );
+            fprintf(stdout, "Connections:");
+            for(j = 0; j < websocket_protocols_count; j++)
+            {
+                fprintf(stdout, "%s %s: %d", j == 0 ? "" : ",", protocols[j].name, websocket_protocols[j].connections);
+            }
+            fprintf(stdout, "\n");
+            admission_print_stats(&admission);
+
+            if(relay_mode)
+            {
+                relay_print_stats(&relay);
+            }
+            for(i = 0; i < PIPELINES_COUNT && !relay_mode; i++)
+            {
+                pipeline_print_stats(&pipelines[i], ms - oldms_conn_count);
+            }
 
             /* Reset timer */
             oldms_conn_count = ms;
@@ -1086,9 +1264,17 @@ int main(int argc, char **argv)
     pthread_join(wsThread, NULL);
     lws_context_destroy(context);
 
-	close_airspy();
-	close_fftw();
+	for(i = 0; i < PIPELINES_COUNT; i++)
+	{
+		pipeline_close(&pipelines[i]);
+	}
+	if(!relay_mode)
+	{
+		airspy_exit();
+	}
+	fftw_forget_wisdom();
+	arena_free(&arena);
 	closelog();
 
-	return 0;
+	return failed ? 1 : 0;
 }
@@ -0,0 +1,1803 @@
+#include "pipeline.h"
+#include "realtime.h"
+
+/* Blocks of IQ held between the AirSpy callback and the FFT thread (power of two) */
+#define IQ_RING_BLOCKS  8
+
+/* Sample type -> 32bit Complex Float */
+#define AIRSPY_SAMPLE_TYPE  AIRSPY_SAMPLE_FLOAT32_IQ
+/* Sample type for fixed-point pipelines -> 16bit Complex Integer */
+#define AIRSPY_SAMPLE_TYPE_FIXED    AIRSPY_SAMPLE_INT16_IQ
+/* Linear Gain */
+#define LINEAR
+/* Sensitive Gain */
+//#define SENSITIVE
+
+/* transfer->sample_count is normally 65536 */
+#define	AIRSPY_BUFFER_COPY_SIZE	65536
+
+/* FFTs are taken over the first half of each transfer (as when only AIRSPY_BUFFER_COPY_SIZE floats
+ *  were copied out), this sets the FFT rate. */
+#define FFT_BLOCK_SAMPLES   (AIRSPY_BUFFER_COPY_SIZE / 2)
+
+/* Zoom pipelines: DDC output per ring block (at least 4 FFT frames), and ring length */
+#define ZOOM_BLOCK_SAMPLES  8192
+#define ZOOM_IQ_RING_BLOCKS 8
+
+/* How long the FFT thread must have had headroom before a quality level is restored */
+#define FFT_LOAD_RESTORE_MS 2000
+
+/* Live tuning: samples dropped after a change while the tuner settles and libairspy's queued transfers drain */
+#define PIPELINE_TUNE_SETTLE_MS 100
+/* AirSpy R2 / Mini tuning range */
+#define TUNE_FREQ_MIN       24000000
+#define TUNE_FREQ_MAX       1800000000
+#define TUNE_GAIN_MAX       21
+
+/* Carrier frames after startup or a retune before new carriers trigger a capture, while the list settles */
+#define CAPTURE_CARRIER_HOLDOFF 20
+
+/* OLD
+#define FFT_OFFSET  85
+#define FFT_SCALE   3000.0
+
+
+#define FLOOR_TARGET    8500
+#define FLOOR_TIME_SMOOTH 0.995
+*/
+
+#define FFT_PRESCALE 3.0
+
+#define FFT_OFFSET  (150)
+#define FFT_SCALE   (9e3)
+
+
+#define FLOOR_TARGET	(FFT_PRESCALE * 47000)
+#define FLOOR_TIME_SMOOTH 0.995
+/* FLOOR_TIME_SMOOTH is per frame at this interval, the rate snapshots were once taken at */
+#define FLOOR_TIME_SMOOTH_MS    100
+
+#define FLOOR_OFFSET    (FFT_PRESCALE * 38000)
+
+/* Percentile of the displayed bins taken as the noise floor */
+#define FLOOR_PERCENTILE    5
+
+static const char *fftw_wisdom_filename = ".fftw_wisdom";
+
+static int airspy_rx(airspy_transfer_t* transfer);
+
+/* Each block must be done with before the next one arrives */
+static uint64_t fft_budget_ns(const pipeline_t *pipeline)
+{
+    return ((uint64_t)pipeline->iq_ring.block_samples * 1000000000) / __atomic_load_n(&pipeline->sample_rate, __ATOMIC_RELAXED);
+}
+
+static uint8_t setup_fft_levels(pipeline_t *pipeline)
+{
+    const uint32_t overlap = pipeline->config->overlap;
+    pipeline_fft_level_t *level;
+    uint32_t work[LOAD_SHED_LEVELS_MAX];
+    uint32_t level_count, hop, frames;
+    uint64_t budget_ns;
+
+    if(overlap != 0 && overlap != 50 && overlap != 75)
+    {
+        printf("%s: overlap %d%% not supported (0, 50 or 75)\n", pipeline->config->name, overlap);
+        return 0;
+    }
+
+    /* Level 0 is the configured overlap, each level down doubles the hop: less overlap, then skipped frames */
+    hop = (pipeline->fft_size * (100 - overlap)) / 100;
+    for(level_count = 0; level_count < LOAD_SHED_LEVELS_MAX; level_count++, hop *= 2)
+    {
+        frames = filterbank_frames(&pipeline->filterbank, pipeline->fft_block_samples, hop);
+        if(frames == 0 || (level_count > 0 && frames == pipeline->fft_levels[level_count - 1].frames))
+        {
+            break;
+        }
+        level = &pipeline->fft_levels[level_count];
+        level->hop = hop;
+        level->frames = frames;
+        work[level_count] = frames;
+    }
+    if(level_count == 0)
+    {
+        printf("%s: %d taps of %d bins is longer than a block\n", pipeline->config->name, pipeline->filterbank.taps, pipeline->fft_size);
+        return 0;
+    }
+
+    budget_ns = fft_budget_ns(pipeline);
+    return load_shed_init(&pipeline->load_shed, work, level_count, budget_ns,
+        ((uint64_t)FFT_LOAD_RESTORE_MS * 1000000) / budget_ns);
+}
+
+/* Fixed-point FFT in place of FFTW, power being summed in integers */
+static uint8_t setup_fft_fixed(pipeline_t *pipeline, arena_t *arena)
+{
+    const uint32_t fft_size = pipeline->fft_size;
+
+    pipeline->fft_buffer.power_lo = arena_alloc(arena, sizeof(uint64_t) * fft_size, ARENA_CACHE_LINE);
+    pipeline->fft_buffer.power_hi = arena_alloc(arena, sizeof(uint32_t) * fft_size, ARENA_CACHE_LINE);
+    pipeline->fft_block_power_lo = arena_alloc(arena, sizeof(uint64_t) * fft_size, ARENA_CACHE_LINE);
+    pipeline->fft_block_power_hi = arena_alloc(arena, sizeof(uint32_t) * fft_size, ARENA_CACHE_LINE);
+    if(pipeline->fft_buffer.power_lo == NULL || pipeline->fft_buffer.power_hi == NULL
+        || pipeline->fft_block_power_lo == NULL || pipeline->fft_block_power_hi == NULL)
+    {
+        return 0;
+    }
+    memset(pipeline->fft_buffer.power_lo, 0, sizeof(uint64_t) * fft_size);
+    memset(pipeline->fft_buffer.power_hi, 0, sizeof(uint32_t) * fft_size);
+
+    return fft_fixed_init(&pipeline->fft_fixed, arena, &pipeline->filterbank);
+}
+
+static uint8_t setup_fft(pipeline_t *pipeline, arena_t *arena)
+{
+    int i;
+
+    if(!filterbank_init(&pipeline->filterbank, arena, pipeline->config->estimator, pipeline->fft_size, pipeline->config->estimator_taps)
+        || !setup_fft_levels(pipeline))
+    {
+        return 0;
+    }
+
+    /* Block power is summed here on the float path, and converted into here for the shared memory ring on the fixed */
+    pipeline->fft_block_power = arena_alloc(arena, sizeof(double) * pipeline->fft_size, ARENA_CACHE_LINE);
+    if(pipeline->fft_block_power == NULL)
+    {
+        return 0;
+    }
+    if(pipeline->config->shm_spectrum
+        && (pipeline->fft_block_db = arena_alloc(arena, sizeof(float) * pipeline->fft_size, ARENA_CACHE_LINE)) == NULL)
+    {
+        return 0;
+    }
+
+    if(pipeline->config->fixed_point)
+    {
+        return setup_fft_fixed(pipeline, arena);
+    }
+
+    pipeline->fft_buffer.power = arena_alloc(arena, sizeof(double) * pipeline->fft_size, ARENA_CACHE_LINE);
+    if(pipeline->fft_buffer.power == NULL)
+    {
+        return 0;
+    }
+    memset(pipeline->fft_buffer.power, 0, sizeof(double) * pipeline->fft_size);
+
+    /* Set up FFTW, arena allocations are cache-line aligned which satisfies FFTW's SIMD alignment */
+    pipeline->fft_in = (fftw_complex*) arena_alloc(arena, sizeof(fftw_complex) * pipeline->fft_size, ARENA_CACHE_LINE);
+    pipeline->fft_out = (fftw_complex*) arena_alloc(arena, sizeof(fftw_complex) * pipeline->fft_size, ARENA_CACHE_LINE);
+    if(pipeline->fft_in == NULL || pipeline->fft_out == NULL)
+    {
+        return 0;
+    }
+
+    /* A reproducible plan, independent of the wisdom file */
+    if(pipeline->config->fft_estimate)
+    {
+        pipeline->fft_plan = fftw_plan_dft_1d(pipeline->fft_size, pipeline->fft_in, pipeline->fft_out, FFTW_FORWARD, FFTW_ESTIMATE);
+        return pipeline->fft_plan != NULL;
+    }
+
+    i = fftw_import_wisdom_from_filename(fftw_wisdom_filename);
+    if(i == 0)
+    {
+        fprintf(stdout, "Computing plan...");
+	fflush(stdout);
+    }
+    pipeline->fft_plan = fftw_plan_dft_1d(pipeline->fft_size, pipeline->fft_in, pipeline->fft_out, FFTW_FORWARD, FFTW_EXHAUSTIVE);
+    if(i == 0)
+    {
+        fftw_export_wisdom_to_filename(fftw_wisdom_filename);
+    }
+
+    return 1;
+}
+
+static uint8_t setup_outputs(pipeline_t *pipeline, arena_t *arena)
+{
+    websocket_output_t *outputs[] = {
+        &pipeline->output_fft,
+        &pipeline->output_fft_fast,
+        &pipeline->output_carriers,
+        &pipeline->output_fft_v2.output,
+        &pipeline->output_fft_fast_v2.output
+    };
+    uint32_t i;
+    size_t length = WEBSOCKET_OUTPUT_LENGTH;
+
+    /* Large FFT sizes need more than the default for a framed frame of uint16 bins */
+    if(FFT_FRAME_HEADER_LENGTH + (2 * pipeline->fft_size) > length)
+    {
+        length = FFT_FRAME_HEADER_LENGTH + (2 * pipeline->fft_size);
+    }
+
+    for(i = 0; i < sizeof(outputs) / sizeof(outputs[0]); i++)
+    {
+        outputs[i]->buffer = arena_alloc(arena, LWS_PRE+length, ARENA_CACHE_LINE);
+        if(outputs[i]->buffer == NULL)
+        {
+            return 0;
+        }
+        outputs[i]->size = length;
+        outputs[i]->length = 0;
+        outputs[i]->sequence_id = 0;
+        pthread_mutex_init(&outputs[i]->mutex, NULL);
+    }
+    return 1;
+}
+
+static uint8_t setup_zoom(pipeline_t *pipeline, pipeline_t *source, arena_t *arena)
+{
+    const pipeline_config_t *config = pipeline->config;
+    double offset_hz;
+    uint32_t block_samples;
+
+    if(source == NULL || source->source != NULL)
+    {
+        printf("%s: source '%s' is not an AirSpy pipeline listed before it\n", config->name, config->source);
+        return 0;
+    }
+    if(source->config->fixed_point || config->fixed_point)
+    {
+        printf("%s: zoom pipelines and their sources can't be fixed-point\n", config->name);
+        return 0;
+    }
+    pipeline->source = source;
+    source->zoom_count++;
+
+    if(config->decimation == 0)
+    {
+        printf("%s: zoom decimation not set\n", config->name);
+        return 0;
+    }
+    pipeline->sample_rate = source->sample_rate / config->decimation;
+
+    /* The whole zoomed band must lie within the source band */
+    offset_hz = (double)pipeline->freq_hz - source->freq_hz;
+    if(fabs(offset_hz) + (pipeline->sample_rate / 2.0) > source->sample_rate / 2.0)
+    {
+        printf("%s: %.03fMHz +/- %.03fMHz is outside of %s\n", config->name,
+            (float)pipeline->freq_hz/1000000, (float)pipeline->sample_rate/2000000, source->config->name);
+        return 0;
+    }
+
+    block_samples = ZOOM_BLOCK_SAMPLES;
+    while(block_samples < 4 * pipeline->fft_size * (config->estimator == FILTERBANK_WOLA ? config->estimator_taps : 1))
+    {
+        block_samples *= 2;
+    }
+    pipeline->fft_block_samples = block_samples;
+
+    if(!ddc_init(&pipeline->ddc, arena, offset_hz, source->sample_rate, config->decimation)
+        || !iq_ring_init(&pipeline->iq_ring, arena,
+            capture_ring_blocks(config->capture_seconds, pipeline->sample_rate, block_samples, ZOOM_IQ_RING_BLOCKS),
+            block_samples, IQ_SAMPLE_FLOAT32))
+    {
+        return 0;
+    }
+
+    /* Room for a block in progress plus the output of one more source block */
+    pipeline->ddc_output = arena_alloc(arena,
+        sizeof(float) * 2 * (block_samples + (source->iq_ring.block_samples / config->decimation) + 1), ARENA_CACHE_LINE);
+    return pipeline->ddc_output != NULL;
+}
+
+uint8_t pipeline_init(pipeline_t *pipeline, const pipeline_config_t *config, pipeline_t *source, arena_t *arena)
+{
+    uint32_t i;
+
+    memset(pipeline, 0, sizeof(pipeline_t));
+    pipeline->config = config;
+    pipeline->fft_size = config->fft_size;
+    pipeline->freq_hz = config->freq_hz;
+    pipeline->sample_rate = config->sample_rate;
+    pipeline->spectrum_shm.fd = -1;
+#ifdef SENSITIVE
+    pipeline->gain = config->sensitivity_gain;
+#else
+    pipeline->gain = config->linearity_gain;
+#endif
+    pipeline->biast = config->biast;
+    pthread_mutex_init(&pipeline->tune_mutex, NULL);
+
+    if(config->source != NULL)
+    {
+        if(!setup_zoom(pipeline, source, arena))
+        {
+            return 0;
+        }
+    }
+    else
+    {
+        pipeline->fft_block_samples = FFT_BLOCK_SAMPLES;
+        if(!iq_ring_init(&pipeline->iq_ring, arena,
+            capture_ring_blocks(config->capture_seconds, pipeline->sample_rate, AIRSPY_BUFFER_COPY_SIZE, IQ_RING_BLOCKS), AIRSPY_BUFFER_COPY_SIZE,
+            config->fixed_point ? IQ_SAMPLE_INT16 : IQ_SAMPLE_FLOAT32))
+        {
+            return 0;
+        }
+    }
+
+    if(config->iq_stream && config->fixed_point)
+    {
+        printf("%s: the IQ stream needs float samples, not fixed-point\n", config->name);
+        return 0;
+    }
+    if(config->iq_stream && !iq_streams_init(&pipeline->iq_streams, arena, &pipeline->iq_ring, pipeline->sample_rate))
+    {
+        return 0;
+    }
+    if(config->capture_seconds > 0 && !capture_init(&pipeline->capture, &pipeline->iq_ring, config->name,
+        config->capture_seconds, config->capture_post_seconds, pipeline->sample_rate))
+    {
+        return 0;
+    }
+    pipeline->capture_carrier_holdoff = CAPTURE_CARRIER_HOLDOFF;
+
+    if(pipeline->fft_size < 64 || pipeline->fft_size > pipeline->fft_block_samples)
+    {
+        printf("%s: FFT size %d out of range\n", config->name, pipeline->fft_size);
+        return 0;
+    }
+
+    if((pipeline->drain_power = arena_alloc(arena, sizeof(double) * pipeline->fft_size, ARENA_CACHE_LINE)) == NULL
+        || (pipeline->window_power = arena_alloc(arena, sizeof(double) * pipeline->fft_size, ARENA_CACHE_LINE)) == NULL
+        || (pipeline->line_offset = arena_alloc(arena, sizeof(double) * pipeline->fft_size, ARENA_CACHE_LINE)) == NULL
+        || (pipeline->output_data = arena_alloc(arena, sizeof(uint32_t) * pipeline->fft_size, ARENA_CACHE_LINE)) == NULL
+        || !setup_outputs(pipeline, arena))
+    {
+        return 0;
+    }
+    pthread_mutex_init(&pipeline->fft_buffer.mutex, NULL);
+    pipeline->output_length = (uint32_t)ceil(pipeline->fft_size*0.95) - (uint32_t)(pipeline->fft_size*0.05);
+
+    /* Uncompensated until the AirSpy is opened and its profile loaded, a zoom pipeline's passband is the DDC's */
+    for(i = 0; i < pipeline->fft_size; i++)
+    {
+        pipeline->line_offset[i] = FFT_SCALE * FFT_OFFSET;
+    }
+    if(pipeline->source == NULL
+        && (pipeline->line_profile_points = arena_alloc(arena, sizeof(float) * LINE_PROFILE_POINTS_MAX, ARENA_CACHE_LINE)) == NULL)
+    {
+        return 0;
+    }
+
+    carrier_detector_init(&pipeline->carrier_detector, FFT_SCALE / FFT_PRESCALE);
+
+    if(config->shm_spectrum && !spectrum_shm_init(&pipeline->spectrum_shm, config->name, pipeline->fft_size))
+    {
+        return 0;
+    }
+
+    return setup_fft(pipeline, arena);
+}
+
+static uint8_t setup_airspy(pipeline_t *pipeline)
+{
+    const pipeline_config_t *config = pipeline->config;
+    airspy_read_partid_serialno_t partid_serialno;
+    int result;
+
+    if(config->serial != 0)
+    {
+    	result = airspy_open_sn(&pipeline->device, config->serial);
+    }
+    else
+    {
+    	result = airspy_open(&pipeline->device);
+    }
+    if( result != AIRSPY_SUCCESS ) {
+	    printf("airspy_open() failed: %s (%d)\n", airspy_error_name(result), result);
+	    pipeline->device = NULL;
+	    return 0;
+    }
+
+    /* The serial keys the line profile, read it back if the first available device was opened */
+    pipeline->serial = config->serial;
+    if(pipeline->serial == 0
+        && airspy_board_partid_serialno_read(pipeline->device, &partid_serialno) == AIRSPY_SUCCESS)
+    {
+        pipeline->serial = ((uint64_t)partid_serialno.serial_no[2] << 32) | partid_serialno.serial_no[3];
+    }
+
+    result = airspy_set_sample_type(pipeline->device, config->fixed_point ? AIRSPY_SAMPLE_TYPE_FIXED : AIRSPY_SAMPLE_TYPE);
+    if (result != AIRSPY_SUCCESS) {
+	    printf("airspy_set_sample_type() failed: %s (%d)\n", airspy_error_name(result), result);
+	    airspy_close(pipeline->device);
+	    pipeline->device = NULL;
+	    return 0;
+    }
+
+    /* For live sample rate changes */
+    if(airspy_get_samplerates(pipeline->device, &pipeline->sample_rate_count, 0) != AIRSPY_SUCCESS
+        || pipeline->sample_rate_count > PIPELINE_SAMPLE_RATES_MAX
+        || airspy_get_samplerates(pipeline->device, pipeline->sample_rates, pipeline->sample_rate_count) != AIRSPY_SUCCESS)
+    {
+        pipeline->sample_rate_count = 0;
+    }
+
+    result = airspy_set_samplerate(pipeline->device, pipeline->sample_rate);
+    if (result != AIRSPY_SUCCESS) {
+	    printf("airspy_set_samplerate() failed: %s (%d)\n", airspy_error_name(result), result);
+	    airspy_close(pipeline->device);
+	    pipeline->device = NULL;
+	    return 0;
+    }
+
+    result = airspy_set_rf_bias(pipeline->device, pipeline->biast);
+    if( result != AIRSPY_SUCCESS ) {
+	    printf("airspy_set_rf_bias() failed: %s (%d)\n", airspy_error_name(result), result);
+	    airspy_close(pipeline->device);
+	    pipeline->device = NULL;
+	    return 0;
+    }
+
+    #ifdef LINEAR
+	    result =  airspy_set_linearity_gain(pipeline->device, pipeline->gain);
+	    if( result != AIRSPY_SUCCESS ) {
+		    printf("airspy_set_linearity_gain() failed: %s (%d)\n", airspy_error_name(result), result);
+	    }
+    #elif defined SENSITIVE
+	    result =  airspy_set_sensitivity_gain(pipeline->device, pipeline->gain);
+	    if( result != AIRSPY_SUCCESS ) {
+		    printf("airspy_set_sensitivity_gain() failed: %s (%d)\n", airspy_error_name(result), result);
+	    }
+    #endif
+
+    result = airspy_start_rx(pipeline->device, airspy_rx, pipeline);
+    if( result != AIRSPY_SUCCESS ) {
+	    printf("airspy_start_rx() failed: %s (%d)\n", airspy_error_name(result), result);
+	    airspy_close(pipeline->device);
+	    pipeline->device = NULL;
+	    return 0;
+    }
+
+    result = airspy_set_freq(pipeline->device, pipeline->freq_hz);
+    if( result != AIRSPY_SUCCESS ) {
+	    printf("airspy_set_freq() failed: %s (%d)\n", airspy_error_name(result), result);
+	    airspy_stop_rx(pipeline->device);
+	    airspy_close(pipeline->device);
+	    pipeline->device = NULL;
+	    return 0;
+    }
+
+    return 1;
+}
+
+/* Airspy RX Callback, this is called by a new thread within libairspy */
+static int airspy_rx(airspy_transfer_t* transfer)
+{
+    pipeline_t *pipeline = (pipeline_t *)transfer->ctx;
+    struct timespec timestamp;
+    uint64_t duration_ns;
+
+    if(transfer->samples != NULL && transfer->sample_count >= AIRSPY_BUFFER_COPY_SIZE)
+    {
+        /* Drop samples taken around a change of tuning */
+        if(__atomic_load_n(&pipeline->tune_settle_blocks, __ATOMIC_SEQ_CST) > 0)
+        {
+            __atomic_sub_fetch(&pipeline->tune_settle_blocks, 1, __ATOMIC_SEQ_CST);
+            return 0;
+        }
+
+        /* Transfer has just completed, so back-date the timestamp to its first sample */
+        clock_gettime(CLOCK_REALTIME, &timestamp);
+        duration_ns = ((uint64_t)AIRSPY_BUFFER_COPY_SIZE * 1000000000) / __atomic_load_n(&pipeline->sample_rate, __ATOMIC_RELAXED);
+        if((uint64_t)timestamp.tv_nsec >= duration_ns % 1000000000)
+        {
+            timestamp.tv_nsec -= duration_ns % 1000000000;
+        }
+        else
+        {
+            timestamp.tv_sec -= 1;
+            timestamp.tv_nsec += 1000000000 - (duration_ns % 1000000000);
+        }
+        timestamp.tv_sec -= duration_ns / 1000000000;
+
+        iq_ring_write(&pipeline->iq_ring, transfer->samples, AIRSPY_BUFFER_COPY_SIZE, &timestamp,
+            __atomic_load_n(&pipeline->epoch, __ATOMIC_SEQ_CST));
+    }
+	return 0;
+}
+
+void pipeline_fft_accumulate(pipeline_t *pipeline)
+{
+    const uint32_t fft_size = pipeline->fft_size;
+    fftw_complex    *fft_out = pipeline->fft_out;
+    double          *power = pipeline->fft_block_power;
+    uint32_t        i;
+    fftw_complex    pt;
+
+    double pwr_scale = 1.0 / ((float)fft_size * (float)fft_size);
+
+    if(pipeline->config->fixed_point)
+    {
+        fft_fixed_accumulate(&pipeline->fft_fixed, pipeline->fft_block_power_lo, pipeline->fft_block_power_hi);
+        return;
+    }
+
+    for (i = 0; i < fft_size; i++)
+    {
+        /* shift and normalize */
+        if (i < fft_size / 2)
+        {
+            pt[0] = fft_out[fft_size / 2 + i][0] / fft_size;
+            pt[1] = fft_out[fft_size / 2 + i][1] / fft_size;
+        }
+        else
+        {
+            pt[0] = fft_out[i - fft_size / 2][0] / fft_size;
+            pt[1] = fft_out[i - fft_size / 2][1] / fft_size;
+        }
+        power[i] += pwr_scale * ((pt[0] * pt[0]) + (pt[1] * pt[1]));
+    }
+}
+
+/* Add the block's power to the fft_buffer, once per block so the main thread rarely waits on the lock */
+static void pipeline_fft_post(pipeline_t *pipeline, uint32_t _frames)
+{
+    const uint32_t fft_size = pipeline->fft_size;
+    fft_buffer_t *fft_buffer = &pipeline->fft_buffer;
+    uint32_t i;
+
+    pthread_mutex_lock(&fft_buffer->mutex);
+
+    /* Power of an earlier tuning not yet drained is dropped */
+    if(fft_buffer->epoch != pipeline->fft_epoch)
+    {
+        if(pipeline->config->fixed_point)
+        {
+            memset(fft_buffer->power_lo, 0, sizeof(uint64_t) * fft_size);
+            memset(fft_buffer->power_hi, 0, sizeof(uint32_t) * fft_size);
+        }
+        else
+        {
+            memset(fft_buffer->power, 0, sizeof(double) * fft_size);
+        }
+        fft_buffer->frames = 0;
+        fft_buffer->epoch = pipeline->fft_epoch;
+    }
+
+    if(pipeline->config->fixed_point)
+    {
+        for(i = 0; i < fft_size; i++)
+        {
+            fft_buffer->power_lo[i] += pipeline->fft_block_power_lo[i];
+            fft_buffer->power_hi[i] += pipeline->fft_block_power_hi[i] + (fft_buffer->power_lo[i] < pipeline->fft_block_power_lo[i]);
+        }
+    }
+    else
+    {
+        for(i = 0; i < fft_size; i++)
+        {
+            fft_buffer->power[i] += pipeline->fft_block_power[i];
+        }
+    }
+    fft_buffer->frames += _frames;
+    fft_buffer->sample_index = pipeline->fft_sample_index;
+    fft_buffer->timestamp = pipeline->fft_timestamp;
+
+    pthread_mutex_unlock(&fft_buffer->mutex);
+}
+
+void pipeline_fft_block(pipeline_t *pipeline, const void *samples, const pipeline_fft_level_t *level)
+{
+    const float *samples_float = samples;
+    const int16_t *samples_int16 = samples;
+    uint32_t index;
+
+    if(pipeline->config->fixed_point)
+    {
+        memset(pipeline->fft_block_power_lo, 0, sizeof(uint64_t) * pipeline->fft_size);
+        memset(pipeline->fft_block_power_hi, 0, sizeof(uint32_t) * pipeline->fft_size);
+    }
+    else
+    {
+        memset(pipeline->fft_block_power, 0, sizeof(double) * pipeline->fft_size);
+    }
+
+    for(index = 0; index < level->frames; index++)
+    {
+        if(pipeline->config->fixed_point)
+        {
+            /* Window, fold and transform in fixed point */
+            fft_fixed_execute(&pipeline->fft_fixed, &samples_int16[2 * index * level->hop]);
+        }
+        else
+        {
+            /* Window (and fold) the frame out of the rf buffer into the fft_input buffer */
+            filterbank_prefilter(&pipeline->filterbank, &samples_float[2 * index * level->hop], pipeline->fft_in);
+
+            /* Run FFT */
+            fftw_execute(pipeline->fft_plan);
+        }
+
+        pipeline_fft_accumulate(pipeline);
+    }
+
+    pipeline_fft_post(pipeline, level->frames);
+}
+
+/* Mean power of the block just taken in dBFS, for the shared memory ring */
+static void pipeline_fft_block_db(pipeline_t *pipeline, uint32_t _frames)
+{
+    uint32_t i;
+
+    if(pipeline->config->fixed_point)
+    {
+        fft_fixed_power(&pipeline->fft_fixed, pipeline->fft_block_power_lo, pipeline->fft_block_power_hi, pipeline->fft_block_power);
+    }
+    for(i = 0; i < pipeline->fft_size; i++)
+    {
+        pipeline->fft_block_db[i] = 10.0 * log10((pipeline->fft_block_power[i] / _frames) + 1.0e-20);
+    }
+}
+
+/* FFT Thread */
+static void *thread_fft(void *arg)
+{
+    pipeline_t *pipeline = (pipeline_t *)arg;
+    const uint32_t fft_size = pipeline->fft_size;
+    const pipeline_fft_level_t *level;
+    uint64_t        sequence = 0;
+    uint64_t        backlog;
+    const iq_block_t *block;
+    uint64_t        sample_index;
+    struct timespec timestamp;
+    uint64_t        skipped = 0;
+    bool            discontinuity = false;
+    struct timespec cpu_start, cpu_end, busy_start, busy_end;
+
+    while(1)
+    {
+        /* Wait for the next block of IQ */
+        block = iq_ring_read(&pipeline->iq_ring, &sequence, &pipeline->fft_blocks_skipped);
+
+        clock_gettime(CLOCK_MONOTONIC, &busy_start);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+
+        sample_index = block->sample_index;
+        timestamp = block->timestamp;
+        pipeline->fft_sample_index = sample_index;
+        pipeline->fft_timestamp = timestamp;
+
+        /* Retuned, the stages restart their averaging from this block, at the new block rate */
+        if(block->epoch != pipeline->fft_epoch)
+        {
+            pipeline->fft_epoch = block->epoch;
+            pipeline->load_shed.budget_ns = fft_budget_ns(pipeline);
+            pipeline->load_shed.restore_blocks = ((uint64_t)FFT_LOAD_RESTORE_MS * 1000000) / pipeline->load_shed.budget_ns;
+            discontinuity = true;
+        }
+
+        level = &pipeline->fft_levels[pipeline->load_shed.level];
+        pipeline_fft_block(pipeline, block->samples, level);
+
+        if(pipeline->config->shm_spectrum)
+        {
+            pipeline_fft_block_db(pipeline, level->frames);
+            spectrum_shm_publish(&pipeline->spectrum_shm, pipeline->fft_block_db, fft_size,
+                discontinuity || (pipeline->fft_blocks_skipped + pipeline->fft_blocks_shed) != skipped ? SPECTRUM_SHM_FLAG_DISCONTINUITY : 0,
+                sample_index, &timestamp, __atomic_load_n(&pipeline->freq_hz, __ATOMIC_RELAXED),
+                __atomic_load_n(&pipeline->sample_rate, __ATOMIC_RELAXED), fft_size,
+                (100 * level->frames) / pipeline->fft_levels[0].frames);
+            skipped = pipeline->fft_blocks_skipped + pipeline->fft_blocks_shed;
+        }
+        discontinuity = false;
+
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+        clock_gettime(CLOCK_MONOTONIC, &busy_end);
+        __atomic_add_fetch(&pipeline->fft_cpu_ns,
+            ((cpu_end.tv_sec - cpu_start.tv_sec) * 1000000000ULL) + cpu_end.tv_nsec - cpu_start.tv_nsec, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&pipeline->fft_lines, level->frames, __ATOMIC_RELAXED);
+
+        /* Adjust quality to the time taken (including any time we were preempted) and the blocks queued behind this one */
+        backlog = iq_ring_backlog(&pipeline->iq_ring, sequence + 1);
+        if(load_shed_update(&pipeline->load_shed,
+            ((busy_end.tv_sec - busy_start.tv_sec) * 1000000000ULL) + busy_end.tv_nsec - busy_start.tv_nsec, backlog))
+        {
+            __atomic_store_n(&pipeline->fft_level, pipeline->load_shed.level, __ATOMIC_RELAXED);
+        }
+
+        /* Count the block as lost if the AirSpy callback lapped us while we were reading it */
+        if(!iq_ring_valid(&pipeline->iq_ring, sequence))
+        {
+            pipeline->fft_blocks_skipped++;
+        }
+        sequence++;
+
+        /* Still falling behind at the lowest quality, drop all but the newest block rather than wait to be lapped */
+        if(load_shed_overloaded(&pipeline->load_shed, backlog))
+        {
+            pipeline->fft_blocks_shed += backlog - 1;
+            sequence += backlog - 1;
+        }
+    }
+
+    return NULL;
+}
+
+static void timespec_add_ns(struct timespec *ts, uint64_t _ns)
+{
+    ts->tv_sec += _ns / 1000000000;
+    ts->tv_nsec += _ns % 1000000000;
+    if(ts->tv_nsec >= 1000000000)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+/* DDC Thread, zoom pipelines only */
+static void *thread_ddc(void *arg)
+{
+    pipeline_t *pipeline = (pipeline_t *)arg;
+    pipeline_t *source = pipeline->source;
+    const uint32_t block_samples = pipeline->iq_ring.block_samples;
+    uint64_t sequence = 0;
+    const iq_block_t *block;
+    struct timespec timestamp = { 0 }, cpu_start, cpu_end;
+    uint32_t start, position, epoch = 0;
+
+    /* The source is already running, start from its next block */
+    sequence = iq_ring_head(&source->iq_ring);
+
+    while(1)
+    {
+        /* Wait for the next block of IQ from the source */
+        block = iq_ring_read(&source->iq_ring, &sequence, &pipeline->ddc_blocks_skipped);
+
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+
+        /* The source was retuned, drop the zoom block in progress rather than span the change */
+        if(block->epoch != epoch)
+        {
+            epoch = block->epoch;
+            pipeline->ddc_output_fill = 0;
+        }
+
+        /* A new zoom block starts in this source block (to within the DDC's group delay) */
+        start = pipeline->ddc_output_fill;
+        if(start == 0)
+        {
+            timestamp = block->timestamp;
+        }
+
+        pipeline->ddc_output_fill += ddc_process(&pipeline->ddc, block->samples, block->sample_count,
+            &pipeline->ddc_output[2 * start]);
+
+        position = 0;
+        while(pipeline->ddc_output_fill - position >= block_samples)
+        {
+            iq_ring_write(&pipeline->iq_ring, &pipeline->ddc_output[2 * position], block_samples, &timestamp, epoch);
+            position += block_samples;
+
+            /* The next zoom block starts partway through this source block */
+            timestamp = block->timestamp;
+            timespec_add_ns(&timestamp,
+                ((uint64_t)(position - start) * pipeline->config->decimation * 1000000000) / source->sample_rate);
+        }
+        if(position > 0)
+        {
+            pipeline->ddc_output_fill -= position;
+            memmove(pipeline->ddc_output, &pipeline->ddc_output[2 * position], sizeof(float) * 2 * pipeline->ddc_output_fill);
+        }
+
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+        __atomic_add_fetch(&pipeline->ddc_cpu_ns,
+            ((cpu_end.tv_sec - cpu_start.tv_sec) * 1000000000ULL) + cpu_end.tv_nsec - cpu_start.tv_nsec, __ATOMIC_RELAXED);
+
+        /* Count the block as lost if the source lapped us while we were reading it */
+        if(!iq_ring_valid(&source->iq_ring, sequence))
+        {
+            pipeline->ddc_blocks_skipped++;
+        }
+        sequence++;
+    }
+
+    return NULL;
+}
+
+static uint8_t start_zoom(pipeline_t *pipeline)
+{
+    const pipeline_config_t *config = pipeline->config;
+    char thread_name[16];
+
+    fprintf(stdout, "Starting DDC Thread for %s (%s %.03fMHz, %.03fMSPS).. ", config->name,
+        pipeline->source->config->name, (float)pipeline->freq_hz/1000000, (float)pipeline->sample_rate/1000000);
+    if (pthread_create(&pipeline->ddc_thread, NULL, thread_ddc, pipeline))
+    {
+        fprintf(stderr, "Error creating DDC thread\n");
+        return 0;
+    }
+    snprintf(thread_name, sizeof(thread_name), "DDC %s", config->name);
+    pthread_setname_np(pipeline->ddc_thread, thread_name);
+    fprintf(stdout, "Done.\n");
+    realtime_thread_apply(pipeline->ddc_thread, thread_name, config->cpu_affinity_airspy, config->fifo_priority_airspy);
+
+    return 1;
+}
+
+uint8_t pipeline_init_relay(pipeline_t *pipeline, const pipeline_config_t *config, arena_t *arena)
+{
+    memset(pipeline, 0, sizeof(pipeline_t));
+    pipeline->config = config;
+    pipeline->fft_size = config->fft_size;
+    pipeline->freq_hz = config->freq_hz;
+    pipeline->sample_rate = config->sample_rate;
+    pipeline->spectrum_shm.fd = -1;
+    pipeline->relayed = true;
+
+    return setup_outputs(pipeline, arena);
+}
+
+uint8_t pipeline_start(pipeline_t *pipeline)
+{
+    const pipeline_config_t *config = pipeline->config;
+    char thread_name[16];
+
+    if(pipeline->source != NULL)
+    {
+        if(!start_zoom(pipeline))
+        {
+            return 0;
+        }
+    }
+    else
+    {
+        /* libairspy's USB and conversion threads inherit the settings of the thread that starts them */
+        snprintf(thread_name, sizeof(thread_name), "AirSpy %s", config->name);
+        realtime_thread_apply(pthread_self(), thread_name, config->cpu_affinity_airspy, config->fifo_priority_airspy);
+
+        fprintf(stdout, "Initialising AirSpy for %s (%.01fMSPS, %.03fMHz).. ", config->name, (float)pipeline->sample_rate/1000000, (float)pipeline->freq_hz/1000000);
+        fflush(stdout);
+        if(!setup_airspy(pipeline))
+        {
+            fprintf(stderr, "AirSpy init failed.\n");
+            return 0;
+        }
+        fprintf(stdout, "Done.\n");
+
+        pipeline_line_profile_apply(pipeline);
+    }
+
+    fprintf(stdout, "Starting FFT Thread for %s.. ", config->name);
+    if (pthread_create(&pipeline->fft_thread, NULL, thread_fft, pipeline))
+    {
+        fprintf(stderr, "Error creating FFT thread\n");
+        return 0;
+    }
+    snprintf(thread_name, sizeof(thread_name), "FFT %s", config->name);
+    pthread_setname_np(pipeline->fft_thread, thread_name);
+    fprintf(stdout, "Done.\n");
+    realtime_thread_apply(pipeline->fft_thread, thread_name, config->cpu_affinity_fft, config->fifo_priority_fft);
+
+    if(config->iq_stream)
+    {
+        fprintf(stdout, "Starting IQ Thread for %s.. ", config->name);
+        if(!iq_streams_start(&pipeline->iq_streams))
+        {
+            fprintf(stderr, "Error creating IQ thread\n");
+            return 0;
+        }
+        snprintf(thread_name, sizeof(thread_name), "IQ %s", config->name);
+        pthread_setname_np(pipeline->iq_streams.thread, thread_name);
+        fprintf(stdout, "Done.\n");
+        realtime_thread_apply(pipeline->iq_streams.thread, thread_name, config->cpu_affinity_fft, 0);
+    }
+
+    if(config->capture_seconds > 0)
+    {
+        fprintf(stdout, "Starting Capture Thread for %s (%ds + %ds).. ", config->name, config->capture_seconds, config->capture_post_seconds);
+        if(!capture_start(&pipeline->capture))
+        {
+            fprintf(stderr, "Error creating capture thread\n");
+            return 0;
+        }
+        snprintf(thread_name, sizeof(thread_name), "Capture %s", config->name);
+        pthread_setname_np(pipeline->capture.thread, thread_name);
+        fprintf(stdout, "Done.\n");
+        realtime_thread_apply(pipeline->capture.thread, thread_name, "", 0);
+    }
+
+    return 1;
+}
+
+void pipeline_close(pipeline_t *pipeline)
+{
+    int result;
+
+    /* De-init AirSpy device */
+    if(pipeline->device != NULL)
+    {
+	    result = airspy_stop_rx(pipeline->device);
+	    if( result != AIRSPY_SUCCESS ) {
+		    printf("airspy_stop_rx() failed: %s (%d)\n", airspy_error_name(result), result);
+	    }
+
+	    result = airspy_close(pipeline->device);
+	    if( result != AIRSPY_SUCCESS )
+	    {
+		    printf("airspy_close() failed: %s (%d)\n", airspy_error_name(result), result);
+	    }
+	    pipeline->device = NULL;
+    }
+
+    spectrum_shm_close(&pipeline->spectrum_shm);
+
+    /* De-init fftw, buffers belong to the arena */
+    if(pipeline->fft_plan != NULL)
+    {
+        fftw_destroy_plan(pipeline->fft_plan);
+        pipeline->fft_plan = NULL;
+    }
+}
+
+uint32_t pipeline_tune_request(pipeline_t *pipeline, const pipeline_tune_t *tune, const char **error)
+{
+    pipeline_tune_t *pending = &pipeline->tune_pending;
+    uint32_t i, ticket;
+
+    if(pipeline->source != NULL || pipeline->relayed)
+    {
+        *error = "not an AirSpy pipeline";
+        return 0;
+    }
+    if(!tune->set_freq && !tune->set_sample_rate && !tune->set_gain && !tune->set_biast && !tune->capture)
+    {
+        *error = "nothing to change";
+        return 0;
+    }
+    if(tune->capture && pipeline->config->capture_seconds == 0)
+    {
+        *error = "capture not configured";
+        return 0;
+    }
+    if(tune->set_freq && (tune->freq_hz < TUNE_FREQ_MIN || tune->freq_hz > TUNE_FREQ_MAX))
+    {
+        *error = "frequency out of range";
+        return 0;
+    }
+    if(tune->set_sample_rate)
+    {
+        for(i = 0; i < pipeline->sample_rate_count && pipeline->sample_rates[i] != tune->sample_rate; i++);
+        if(i == pipeline->sample_rate_count)
+        {
+            *error = "sample rate not supported";
+            return 0;
+        }
+    }
+    /* Zoom pipelines are set up at an offset and decimation from this tuning */
+    if((tune->set_freq || tune->set_sample_rate) && pipeline->zoom_count > 0)
+    {
+        *error = "zoom pipelines depend on this tuning";
+        return 0;
+    }
+    /* IQ subscriptions were fitted to this rate, checked again when the change is applied */
+    if(tune->set_sample_rate && tune->sample_rate != pipeline->sample_rate && pipeline->config->iq_stream
+        && __atomic_load_n(&pipeline->iq_streams.clients, __ATOMIC_RELAXED) > 0)
+    {
+        *error = "IQ clients depend on this sample rate";
+        return 0;
+    }
+    if(tune->set_gain && tune->gain > TUNE_GAIN_MAX)
+    {
+        *error = "gain out of range";
+        return 0;
+    }
+    if(tune->set_biast && tune->biast > 1)
+    {
+        *error = "biast is 0 or 1";
+        return 0;
+    }
+
+    /* Merge with any change not yet applied */
+    pthread_mutex_lock(&pipeline->tune_mutex);
+    if(tune->set_freq)
+    {
+        pending->set_freq = true;
+        pending->freq_hz = tune->freq_hz;
+    }
+    if(tune->set_sample_rate)
+    {
+        pending->set_sample_rate = true;
+        pending->sample_rate = tune->sample_rate;
+    }
+    if(tune->set_gain)
+    {
+        pending->set_gain = true;
+        pending->gain = tune->gain;
+    }
+    if(tune->set_biast)
+    {
+        pending->set_biast = true;
+        pending->biast = tune->biast;
+    }
+    pending->capture |= tune->capture;
+    ticket = ++pipeline->tune_requested;
+    pthread_mutex_unlock(&pipeline->tune_mutex);
+
+    return ticket;
+}
+
+/* A sample rate change, stopping and restarting the AirSpy on its own thread */
+typedef struct {
+    pipeline_t *pipeline;
+    uint32_t sample_rate;
+    int result;
+    bool rate_set;
+    bool restarted;
+} pipeline_restart_t;
+
+/* libairspy's USB and conversion threads inherit the settings of the thread that starts them, as in
+ *  pipeline_start(), which the main thread no longer has */
+static void *thread_airspy_restart(void *arg)
+{
+    pipeline_restart_t *restart = (pipeline_restart_t *)arg;
+    pipeline_t *pipeline = restart->pipeline;
+    const pipeline_config_t *config = pipeline->config;
+    char thread_name[16];
+
+    snprintf(thread_name, sizeof(thread_name), "AirSpy %s", config->name);
+    realtime_thread_apply(pthread_self(), thread_name, config->cpu_affinity_airspy, config->fifo_priority_airspy);
+
+    restart->rate_set = false;
+    restart->restarted = true;
+    restart->result = airspy_stop_rx(pipeline->device);
+    if(restart->result == AIRSPY_SUCCESS)
+    {
+        restart->result = airspy_set_samplerate(pipeline->device, restart->sample_rate);
+        restart->rate_set = (restart->result == AIRSPY_SUCCESS);
+
+        /* Restart at whichever rate is now set */
+        restart->restarted = (airspy_start_rx(pipeline->device, airspy_rx, pipeline) == AIRSPY_SUCCESS);
+    }
+
+    return NULL;
+}
+
+bool pipeline_tune_apply(pipeline_t *pipeline)
+{
+    pipeline_restart_t restart;
+    pthread_t restart_thread;
+    pipeline_tune_t tune;
+    const char *error = NULL;
+    uint32_t ticket, sample_rate;
+    int result = AIRSPY_SUCCESS;
+
+    pthread_mutex_lock(&pipeline->tune_mutex);
+    ticket = pipeline->tune_requested;
+    if(ticket == pipeline->tune_completed)
+    {
+        pthread_mutex_unlock(&pipeline->tune_mutex);
+        return false;
+    }
+    tune = pipeline->tune_pending;
+    memset(&pipeline->tune_pending, 0, sizeof(pipeline_tune_t));
+    pthread_mutex_unlock(&pipeline->tune_mutex);
+
+    if(!tune.set_freq && !tune.set_sample_rate && !tune.set_gain && !tune.set_biast)
+    {
+        /* A capture alone, nothing to retune */
+    }
+    else if(pipeline->device == NULL)
+    {
+        error = "AirSpy not running";
+    }
+    else if(tune.set_sample_rate && tune.sample_rate != pipeline->sample_rate && pipeline->config->iq_stream
+        && !iq_streams_rate_change_begin(&pipeline->iq_streams))
+    {
+        /* A client subscribed since the request, nothing is changed */
+        error = "IQ clients depend on this sample rate";
+    }
+    else
+    {
+        /* Drop whatever is in flight from here until the change has settled */
+        sample_rate = tune.set_sample_rate ? tune.sample_rate : pipeline->sample_rate;
+        __atomic_store_n(&pipeline->tune_settle_blocks,
+            1 + (((uint64_t)PIPELINE_TUNE_SETTLE_MS * sample_rate) / (1000 * AIRSPY_BUFFER_COPY_SIZE)), __ATOMIC_SEQ_CST);
+
+        /* libairspy only changes sample rate with streaming stopped */
+        if(tune.set_sample_rate && tune.sample_rate != pipeline->sample_rate)
+        {
+            restart.pipeline = pipeline;
+            restart.sample_rate = tune.sample_rate;
+            if(pthread_create(&restart_thread, NULL, thread_airspy_restart, &restart))
+            {
+                error = "AirSpy restart thread failed";
+            }
+            else
+            {
+                pthread_join(restart_thread, NULL);
+                result = restart.result;
+                if(restart.rate_set)
+                {
+                    __atomic_store_n(&pipeline->sample_rate, tune.sample_rate, __ATOMIC_RELAXED);
+                    pipeline_line_profile_apply(pipeline);
+                }
+                if(!restart.restarted)
+                {
+                    error = "AirSpy failed to restart";
+                }
+            }
+            if(pipeline->config->iq_stream)
+            {
+                iq_streams_rate_change_end(&pipeline->iq_streams, pipeline->sample_rate);
+            }
+        }
+        if(result == AIRSPY_SUCCESS && tune.set_freq)
+        {
+            result = airspy_set_freq(pipeline->device, tune.freq_hz);
+            if(result == AIRSPY_SUCCESS)
+            {
+                __atomic_store_n(&pipeline->freq_hz, tune.freq_hz, __ATOMIC_RELAXED);
+            }
+        }
+        if(result == AIRSPY_SUCCESS && tune.set_gain)
+        {
+#ifdef SENSITIVE
+            result = airspy_set_sensitivity_gain(pipeline->device, tune.gain);
+#else
+            result = airspy_set_linearity_gain(pipeline->device, tune.gain);
+#endif
+            if(result == AIRSPY_SUCCESS)
+            {
+                pipeline->gain = tune.gain;
+            }
+        }
+        if(result == AIRSPY_SUCCESS && tune.set_biast)
+        {
+            result = airspy_set_rf_bias(pipeline->device, tune.biast);
+            if(result == AIRSPY_SUCCESS)
+            {
+                pipeline->biast = tune.biast;
+            }
+        }
+        if(result != AIRSPY_SUCCESS && error == NULL)
+        {
+            printf("%s: retune failed: %s (%d)\n", pipeline->config->name, airspy_error_name(result), result);
+            error = "AirSpy error";
+        }
+
+        /* Samples from now on are of the new tuning, even if only partly applied */
+        __atomic_add_fetch(&pipeline->epoch, 1, __ATOMIC_SEQ_CST);
+
+        fprintf(stdout, "%s: tuned to %.03fMHz, %.01fMSPS, gain %d, biast %d (epoch %d)\n", pipeline->config->name,
+            (float)pipeline->freq_hz/1000000, (float)pipeline->sample_rate/1000000, pipeline->gain, pipeline->biast, pipeline->epoch);
+    }
+
+    if(tune.capture && error == NULL && !pipeline_capture_trigger(pipeline, "operator"))
+    {
+        error = "capture already running";
+    }
+
+    pthread_mutex_lock(&pipeline->tune_mutex);
+    pipeline->tune_completed = ticket;
+    pipeline->tune_error = error;
+    pthread_mutex_unlock(&pipeline->tune_mutex);
+
+    return true;
+}
+
+bool pipeline_capture_trigger(pipeline_t *pipeline, const char *_reason)
+{
+    if(pipeline->config->capture_seconds == 0)
+    {
+        return false;
+    }
+    /* Called from the FFT thread too, while the main thread retunes */
+    return capture_trigger(&pipeline->capture, __atomic_load_n(&pipeline->epoch, __ATOMIC_SEQ_CST),
+        __atomic_load_n(&pipeline->freq_hz, __ATOMIC_RELAXED), __atomic_load_n(&pipeline->sample_rate, __ATOMIC_RELAXED), _reason);
+}
+
+uint32_t pipeline_tune_completed(pipeline_t *pipeline, const char **error)
+{
+    uint32_t ticket;
+
+    pthread_mutex_lock(&pipeline->tune_mutex);
+    ticket = pipeline->tune_completed;
+    *error = pipeline->tune_error;
+    pthread_mutex_unlock(&pipeline->tune_mutex);
+
+    return ticket;
+}
+
+uint32_t pipeline_fft_quality(pipeline_t *pipeline)
+{
+    uint32_t level = __atomic_load_n(&pipeline->fft_level, __ATOMIC_RELAXED);
+
+    return (100 * pipeline->fft_levels[level].frames) / pipeline->fft_levels[0].frames;
+}
+
+void pipeline_print_stats(pipeline_t *pipeline, uint32_t _interval_ms)
+{
+    uint64_t cpu_ns = __atomic_load_n(&pipeline->fft_cpu_ns, __ATOMIC_RELAXED);
+    uint64_t lines = __atomic_load_n(&pipeline->fft_lines, __ATOMIC_RELAXED);
+    uint64_t cpu_delta = cpu_ns - pipeline->stats_cpu_ns;
+    uint64_t lines_delta = lines - pipeline->stats_lines;
+    uint32_t level = __atomic_load_n(&pipeline->fft_level, __ATOMIC_RELAXED);
+    const iq_subscription_t *subscription;
+    uint32_t i;
+
+    fprintf(stdout, "FFT %s: %s%s", pipeline->config->name, filterbank_name(&pipeline->filterbank),
+        pipeline->config->fixed_point ? " fixed-point" : "");
+    if(pipeline->filterbank.taps > 1)
+    {
+        fprintf(stdout, " %d taps", pipeline->filterbank.taps);
+    }
+    fprintf(stdout, ", quality %d%% (level %d/%d, %d lines/block, %"PRIu64" changes)",
+        pipeline_fft_quality(pipeline), level, pipeline->load_shed.level_count - 1,
+        pipeline->fft_levels[level].frames, pipeline->load_shed.changes);
+    fprintf(stdout, ", %.2fus/line, %.1f%% CPU, %"PRIu64" blocks skipped, %"PRIu64" shed\n",
+        lines_delta > 0 ? (cpu_delta / 1000.0) / lines_delta : 0.0,
+        _interval_ms > 0 ? (cpu_delta / 1e4) / _interval_ms : 0.0,
+        pipeline->fft_blocks_skipped, pipeline->fft_blocks_shed);
+
+    pipeline->stats_cpu_ns = cpu_ns;
+    pipeline->stats_lines = lines;
+
+    if(pipeline->source != NULL)
+    {
+        cpu_ns = __atomic_load_n(&pipeline->ddc_cpu_ns, __ATOMIC_RELAXED);
+        fprintf(stdout, "DDC %s: %s %.03fMHz /%d, %.1f%% CPU, %"PRIu64" blocks skipped\n",
+            pipeline->config->name, pipeline->source->config->name, (float)pipeline->freq_hz/1000000, pipeline->config->decimation,
+            _interval_ms > 0 ? ((cpu_ns - pipeline->stats_ddc_cpu_ns) / 1e4) / _interval_ms : 0.0,
+            pipeline->ddc_blocks_skipped);
+        pipeline->stats_ddc_cpu_ns = cpu_ns;
+    }
+
+    if(pipeline->config->iq_stream)
+    {
+        fprintf(stdout, "IQ %s:", pipeline->config->name);
+        for(i = 0; i < IQ_STREAM_SUBSCRIPTIONS_MAX; i++)
+        {
+            subscription = &pipeline->iq_streams.subscriptions[i];
+            if(subscription->active)
+            {
+                fprintf(stdout, " %+.03fMHz %dkSPS (%d clients),", (float)subscription->offset_hz/1000000,
+                    iq_subscription_rate(&pipeline->iq_streams, subscription)/1000, subscription->clients);
+            }
+        }
+        fprintf(stdout, " %d clients, %"PRIu64" blocks skipped\n", pipeline->iq_streams.clients, pipeline->iq_streams.blocks_skipped);
+    }
+
+    if(pipeline->config->capture_seconds > 0)
+    {
+        capture_print_stats(&pipeline->capture);
+    }
+}
+
+uint8_t pipeline_stage_add(pipeline_t *pipeline, arena_t *arena, uint32_t _interval_ms, uint32_t _window_ms,
+    websocket_output_t *output, fft_frame_output_t *frame_output, websocket_output_t *carriers_output)
+{
+    pipeline_stage_t *stage;
+    uint32_t i;
+
+    if(pipeline->stage_count >= PIPELINE_STAGES_MAX)
+    {
+        printf("%s: more than %d output stages\n", pipeline->config->name, PIPELINE_STAGES_MAX);
+        return 0;
+    }
+    if(_interval_ms == 0 || _window_ms < _interval_ms || _window_ms % _interval_ms != 0
+        || _window_ms / _interval_ms > PIPELINE_STAGE_BLOCKS_MAX)
+    {
+        printf("%s: stage window of %dms is not 1 to %d times its %dms interval\n", pipeline->config->name,
+            _window_ms, PIPELINE_STAGE_BLOCKS_MAX, _interval_ms);
+        return 0;
+    }
+    /* One carrier detector per pipeline */
+    for(i = 0; i < pipeline->stage_count && carriers_output != NULL; i++)
+    {
+        if(pipeline->stages[i].carriers_output != NULL)
+        {
+            printf("%s: carriers are already detected on another stage\n", pipeline->config->name);
+            return 0;
+        }
+    }
+
+    stage = &pipeline->stages[pipeline->stage_count];
+    memset(stage, 0, sizeof(pipeline_stage_t));
+    stage->interval_ms = _interval_ms;
+    stage->window_ms = _window_ms;
+    stage->output = output;
+    stage->frame_output = frame_output;
+    stage->carriers_output = carriers_output;
+    stage->floor_smooth = pow(FLOOR_TIME_SMOOTH, (double)_interval_ms / FLOOR_TIME_SMOOTH_MS);
+    stage->block_count = _window_ms / _interval_ms;
+    stage->lowest_smooth = FLOOR_TARGET;
+
+    stage->power = arena_alloc(arena, sizeof(double) * pipeline->fft_size, ARENA_CACHE_LINE);
+    stage->blocks = arena_alloc(arena, sizeof(double) * pipeline->fft_size * stage->block_count, ARENA_CACHE_LINE);
+    stage->frame = arena_alloc(arena, sizeof(uint16_t) * pipeline->output_length, ARENA_CACHE_LINE);
+    if(stage->power == NULL || stage->blocks == NULL || stage->frame == NULL)
+    {
+        return 0;
+    }
+    memset(stage->power, 0, sizeof(double) * pipeline->fft_size);
+
+    pipeline->stage_count++;
+    return 1;
+}
+
+/* Take the power summed by the FFT thread and add it to each stage */
+static void pipeline_drain(pipeline_t *pipeline)
+{
+    const uint32_t fft_size = pipeline->fft_size;
+    fft_buffer_t *fft_buffer = &pipeline->fft_buffer;
+    pipeline_stage_t *stage;
+    uint32_t i, s;
+
+    pthread_mutex_lock(&fft_buffer->mutex);
+
+    if(pipeline->config->fixed_point)
+    {
+        fft_fixed_power(&pipeline->fft_fixed, fft_buffer->power_lo, fft_buffer->power_hi, pipeline->drain_power);
+        memset(fft_buffer->power_lo, 0, sizeof(uint64_t) * fft_size);
+        memset(fft_buffer->power_hi, 0, sizeof(uint32_t) * fft_size);
+    }
+    else
+    {
+        memcpy(pipeline->drain_power, fft_buffer->power, sizeof(double) * fft_size);
+        memset(fft_buffer->power, 0, sizeof(double) * fft_size);
+    }
+    pipeline->drain_frames = fft_buffer->frames;
+    pipeline->drain_epoch = fft_buffer->epoch;
+    pipeline->drain_sample_index = fft_buffer->sample_index;
+    pipeline->drain_timestamp = fft_buffer->timestamp;
+    fft_buffer->frames = 0;
+
+    pthread_mutex_unlock(&fft_buffer->mutex);
+
+    /* Calibration measures one tuning, starting over on a change */
+    if(pipeline->calibration_power != NULL)
+    {
+        if(pipeline->drain_epoch != pipeline->calibration_epoch)
+        {
+            memset(pipeline->calibration_power, 0, sizeof(double) * fft_size);
+            pipeline->calibration_frames = 0;
+            pipeline->calibration_epoch = pipeline->drain_epoch;
+        }
+        for(i = 0; i < fft_size && pipeline->drain_frames > 0; i++)
+        {
+            pipeline->calibration_power[i] += pipeline->drain_power[i];
+        }
+        pipeline->calibration_frames += pipeline->drain_frames;
+    }
+
+    for(s = 0; s < pipeline->stage_count; s++)
+    {
+        stage = &pipeline->stages[s];
+
+        /* Power from a new tuning, the stage's window, floor and carriers start over */
+        if(pipeline->drain_epoch != stage->epoch)
+        {
+            memset(stage->power, 0, sizeof(double) * fft_size);
+            memset(stage->block_frames, 0, sizeof(stage->block_frames));
+            stage->frames = 0;
+            stage->epoch = pipeline->drain_epoch;
+            stage->retuned = true;
+        }
+        if(pipeline->drain_frames == 0)
+        {
+            continue;
+        }
+
+        for(i = 0; i < fft_size; i++)
+        {
+            stage->power[i] += pipeline->drain_power[i];
+        }
+        stage->frames += pipeline->drain_frames;
+        stage->sample_index = pipeline->drain_sample_index;
+        stage->timestamp = pipeline->drain_timestamp;
+    }
+}
+
+/* Close the stage's interval into its window, and return the window's power and frames */
+static const double *pipeline_stage_window(pipeline_t *pipeline, pipeline_stage_t *stage, uint32_t *frames)
+{
+    const uint32_t fft_size = pipeline->fft_size;
+    double *block = &stage->blocks[stage->block_next * fft_size];
+    uint32_t i, b;
+
+    memcpy(block, stage->power, sizeof(double) * fft_size);
+    stage->block_frames[stage->block_next] = stage->frames;
+    stage->block_next = (stage->block_next + 1) % stage->block_count;
+    memset(stage->power, 0, sizeof(double) * fft_size);
+    stage->frames = 0;
+
+    if(stage->block_count == 1)
+    {
+        *frames = stage->block_frames[0];
+        return block;
+    }
+
+    *frames = 0;
+    memset(pipeline->window_power, 0, sizeof(double) * fft_size);
+    for(b = 0; b < stage->block_count; b++)
+    {
+        /* Intervals with no frames, or from before a retune, hold nothing */
+        if(stage->block_frames[b] == 0)
+        {
+            continue;
+        }
+        block = &stage->blocks[b * fft_size];
+        for(i = 0; i < fft_size; i++)
+        {
+            pipeline->window_power[i] += block[i];
+        }
+        *frames += stage->block_frames[b];
+    }
+    return pipeline->window_power;
+}
+
+/* Scale the stage's window, estimate the noise floor and pack the frame. Returns false if the window is empty. */
+static bool pipeline_stage_snapshot(pipeline_t *pipeline, pipeline_stage_t *stage)
+{
+	int32_t i, j;
+    int32_t floor_start;
+    double floor_end;
+    uint32_t lowest, frames;
+    int32_t offset;
+    int64_t level;
+    double scale;
+    const int32_t fft_size = pipeline->fft_size;
+    uint32_t *fft_output_data = pipeline->output_data;
+    const double *power;
+
+    power = pipeline_stage_window(pipeline, stage, &frames);
+    if(frames == 0)
+    {
+        return false;
+    }
+    scale = 1.0 / frames;
+
+    /* Noise floor is taken over the same span of output bins as the old minimum search */
+    floor_start = (fft_size*0.05);
+    floor_end = (ceil(fft_size*0.95) - (int32_t)(fft_size*0.05)) - (fft_size*0.1);
+
+    /* Create data points, adding each to the noise floor histogram as we go */
+    floor_estimator_reset(&pipeline->floor_estimator);
+
+    for(i = 0, j = (fft_size*0.05); i < (int32_t)pipeline->output_length; i++, j++)
+    {
+        /* Mean power in dBFS, to output units with the bin's offset and passband compensation */
+        level = (int64_t)(((FFT_SCALE * 10.0) * log10((power[j] * scale) + 1.0e-20)) + pipeline->line_offset[j]);
+        fft_output_data[i] = level > 0 ? level : 0;
+
+        if(i >= floor_start && i < floor_end)
+        {
+            floor_estimator_add(&pipeline->floor_estimator, fft_output_data[i]);
+        }
+    }
+
+    stage->blocks_lost = __atomic_load_n(&pipeline->fft_blocks_skipped, __ATOMIC_RELAXED)
+        + __atomic_load_n(&pipeline->fft_blocks_shed, __ATOMIC_RELAXED);
+
+    /* Output bin 0 is FFT bin (fft_size*0.05), FFT bin fft_size/2 being the tuned frequency */
+    stage->bin_hz = (double)__atomic_load_n(&pipeline->sample_rate, __ATOMIC_RELAXED) / fft_size;
+    stage->bin0_hz = (double)__atomic_load_n(&pipeline->freq_hz, __ATOMIC_RELAXED)
+        + (((int32_t)(fft_size*0.05) - (int32_t)(fft_size/2)) * stage->bin_hz);
+
+   	/* Calculate noise floor, starting from this frame's at startup or a retune */
+    lowest = floor_estimator_percentile(&pipeline->floor_estimator, FLOOR_PERCENTILE);
+    if(!stage->published || stage->retuned)
+    {
+        stage->lowest_smooth = lowest;
+        if(stage->retuned && stage->carriers_output != NULL)
+        {
+            carrier_detector_reset(&pipeline->carrier_detector);
+        }
+    }
+    stage->lowest_smooth = (lowest * (1.f - stage->floor_smooth)) + (stage->lowest_smooth * stage->floor_smooth);
+
+    /* Compensate for noise floor */
+    offset = (FLOOR_TARGET) - stage->lowest_smooth;
+
+    /* Noise floor of this frame in output units */
+    if((int64_t)lowest + offset > FLOOR_OFFSET)
+    {
+        stage->floor = ((int64_t)lowest + offset - (int64_t)FLOOR_OFFSET) / FFT_PRESCALE;
+    }
+    else
+    {
+        stage->floor = 0;
+    }
+
+    for(j = 0; j < (int32_t)pipeline->output_length; j++)
+    {
+        /* Add noise-floor AGC offset (can be negative) */
+        fft_output_data[j] += offset;
+
+        /* Subtract viewport floor offset and set to zero if underflow */
+        if(__builtin_usub_overflow(fft_output_data[j], (uint32_t)FLOOR_OFFSET, &fft_output_data[j]))
+        {
+            fft_output_data[j] = 0;
+        }
+
+        /* Divide output by FFT_PRESCALE to scale for uint16_t */
+        fft_output_data[j] /= FFT_PRESCALE;
+
+        /* Catch data overflow */
+        if(fft_output_data[j] > 0xFFFF)
+        {
+            fft_output_data[j] = 0xFFFF;
+        }
+
+        stage->frame[j] = fft_output_data[j];
+    }
+
+    stage->published = true;
+    return true;
+}
+
+uint16_t pipeline_floor_target(void)
+{
+    return (FLOOR_TARGET - FLOOR_OFFSET) / FFT_PRESCALE;
+}
+
+float pipeline_line_compensation_db(const pipeline_t *pipeline, uint32_t _output_index)
+{
+    return (pipeline->line_offset[_output_index + (int32_t)(pipeline->fft_size*0.05)] / FFT_SCALE) - FFT_OFFSET;
+}
+
+bool pipeline_line_profile_apply(pipeline_t *pipeline)
+{
+    const char *name = pipeline->config->name;
+    uint32_t i, point_count;
+
+    if(!line_profile_load(pipeline->serial, pipeline->sample_rate, pipeline->line_profile_points, &point_count))
+    {
+        for(i = 0; i < pipeline->fft_size; i++)
+        {
+            pipeline->line_offset[i] = FFT_SCALE * FFT_OFFSET;
+        }
+        fprintf(stdout, "%s: no line profile for %016"PRIX64" at %.01fMSPS, passband uncompensated (see -c)\n",
+            name, pipeline->serial, (float)pipeline->sample_rate/1000000);
+        return false;
+    }
+
+    pipeline_line_profile_set(pipeline, pipeline->line_profile_points, point_count);
+    fprintf(stdout, "%s: line profile for %016"PRIX64" at %.01fMSPS, %d points to %d bins\n",
+        name, pipeline->serial, (float)pipeline->sample_rate/1000000, point_count, pipeline->fft_size);
+    return true;
+}
+
+void pipeline_line_profile_set(pipeline_t *pipeline, const float *points, uint32_t _point_count)
+{
+    line_profile_interpolate(points, _point_count, pipeline->line_offset, pipeline->fft_size,
+        FFT_SCALE, FFT_SCALE * FFT_OFFSET);
+}
+
+uint8_t pipeline_calibrate_init(pipeline_t *pipeline, arena_t *arena)
+{
+    if(pipeline->source != NULL)
+    {
+        printf("%s: line profiles are for AirSpy pipelines\n", pipeline->config->name);
+        return 0;
+    }
+
+    if((pipeline->calibration_power = arena_alloc(arena, sizeof(double) * pipeline->fft_size, ARENA_CACHE_LINE)) == NULL
+        || (pipeline->calibration_points = arena_alloc(arena, sizeof(float) * pipeline->fft_size, ARENA_CACHE_LINE)) == NULL
+        || (pipeline->calibration_scratch = arena_alloc(arena, sizeof(float) * 2 * pipeline->fft_size, ARENA_CACHE_LINE)) == NULL)
+    {
+        return 0;
+    }
+    pipeline->calibration_frames = 0;
+    pipeline->calibration_epoch = pipeline->epoch;
+
+    return 1;
+}
+
+uint8_t pipeline_calibrate_save(pipeline_t *pipeline)
+{
+    const char *name = pipeline->config->name;
+    float lowest, highest;
+    uint32_t i;
+
+    if(pipeline->calibration_frames == 0)
+    {
+        printf("%s: no FFTs to measure the line profile from\n", name);
+        return 0;
+    }
+
+    /* Corrected to the median of the output bins, as the floor AGC will level them */
+    line_profile_measure(pipeline->calibration_power, pipeline->calibration_frames, pipeline->fft_size,
+        (uint32_t)(pipeline->fft_size*0.05), pipeline->output_length,
+        pipeline->calibration_points, pipeline->calibration_scratch);
+
+    lowest = highest = pipeline->calibration_points[(uint32_t)(pipeline->fft_size*0.05)];
+    for(i = (uint32_t)(pipeline->fft_size*0.05); i < (uint32_t)(pipeline->fft_size*0.05) + pipeline->output_length; i++)
+    {
+        lowest = fminf(lowest, pipeline->calibration_points[i]);
+        highest = fmaxf(highest, pipeline->calibration_points[i]);
+    }
+
+    if(!line_profile_save(pipeline->serial, pipeline->sample_rate, pipeline->calibration_points, pipeline->fft_size))
+    {
+        return 0;
+    }
+    fprintf(stdout, "%s: line profile for %016"PRIX64" at %.01fMSPS saved from %"PRIu64" FFTs, %+.2f to %+.2fdB across the output\n",
+        name, pipeline->serial, (float)pipeline->sample_rate/1000000, pipeline->calibration_frames, lowest, highest);
+
+    return 1;
+}
+
+static void pipeline_fft_to_buffer(pipeline_t *pipeline, const pipeline_stage_t *stage, websocket_output_t *_websocket_output)
+{
+    /* Lock websocket output buffer for writing */
+    pthread_mutex_lock(&_websocket_output->mutex);
+
+    memcpy(&_websocket_output->buffer[LWS_PRE], stage->frame, 2*pipeline->output_length);
+
+    _websocket_output->length = 2*pipeline->output_length;
+    _websocket_output->sequence_id++;
+
+	pthread_mutex_unlock(&_websocket_output->mutex);
+}
+
+typedef struct {
+    uint8_t version;
+    uint8_t header_length;
+    uint16_t flags;
+    uint32_t sequence;
+    uint64_t sample_index;
+    uint64_t capture_ns;
+    uint64_t publish_ns;
+    double bin0_hz;
+    double bin_hz;
+    uint32_t epoch;
+    uint32_t bin_count;
+} fft_frame_header_t;
+
+_Static_assert(sizeof(fft_frame_header_t) == FFT_FRAME_HEADER_LENGTH, "FFT frame header is not packed");
+
+static void pipeline_fft_frame_to_buffer(pipeline_t *pipeline, const pipeline_stage_t *stage, fft_frame_output_t *_frame_output)
+{
+    websocket_output_t *websocket_output = &_frame_output->output;
+    fft_frame_header_t header;
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    header.version = FFT_FRAME_VERSION;
+    header.header_length = FFT_FRAME_HEADER_LENGTH;
+    header.flags = (stage->epoch != _frame_output->epoch || stage->blocks_lost != _frame_output->blocks_lost)
+        ? FFT_FRAME_FLAG_DISCONTINUITY : 0;
+    header.sample_index = stage->sample_index;
+    header.capture_ns = ((uint64_t)stage->timestamp.tv_sec * 1000000000) + stage->timestamp.tv_nsec;
+    header.publish_ns = ((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+    header.bin0_hz = stage->bin0_hz;
+    header.bin_hz = stage->bin_hz;
+    header.epoch = stage->epoch;
+    header.bin_count = pipeline->output_length;
+
+    _frame_output->epoch = stage->epoch;
+    _frame_output->blocks_lost = stage->blocks_lost;
+
+    /* Lock websocket output buffer for writing */
+    pthread_mutex_lock(&websocket_output->mutex);
+
+    header.sequence = websocket_output->sequence_id + 1;
+    memcpy(&websocket_output->buffer[LWS_PRE], &header, FFT_FRAME_HEADER_LENGTH);
+    memcpy(&websocket_output->buffer[LWS_PRE + FFT_FRAME_HEADER_LENGTH], stage->frame, 2*pipeline->output_length);
+
+    websocket_output->length = FFT_FRAME_HEADER_LENGTH + 2*pipeline->output_length;
+    websocket_output->sequence_id++;
+
+    pthread_mutex_unlock(&websocket_output->mutex);
+}
+
+void pipeline_carriers_to_buffer(pipeline_t *pipeline, const pipeline_stage_t *stage, websocket_output_t *_websocket_output)
+{
+    int32_t length;
+
+    if(!carrier_detector_process(&pipeline->carrier_detector, stage->frame, pipeline->output_length, stage->floor,
+        stage->bin0_hz, stage->bin_hz))
+    {
+        return;
+    }
+
+    /* Lock websocket output buffer for writing */
+    pthread_mutex_lock(&_websocket_output->mutex);
+
+    length = carrier_detector_json(&pipeline->carrier_detector,
+        (char *)&_websocket_output->buffer[LWS_PRE], _websocket_output->size,
+        _websocket_output->sequence_id + 1);
+    if(length > 0)
+    {
+        _websocket_output->length = length;
+        _websocket_output->sequence_id++;
+    }
+
+    pthread_mutex_unlock(&_websocket_output->mutex);
+}
+
+/* Capture the IQ around a carrier newly reported, the list being relearnt for a while after a retune */
+static void pipeline_carriers_capture(pipeline_t *pipeline, const pipeline_stage_t *stage)
+{
+    carrier_detector_t *cd = &pipeline->carrier_detector;
+    char reason[CAPTURE_REASON_LENGTH];
+
+    if(stage->retuned)
+    {
+        pipeline->capture_carrier_holdoff = CAPTURE_CARRIER_HOLDOFF;
+    }
+    if(pipeline->capture_carrier_holdoff > 0)
+    {
+        pipeline->capture_carrier_holdoff--;
+    }
+    else if(cd->appeared != pipeline->capture_carriers_appeared && pipeline->config->capture_on_carrier)
+    {
+        snprintf(reason, sizeof(reason), "carrier at %.03fMHz", cd->appeared_freq_hz / 1000000);
+        pipeline_capture_trigger(pipeline, reason);
+    }
+    pipeline->capture_carriers_appeared = cd->appeared;
+}
+
+uint32_t pipeline_stages_run(pipeline_t *pipeline, uint32_t _ms)
+{
+    pipeline_stage_t *stage;
+    uint32_t s, due = 0, published = 0;
+
+    for(s = 0; s < pipeline->stage_count; s++)
+    {
+        stage = &pipeline->stages[s];
+        if(!stage->scheduled)
+        {
+            stage->scheduled = true;
+            stage->due_ms = _ms;
+        }
+        if((int32_t)(_ms - stage->due_ms) >= 0)
+        {
+            due |= 1U << s;
+        }
+    }
+    if(due == 0)
+    {
+        return 0;
+    }
+
+    pipeline_drain(pipeline);
+
+    for(s = 0; s < pipeline->stage_count; s++)
+    {
+        stage = &pipeline->stages[s];
+        if(!(due & (1U << s)))
+        {
+            continue;
+        }
+
+        /* Keep to the interval, unless so far behind that frames would be sent back to back */
+        stage->due_ms += stage->interval_ms;
+        if((int32_t)(_ms - stage->due_ms) >= 0)
+        {
+            stage->due_ms = _ms + stage->interval_ms;
+        }
+
+        if(!pipeline_stage_snapshot(pipeline, stage))
+        {
+            continue;
+        }
+
+        if(stage->output != NULL)
+        {
+            pipeline_fft_to_buffer(pipeline, stage, stage->output);
+        }
+        if(stage->frame_output != NULL)
+        {
+            pipeline_fft_frame_to_buffer(pipeline, stage, stage->frame_output);
+        }
+        /* Clients are only triggered if the carrier list has changed */
+        if(stage->carriers_output != NULL)
+        {
+            pipeline_carriers_to_buffer(pipeline, stage, stage->carriers_output);
+            pipeline_carriers_capture(pipeline, stage);
+        }
+        stage->retuned = false;
+        published |= 1U << s;
+    }
+
+    return published;
+}
@@ -0,0 +1,416 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "main.h"
+#include <stdbool.h>
+
+#include "arena.h"
+#include "iq_ring.h"
+#include "floor_estimator.h"
+#include "carrier_detect.h"
+#include "filterbank.h"
+#include "load_shed.h"
+#include "ddc.h"
+#include "iq_stream.h"
+#include "spectrum_shm.h"
+#include "fft_fixed.h"
+#include "capture.h"
+#include "line_profile.h"
+
+/* A pipeline is one SDR source and everything fed from it: IQ ring, FFT thread, output stages and outputs.
+ * Several pipelines can run in one process, each serving its protocols under its own name.
+ *
+ * A zoom pipeline has no AirSpy of its own: a DDC thread down-converts and decimates a sub-band of
+ *  another pipeline's IQ into its ring, and it is served like any other pipeline from there. */
+
+typedef struct {
+    /* Protocol namespace, eg. "wb" serves "wb.fft", "wb.fft_fast", .. */
+    const char *name;
+    /* Also serve the original un-prefixed protocols ("fft", "fft_m0dtslivetune", ..), one pipeline only */
+    bool legacy_protocols;
+
+    /* Zoom: name of the pipeline to take IQ from (listed earlier), NULL for an AirSpy.
+     *  freq_hz is then the centre of the sub-band, and the sample rate the source's / decimation. */
+    const char *source;
+    uint32_t decimation;
+
+    /* AirSpy serial number, 0 opens the first available device */
+    uint64_t serial;
+    uint32_t freq_hz;
+    uint32_t sample_rate;
+    uint32_t biast;
+    uint32_t linearity_gain;    // MAX=21
+    uint32_t sensitivity_gain;  // MAX=21
+
+    uint32_t fft_size;
+    /* Serve decimated IQ to clients as "<name>.iq", see iq_stream.h */
+    bool iq_stream;
+    /* Take int16 IQ and run the FFT thread in fixed point, see fft_fixed.h. AirSpy pipelines without an IQ stream only. */
+    bool fixed_point;
+    /* Plan the FFT with FFTW_ESTIMATE, ignoring the wisdom file, so the plan is reproducible (self-test) */
+    bool fft_estimate;
+    /* Publish every FFT block to local readers in "/airspy_fft_<name>", see spectrum_shm_layout.h */
+    bool shm_spectrum;
+    /* Hold capture_seconds of IQ, and on a trigger record it and capture_post_seconds more, see capture.h.
+     *  0 disables capture. The IQ is held in the arena, 80MB a second at 10MSPS float. */
+    uint32_t capture_seconds;
+    uint32_t capture_post_seconds;
+    /* Also trigger a capture on each carrier newly reported, once the carrier list has settled */
+    bool capture_on_carrier;
+
+    /* Spectral estimator, and prototype filter length in FFTs for FILTERBANK_WOLA */
+    filterbank_type_t estimator;
+    uint32_t estimator_taps;
+    /* Overlap of consecutive FFT frames as a percentage of the FFT size: 0, 50 or 75.
+     *  Reduced automatically, and then frames skipped, if the FFT thread can't keep up. */
+    uint32_t overlap;
+
+    /* Thread settings, see realtime_thread_apply(). The AirSpy settings apply to the DDC thread of a zoom pipeline. */
+    const char *cpu_affinity_airspy;
+    const char *cpu_affinity_fft;
+    int32_t fifo_priority_airspy;
+    int32_t fifo_priority_fft;
+} pipeline_config_t;
+
+#define WEBSOCKET_OUTPUT_LENGTH	4096
+typedef struct {
+	uint8_t *buffer;
+	/* Bytes available after LWS_PRE */
+	uint32_t size;
+	uint32_t length;
+	uint32_t sequence_id;
+	pthread_mutex_t mutex CACHE_LINE_ALIGNED;
+} websocket_output_t;
+
+/* Framed FFT outputs ("<name>.fft_v2", "<name>.fft_fast_v2")
+ *
+ * The legacy protocols carry bare frames of uint16 bins. The framed ones put a little-endian header
+ *  in front of the same bins:
+ *
+ *   0  uint8   version, FFT_FRAME_VERSION
+ *   1  uint8   header length, the bins start here
+ *   2  uint16  flags, FFT_FRAME_FLAG_DISCONTINUITY if IQ was lost, or the AirSpy retuned, since the
+ *               output's previous frame
+ *   4  uint32  sequence, counting this output's frames, a gap is a frame the client missed
+ *   8  uint64  sample index of the newest IQ block averaged in, counted in the pipeline's IQ since start
+ *  16  uint64  capture time of that sample, ns since the Unix epoch (CLOCK_REALTIME)
+ *  24  uint64  publish time of the frame, ns since the Unix epoch (CLOCK_REALTIME)
+ *  32  double  frequency of bin 0 (Hz)
+ *  40  double  bin step (Hz)
+ *  48  uint32  tuning epoch, see pipeline_tune_request()
+ *  52  uint32  bin count
+ *  56  uint16[count] bins, as the legacy frame
+ *
+ * Publish minus capture time is the latency up to the websocket write, a relay passes the frames on
+ *  untouched. Clients should skip to the header length, so fields can be added at the end.
+ */
+#define FFT_FRAME_VERSION               2
+#define FFT_FRAME_HEADER_LENGTH         56
+#define FFT_FRAME_FLAG_DISCONTINUITY    0x0001
+
+/* A framed output, and what its last frame covered */
+typedef struct {
+	websocket_output_t output;
+	uint32_t epoch;
+	uint64_t blocks_lost;
+} fft_frame_output_t;
+
+/* Power the FFT thread has summed since the main thread last drained it, see pipeline_stages_run() */
+typedef struct {
+	/* Linear power relative to full scale, fft_size bins */
+	double *power;
+	/* Instead of power for a fixed-point pipeline, see fft_fixed_accumulate() */
+	uint64_t *power_lo;
+	uint32_t *power_hi;
+	uint32_t frames;
+	/* Tuning epoch of the power, anything older is dropped when a block of a new one is added */
+	uint32_t epoch;
+	/* Newest IQ block added */
+	uint64_t sample_index;
+	struct timespec timestamp;
+	pthread_mutex_t mutex CACHE_LINE_ALIGNED;
+} fft_buffer_t;
+
+/* One quality level of the FFT thread */
+typedef struct {
+    /* Samples between frames */
+    uint32_t hop;
+    uint32_t frames;
+} pipeline_fft_level_t;
+
+/* Output stages
+ *
+ * Each stage publishes a frame every interval_ms, the mean linear power over the last window_ms (a
+ *  multiple of the interval), with its own noise floor AGC. The FFT thread sums power into the
+ *  fft_buffer once per block; the main thread drains that into every stage, and a stage only sums
+ *  and packs its window when due. A stage's cost is its own accumulation and packing, whatever else
+ *  is running.
+ */
+#define PIPELINE_STAGES_MAX         4
+/* Intervals held for a stage's window */
+#define PIPELINE_STAGE_BLOCKS_MAX   16
+
+typedef struct {
+    uint32_t interval_ms;
+    uint32_t window_ms;
+    /* Published to, carriers_output may be NULL (the carrier detector runs on one stage only) */
+    websocket_output_t *output;
+    fft_frame_output_t *frame_output;
+    websocket_output_t *carriers_output;
+    /* Floor AGC smoothing per frame, FLOOR_TIME_SMOOTH at this interval */
+    float floor_smooth;
+
+    /* Power drained since the last frame, and its frames */
+    double *power;
+    uint32_t frames;
+    /* The last block_count intervals of power, oldest overwritten next */
+    double *blocks;
+    uint32_t block_frames[PIPELINE_STAGE_BLOCKS_MAX];
+    uint32_t block_count;
+    uint32_t block_next;
+
+    /* Scheduling, in the ms of pipeline_stages_run() */
+    bool scheduled;
+    uint32_t due_ms;
+    /* Tuning epoch of the power, and whether it changed since the last frame */
+    uint32_t epoch;
+    bool retuned;
+    bool published;
+
+    /** Last frame **/
+    uint16_t *frame;
+    uint16_t floor;
+    uint32_t lowest_smooth;
+    uint64_t sample_index;
+    struct timespec timestamp;
+    uint64_t blocks_lost;
+    double bin0_hz;
+    double bin_hz;
+} pipeline_stage_t;
+
+/* A live change of tuning, see pipeline_tune_request(). Only the fields flagged are changed. */
+typedef struct {
+    bool set_freq;
+    uint32_t freq_hz;
+    bool set_sample_rate;
+    uint32_t sample_rate;
+    /* Linearity or sensitivity gain, as built (see pipeline.c) */
+    bool set_gain;
+    uint32_t gain;
+    bool set_biast;
+    uint32_t biast;
+    /* Start a capture, once any change with it has been applied */
+    bool capture;
+} pipeline_tune_t;
+
+#define PIPELINE_SAMPLE_RATES_MAX   8
+
+typedef struct pipeline_t pipeline_t;
+
+struct pipeline_t {
+    const pipeline_config_t *config;
+    uint32_t fft_size;
+    /* Outputs are fed from an upstream instance (relay.h), nothing else is set up */
+    bool relayed;
+
+    /** AirSpy **/
+    struct airspy_device* device;
+    /* Serial number of the device opened, its line profile is looked up by it */
+    uint64_t serial;
+    uint32_t freq_hz;
+    uint32_t sample_rate;
+    uint32_t gain;
+    uint32_t biast;
+    /* Sample rates the device supports */
+    uint32_t sample_rates[PIPELINE_SAMPLE_RATES_MAX];
+    uint32_t sample_rate_count;
+    /* Zoom pipelines taking IQ from this one */
+    uint32_t zoom_count;
+
+    /** Live tuning **/
+    /* Changes waiting for the main thread, and tickets requested / applied */
+    pthread_mutex_t tune_mutex;
+    pipeline_tune_t tune_pending;
+    uint32_t tune_requested;
+    uint32_t tune_completed;
+    /* Result of the last change applied, NULL on success */
+    const char *tune_error;
+    /* Bumped on each applied change and carried by each IQ block from then on */
+    uint32_t epoch;
+    /* Blocks the AirSpy callback still drops while a change settles */
+    uint32_t tune_settle_blocks;
+
+    /** Capture **/
+    capture_t capture;
+    /* Carriers newly reported, as last seen, and carrier frames left before they trigger a capture */
+    uint32_t capture_carriers_appeared;
+    uint32_t capture_carrier_holdoff;
+
+    /** Zoom **/
+    pipeline_t *source;
+    pthread_t ddc_thread;
+    ddc_t ddc;
+    /* DDC output waiting to fill a ring block */
+    float *ddc_output;
+    uint32_t ddc_output_fill;
+    uint64_t ddc_blocks_skipped;
+    uint64_t ddc_cpu_ns;
+    uint64_t stats_ddc_cpu_ns;
+
+    /** IQ from the AirSpy callback or DDC **/
+    iq_ring_t iq_ring;
+    iq_streams_t iq_streams;
+
+    /** FFT Thread **/
+    pthread_t fft_thread;
+    fftw_complex *fft_in;
+    fftw_complex *fft_out;
+    fftw_plan fft_plan;
+    filterbank_t filterbank;
+    /* In place of FFTW for a fixed-point pipeline */
+    fft_fixed_t fft_fixed;
+    /* Samples of each ring block taken by the FFT thread */
+    uint32_t fft_block_samples;
+    /* Quality levels, from the configured overlap (level 0) down, see load_shed.h */
+    pipeline_fft_level_t fft_levels[LOAD_SHED_LEVELS_MAX];
+    load_shed_t load_shed;
+    /* Current quality level, written by the FFT thread */
+    uint32_t fft_level;
+    /* Power of the block being taken, added to the fft_buffer at its end. The fixed-point path sums
+     *  into power_lo / power_hi and converts into power only for the shared memory ring. */
+    double *fft_block_power;
+    uint64_t *fft_block_power_lo;
+    uint32_t *fft_block_power_hi;
+    /* The block in dBFS, for the shared memory ring */
+    float *fft_block_db;
+    fft_buffer_t fft_buffer;
+    /* Blocks the FFT thread has lost to ring overruns, and dropped itself to catch up */
+    uint64_t fft_blocks_skipped;
+    uint64_t fft_blocks_shed;
+    /* FFT thread CPU time and FFTs run, read by pipeline_print_stats() */
+    uint64_t fft_cpu_ns;
+    uint64_t fft_lines;
+    uint64_t stats_cpu_ns;
+    uint64_t stats_lines;
+    /* Shared memory ring, written by the FFT thread */
+    spectrum_shm_t spectrum_shm;
+    /* Epoch of the blocks the FFT thread is taking */
+    uint32_t fft_epoch;
+    /* Block the FFT thread is taking */
+    uint64_t fft_sample_index;
+    struct timespec fft_timestamp;
+
+    /** Output stages, run by the main thread **/
+    pipeline_stage_t stages[PIPELINE_STAGES_MAX];
+    uint32_t stage_count;
+    /* Power drained from the fft_buffer, and what it covers */
+    double *drain_power;
+    uint32_t drain_frames;
+    uint32_t drain_epoch;
+    uint64_t drain_sample_index;
+    struct timespec drain_timestamp;
+    /* Scratch of the stage being published: its window's power, and unpacked levels */
+    double *window_power;
+    uint32_t *output_data;
+    /* Added to FFT_SCALE * dB for each bin's level in output units: FFT_OFFSET and the line profile's
+     *  correction at the current sample rate, see pipeline_line_profile_apply() */
+    double *line_offset;
+    /* Profile as loaded (AirSpy pipelines) */
+    float *line_profile_points;
+    /* Output bins, the central 90% of the FFT */
+    uint32_t output_length;
+    floor_estimator_t floor_estimator CACHE_LINE_ALIGNED;
+    carrier_detector_t carrier_detector;
+
+    /** Line profile calibration, see pipeline_calibrate_init() **/
+    /* Power drained since calibration started or the tuning last changed, and its frames */
+    double *calibration_power;
+    uint64_t calibration_frames;
+    uint32_t calibration_epoch;
+    float *calibration_points;
+    float *calibration_scratch;
+
+    /** Outputs **/
+    websocket_output_t output_fft;
+    websocket_output_t output_fft_fast;
+    websocket_output_t output_carriers;
+    fft_frame_output_t output_fft_v2;
+    fft_frame_output_t output_fft_fast_v2;
+};
+
+/* Allocate buffers from the arena and plan the FFT. source is the initialised pipeline named by
+ *  config->source for a zoom pipeline, otherwise NULL. Returns 1 on success. */
+uint8_t pipeline_init(pipeline_t *pipeline, const pipeline_config_t *config, pipeline_t *source, arena_t *arena);
+
+/* Allocate only the outputs, for a relay to fill from upstream. Returns 1 on success. */
+uint8_t pipeline_init_relay(pipeline_t *pipeline, const pipeline_config_t *config, arena_t *arena);
+
+/* Open and start the AirSpy (or for a zoom pipeline, the DDC thread), then the FFT and IQ threads.
+ *  airspy_init() must have been called. Returns 1 on success. */
+uint8_t pipeline_start(pipeline_t *pipeline);
+
+void pipeline_close(pipeline_t *pipeline);
+
+/* Queue a change of tuning for the main thread to apply with pipeline_tune_apply(), AirSpy pipelines only.
+ *  Returns the ticket of the change, or 0 with *error set if it is invalid. */
+uint32_t pipeline_tune_request(pipeline_t *pipeline, const pipeline_tune_t *tune, const char **error);
+
+/* Main thread: apply any queued change to the running AirSpy. Samples are dropped for
+ *  PIPELINE_TUNE_SETTLE_MS, then carry the next epoch, at which the FFT averaging, noise floor
+ *  AGC, carrier list and IQ streams restart. A capture is started after the change, or on its
+ *  own without one. Returns true if a request was applied. */
+bool pipeline_tune_apply(pipeline_t *pipeline);
+
+/* Main thread: start a capture if the pipeline has one configured. Returns false if it hasn't, or one is running. */
+bool pipeline_capture_trigger(pipeline_t *pipeline, const char *_reason);
+
+/* Ticket of the last change applied, with its error (NULL on success) */
+uint32_t pipeline_tune_completed(pipeline_t *pipeline, const char **error);
+
+/* Print the FFT thread's CPU cost per line and quality level since the last call, _interval_ms apart */
+void pipeline_print_stats(pipeline_t *pipeline, uint32_t _interval_ms);
+
+/* FFT quality as a percentage of the lines per block at the configured overlap */
+uint32_t pipeline_fft_quality(pipeline_t *pipeline);
+
+/* FFT thread work for one block of IQ (interleaved, float or int16 as the ring) at a quality level:
+ *  level->frames FFTs, each windowed, transformed and its power summed, then added to the fft_buffer */
+void pipeline_fft_block(pipeline_t *pipeline, const void *samples, const pipeline_fft_level_t *level);
+
+/* Add the power of the last FFT to the block being taken */
+void pipeline_fft_accumulate(pipeline_t *pipeline);
+
+/* Add an output stage publishing to the outputs given every _interval_ms, averaged over _window_ms.
+ *  Returns 1 on success. */
+uint8_t pipeline_stage_add(pipeline_t *pipeline, arena_t *arena, uint32_t _interval_ms, uint32_t _window_ms,
+    websocket_output_t *output, fft_frame_output_t *frame_output, websocket_output_t *carriers_output);
+
+/* Main thread: drain the fft_buffer into the stages when any is due at _ms, and publish those due.
+ *  Returns a mask of the stages published. */
+uint32_t pipeline_stages_run(pipeline_t *pipeline, uint32_t _ms);
+
+/* Level the noise floor AGC settles the floor of the packed frame at */
+uint16_t pipeline_floor_target(void);
+
+/* Passband compensation added to output bin _output_index of the packed frame, in dB */
+float pipeline_line_compensation_db(const pipeline_t *pipeline, uint32_t _output_index);
+
+/* Main thread: load the device's line profile for the current sample rate, if it has one, and apply it
+ *  from the next frame. Done on start and each change of sample rate. Returns true if one was found. */
+bool pipeline_line_profile_apply(pipeline_t *pipeline);
+
+/* Apply _point_count profile points (see line_profile.h) from the next frame, whatever the device */
+void pipeline_line_profile_set(pipeline_t *pipeline, const float *points, uint32_t _point_count);
+
+/* Allocate for measuring a line profile, and start summing the power drained from now on (see
+ *  line_profile.h). AirSpy pipelines only, before the arena is sealed. Returns 1 on success. */
+uint8_t pipeline_calibrate_init(pipeline_t *pipeline, arena_t *arena);
+
+/* Main thread: save the profile measured since pipeline_calibrate_init() or the last retune as the
+ *  device's at the current sample rate. Returns 1 on success. */
+uint8_t pipeline_calibrate_save(pipeline_t *pipeline);
+
+/* Run the carrier detector over a stage's last frame, publishing the carrier list if it changed */
+void pipeline_carriers_to_buffer(pipeline_t *pipeline, const pipeline_stage_t *stage, websocket_output_t *_websocket_output);
+
+#endif /* PIPELINE_H */
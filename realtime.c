@@ -0,0 +1,182 @@
+#include "realtime.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+static cpu_set_t initial_cpu_set;
+
+void realtime_init(void)
+{
+    CPU_ZERO(&initial_cpu_set);
+    if(sched_getaffinity(0, sizeof(cpu_set_t), &initial_cpu_set) != 0)
+    {
+        printf("sched_getaffinity() failed: %s\n", strerror(errno));
+    }
+}
+
+/* Parse a CPU list such as "0-1,3" */
+static uint8_t cpu_list_parse(const char *cpu_list, cpu_set_t *cpu_set)
+{
+    const char *p = cpu_list;
+    char *end;
+    long first, last, cpu;
+
+    CPU_ZERO(cpu_set);
+    while(*p != '\0')
+    {
+        first = strtol(p, &end, 10);
+        if(end == p || first < 0)
+        {
+            return 0;
+        }
+        last = first;
+        p = end;
+        if(*p == '-')
+        {
+            p++;
+            last = strtol(p, &end, 10);
+            if(end == p || last < first)
+            {
+                return 0;
+            }
+            p = end;
+        }
+        if(last >= CPU_SETSIZE)
+        {
+            return 0;
+        }
+        for(cpu = first; cpu <= last; cpu++)
+        {
+            CPU_SET(cpu, cpu_set);
+        }
+        if(*p == ',')
+        {
+            p++;
+        }
+        else if(*p != '\0')
+        {
+            return 0;
+        }
+    }
+    return CPU_COUNT(cpu_set) > 0;
+}
+
+static void cpu_list_format(const cpu_set_t *cpu_set, char *buffer, size_t length)
+{
+    int32_t cpu, first = -1;
+    size_t n = 0;
+
+    buffer[0] = '\0';
+    for(cpu = 0; cpu <= CPU_SETSIZE && n < length; cpu++)
+    {
+        if(cpu < CPU_SETSIZE && CPU_ISSET(cpu, cpu_set))
+        {
+            if(first < 0)
+            {
+                first = cpu;
+            }
+            continue;
+        }
+        if(first >= 0)
+        {
+            if(first == cpu - 1)
+            {
+                n += snprintf(&buffer[n], length - n, "%s%d", n ? "," : "", first);
+            }
+            else
+            {
+                n += snprintf(&buffer[n], length - n, "%s%d-%d", n ? "," : "", first, cpu - 1);
+            }
+            first = -1;
+        }
+    }
+}
+
+uint8_t realtime_thread_apply(pthread_t thread, const char *name, const char *cpu_list, int32_t _fifo_priority)
+{
+    cpu_set_t cpu_set;
+    struct sched_param param;
+    char cpu_string[128];
+    int policy, result;
+    uint8_t ok = 1;
+
+    /* CPU affinity */
+    if(cpu_list[0] == '\0')
+    {
+        cpu_set = initial_cpu_set;
+    }
+    else if(!cpu_list_parse(cpu_list, &cpu_set))
+    {
+        printf("Thread '%s': invalid CPU list \"%s\"\n", name, cpu_list);
+        cpu_set = initial_cpu_set;
+        ok = 0;
+    }
+    result = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpu_set);
+    if(result != 0)
+    {
+        printf("Thread '%s': pthread_setaffinity_np() failed: %s\n", name, strerror(result));
+        ok = 0;
+    }
+
+    /* Scheduler */
+    memset(&param, 0, sizeof(param));
+    if(_fifo_priority > 0)
+    {
+        param.sched_priority = _fifo_priority;
+        result = pthread_setschedparam(thread, SCHED_FIFO, &param);
+    }
+    else
+    {
+        result = pthread_setschedparam(thread, SCHED_OTHER, &param);
+    }
+    if(result != 0)
+    {
+        printf("Thread '%s': pthread_setschedparam() failed: %s\n", name, strerror(result));
+        ok = 0;
+    }
+
+    /* Report what is now in effect */
+    if(pthread_getaffinity_np(thread, sizeof(cpu_set_t), &cpu_set) == 0)
+    {
+        cpu_list_format(&cpu_set, cpu_string, sizeof(cpu_string));
+    }
+    else
+    {
+        snprintf(cpu_string, sizeof(cpu_string), "unknown");
+    }
+    if(pthread_getschedparam(thread, &policy, &param) != 0)
+    {
+        policy = -1;
+    }
+    if(policy == SCHED_FIFO)
+    {
+        printf("Thread '%s': CPUs %s, SCHED_FIFO priority %d\n", name, cpu_string, param.sched_priority);
+    }
+    else
+    {
+        printf("Thread '%s': CPUs %s, %s\n", name, cpu_string, policy == SCHED_OTHER ? "SCHED_OTHER" : "unknown scheduler");
+    }
+
+    return ok;
+}
+
+uint8_t realtime_memory_lock(void)
+{
+    int flags = MCL_CURRENT | MCL_FUTURE;
+
+#ifdef MCL_ONFAULT
+    /* Don't populate whole mappings (eg. thread stacks) up front, the arena pre-faults what is in use */
+    flags |= MCL_ONFAULT;
+#endif
+
+    if(mlockall(flags) != 0)
+    {
+        printf("mlockall() failed: %s\n", strerror(errno));
+        return 0;
+    }
+    return 1;
+}
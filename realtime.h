@@ -0,0 +1,19 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/* Record the process's initial CPU set, used for threads configured with an empty CPU list */
+void realtime_init(void);
+
+/* Pin a thread to a CPU list (eg. "2-3" or "0,2", "" for the initial CPU set) and set its scheduler,
+ *  SCHED_FIFO at _fifo_priority if non-zero, otherwise SCHED_OTHER.
+ * The settings actually in effect afterwards are printed. Returns 1 if everything requested was applied. */
+uint8_t realtime_thread_apply(pthread_t thread, const char *name, const char *cpu_list, int32_t _fifo_priority);
+
+/* Lock current and future memory, faulting pages in as they are touched (see arena_seal()). Returns 1 on success. */
+uint8_t realtime_memory_lock(void);
+
+#endif /* REALTIME_H */
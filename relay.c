@@ -0,0 +1,265 @@
+#include "relay.h"
+
+uint8_t relay_init(relay_t *relay, const char *upstream, uint16_t _default_port)
+{
+    const char *colon;
+    size_t host_length;
+    long port;
+    char *end;
+
+    memset(relay, 0, sizeof(relay_t));
+
+    colon = strrchr(upstream, ':');
+    host_length = colon != NULL ? (size_t)(colon - upstream) : strlen(upstream);
+    if(host_length == 0 || host_length >= sizeof(relay->host))
+    {
+        fprintf(stderr, "Relay upstream '%s' is not host[:port]\n", upstream);
+        return 0;
+    }
+    memcpy(relay->host, upstream, host_length);
+    relay->host[host_length] = '\0';
+
+    relay->port = _default_port;
+    if(colon != NULL)
+    {
+        port = strtol(colon + 1, &end, 10);
+        if(*end != '\0' || port <= 0 || port > 65535)
+        {
+            fprintf(stderr, "Relay upstream '%s' has an invalid port\n", upstream);
+            return 0;
+        }
+        relay->port = port;
+    }
+
+    return 1;
+}
+
+uint8_t relay_stream_add(relay_t *relay, arena_t *arena, const char *_namespace, const char *name, websocket_output_t *output)
+{
+    relay_stream_t *stream;
+
+    if(relay->stream_count >= RELAY_STREAMS_MAX)
+    {
+        fprintf(stderr, "Too many relay streams, increase RELAY_STREAMS_MAX\n");
+        return 0;
+    }
+    stream = &relay->streams[relay->stream_count];
+
+    snprintf(stream->protocol, RELAY_PROTOCOL_LENGTH, "%s.%s", _namespace, name);
+    stream->output = output;
+    stream->receive_size = output->size;
+    stream->receive = arena_alloc(arena, stream->receive_size, ARENA_CACHE_LINE);
+    if(stream->receive == NULL)
+    {
+        return 0;
+    }
+
+    relay->stream_count++;
+    return 1;
+}
+
+/* Retry all unconnected streams after RELAY_RECONNECT_S, on the websocket thread */
+static void relay_schedule_reconnect(relay_t *relay)
+{
+    if(relay->reconnect_pending)
+    {
+        return;
+    }
+    relay->reconnect_pending = true;
+    lws_timed_callback_vh_protocol(relay->vhost, relay->protocol, LWS_CALLBACK_USER, RELAY_RECONNECT_S);
+}
+
+static void relay_connect(relay_t *relay, relay_stream_t *stream)
+{
+    struct lws_client_connect_info info;
+
+    memset(&info, 0, sizeof(info));
+    info.context = relay->context;
+    info.vhost = relay->vhost;
+    info.address = relay->host;
+    info.port = relay->port;
+    info.path = "/";
+    info.host = relay->host;
+    info.origin = relay->host;
+    info.protocol = stream->protocol;
+    info.local_protocol_name = relay->protocol->name;
+    info.ietf_version_or_minus_one = -1;
+    info.userdata = stream;
+    info.pwsi = &stream->wsi;
+
+    if(lws_client_connect_via_info(&info) == NULL)
+    {
+        stream->wsi = NULL;
+        relay_schedule_reconnect(relay);
+    }
+}
+
+static relay_stream_t *relay_stream_find(relay_t *relay, struct lws *wsi)
+{
+    uint32_t i;
+
+    for(i = 0; i < relay->stream_count; i++)
+    {
+        if(relay->streams[i].wsi == wsi)
+        {
+            return &relay->streams[i];
+        }
+    }
+    return NULL;
+}
+
+/* Publish a complete upstream frame to the output */
+static void relay_stream_publish(relay_stream_t *stream)
+{
+    websocket_output_t *output = stream->output;
+
+    pthread_mutex_lock(&output->mutex);
+
+    memcpy(&output->buffer[LWS_PRE], stream->receive, stream->receive_length);
+    output->length = stream->receive_length;
+    output->sequence_id++;
+
+    pthread_mutex_unlock(&output->mutex);
+
+    __atomic_add_fetch(&stream->frames, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stream->bytes, stream->receive_length, __ATOMIC_RELAXED);
+}
+
+int relay_callback(relay_t *relay, struct lws *wsi, enum lws_callback_reasons reason, void *in, size_t len)
+{
+    relay_stream_t *stream;
+    uint32_t i;
+
+    switch (reason)
+    {
+        case LWS_CALLBACK_PROTOCOL_INIT:
+            relay->context = lws_get_context(wsi);
+            relay->vhost = lws_get_vhost(wsi);
+            relay->protocol = lws_get_protocol(wsi);
+            for(i = 0; i < relay->stream_count; i++)
+            {
+                relay_connect(relay, &relay->streams[i]);
+            }
+            break;
+
+        case LWS_CALLBACK_USER:
+            relay->reconnect_pending = false;
+            for(i = 0; i < relay->stream_count; i++)
+            {
+                if(relay->streams[i].wsi == NULL)
+                {
+                    relay_connect(relay, &relay->streams[i]);
+                }
+            }
+            break;
+
+        /* The relay protocol only makes client connections */
+        case LWS_CALLBACK_ESTABLISHED:
+            return -1;
+
+        case LWS_CALLBACK_CLIENT_ESTABLISHED:
+            if((stream = relay_stream_find(relay, wsi)) != NULL)
+            {
+                stream->connected = true;
+                stream->receive_length = 0;
+                __atomic_add_fetch(&stream->connects, 1, __ATOMIC_RELAXED);
+                fprintf(stdout, "Relay: %s connected to %s:%d\n", stream->protocol, relay->host, relay->port);
+            }
+            break;
+
+        case LWS_CALLBACK_CLIENT_RECEIVE:
+            if((stream = relay_stream_find(relay, wsi)) == NULL)
+            {
+                break;
+            }
+            if(lws_is_first_fragment(wsi))
+            {
+                stream->receive_length = 0;
+                stream->receive_overflow = false;
+            }
+            if(stream->receive_length + len > stream->receive_size)
+            {
+                stream->receive_overflow = true;
+            }
+            else
+            {
+                memcpy(&stream->receive[stream->receive_length], in, len);
+                stream->receive_length += len;
+            }
+            if(lws_is_final_fragment(wsi) && !lws_remaining_packet_payload(wsi))
+            {
+                if(stream->receive_overflow)
+                {
+                    /* Upstream FFT is larger than this relay's pipeline config allows */
+                    stream->frames_oversize++;
+                }
+                else
+                {
+                    relay_stream_publish(stream);
+                }
+            }
+            break;
+
+        case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+        case LWS_CALLBACK_CLIENT_CLOSED:
+            if((stream = relay_stream_find(relay, wsi)) != NULL)
+            {
+                if(stream->connected)
+                {
+                    fprintf(stdout, "Relay: %s disconnected from %s:%d\n", stream->protocol, relay->host, relay->port);
+                }
+                stream->connected = false;
+                stream->wsi = NULL;
+                relay_schedule_reconnect(relay);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+uint32_t relay_connected_count(relay_t *relay)
+{
+    uint32_t i, n = 0;
+
+    for(i = 0; i < relay->stream_count; i++)
+    {
+        if(relay->streams[i].connected)
+        {
+            n++;
+        }
+    }
+    return n;
+}
+
+bool relay_stream_updated(relay_stream_t *stream)
+{
+    uint32_t sequence_id = __atomic_load_n(&stream->output->sequence_id, __ATOMIC_RELAXED);
+
+    if(sequence_id == stream->notified_sequence_id)
+    {
+        return false;
+    }
+    stream->notified_sequence_id = sequence_id;
+    return true;
+}
+
+void relay_print_stats(relay_t *relay)
+{
+    relay_stream_t *stream;
+    uint32_t i;
+
+    fprintf(stdout, "Relay %s:%d:", relay->host, relay->port);
+    for(i = 0; i < relay->stream_count; i++)
+    {
+        stream = &relay->streams[i];
+        fprintf(stdout, "%s %s %s (%"PRIu64" frames, %"PRIu64" bytes, %"PRIu64" connects, %"PRIu64" oversize)",
+            i == 0 ? "" : ",", stream->protocol, stream->connected ? "up" : "down",
+            __atomic_load_n(&stream->frames, __ATOMIC_RELAXED), __atomic_load_n(&stream->bytes, __ATOMIC_RELAXED),
+            __atomic_load_n(&stream->connects, __ATOMIC_RELAXED), stream->frames_oversize);
+    }
+    fprintf(stdout, "\n");
+}
@@ -0,0 +1,78 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include "main.h"
+#include <stdbool.h>
+
+#include "arena.h"
+#include "pipeline.h"
+
+/* Relay mode
+ *
+ * Instead of running AirSpys and FFTs, subscribe to the protocols of an upstream airspy_fft_ws as a
+ *  websocket client and re-serve its frames from the same pipeline outputs, so downstream clients see
+ *  identical protocols. Each upstream protocol is one client connection, reconnected every
+ *  RELAY_RECONNECT_S while the upstream is unreachable. Relays can be chained, as a relay serves the
+ *  same namespaced protocols it subscribes to.
+ */
+
+#define RELAY_STREAMS_MAX       32
+#define RELAY_RECONNECT_S       5
+#define RELAY_PROTOCOL_LENGTH   48
+
+typedef struct {
+    /* Upstream subprotocol, eg. "wb.fft" */
+    char protocol[RELAY_PROTOCOL_LENGTH];
+    websocket_output_t *output;
+
+    /* Websocket thread only */
+    struct lws *wsi;
+    bool connected;
+    /* Frame being reassembled from fragments */
+    uint8_t *receive;
+    uint32_t receive_length;
+    uint32_t receive_size;
+    bool receive_overflow;
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t connects;
+    uint64_t frames_oversize;
+
+    /* Main thread only, the last frame fanned out to downstream clients */
+    uint32_t notified_sequence_id;
+} relay_stream_t;
+
+typedef struct {
+    char host[128];
+    uint16_t port;
+
+    relay_stream_t streams[RELAY_STREAMS_MAX];
+    uint32_t stream_count;
+
+    /* Set by the relay protocol on init */
+    struct lws_context *context;
+    struct lws_vhost *vhost;
+    const struct lws_protocols *protocol;
+    /* A reconnect timer is running */
+    bool reconnect_pending;
+} relay_t;
+
+/* Parse "host[:port]", the port defaulting to _default_port. Returns 1 on success. */
+uint8_t relay_init(relay_t *relay, const char *upstream, uint16_t _default_port);
+
+/* Subscribe to "<_namespace>.<name>" upstream, writing its frames to output. Returns 1 on success. */
+uint8_t relay_stream_add(relay_t *relay, arena_t *arena, const char *_namespace, const char *name, websocket_output_t *output);
+
+/* Handle the lws callbacks of the relay protocol, which the upstream client connections are bound to.
+ *  On init this starts the connections. */
+int relay_callback(relay_t *relay, struct lws *wsi, enum lws_callback_reasons reason, void *in, size_t len);
+
+/* Upstream connections currently established */
+uint32_t relay_connected_count(relay_t *relay);
+
+/* Main thread: true once for each new frame on a stream since the last call */
+bool relay_stream_updated(relay_stream_t *stream);
+
+void relay_print_stats(relay_t *relay);
+
+#endif /* RELAY_H */
@@ -0,0 +1,738 @@
+#include "selftest.h"
+#include "pipeline.h"
+
+#define SELFTEST_SAMPLE_RATE    10000000
+#define SELFTEST_FREQ           745000000
+
+/* Gaussian noise per I/Q component, from a fixed seed */
+#define SELFTEST_NOISE_RMS      0.01
+#define SELFTEST_SEED           0x2545F4914F6CDD1DULL
+
+/* Blocks of IQ averaged, ~0.5s of a 10MSPS AirSpy */
+#define SELFTEST_BLOCKS         160
+/* Frames published from them by a 1ms stage with a window of this many intervals: the first takes all
+ *  the blocks, the rest republish the same window for the carrier detector to confirm them */
+#define SELFTEST_STAGE_FRAMES   8
+
+/* Tone leakage is taken into account this many bins either side */
+#define SELFTEST_RESPONSE_BINS  16
+
+/* Line profile applied to every test pipeline: as measured by the "wb" pipeline, one point per bin of
+ *  1024, a tilt and a ripple of this many dB each across the band */
+#define SELFTEST_PROFILE_POINTS 1024
+#define SELFTEST_PROFILE_DB     0.5
+
+/* A fixed-point pipeline's frame against its float twin's, from the same signal */
+#define SELFTEST_FIXED_TOLERANCE_DB 0.1
+
+/* Each benchmark runs for at least this long */
+#define SELFTEST_BENCHMARK_NS   200000000ULL
+/* The DDC is timed over one AirSpy transfer, at zoom decimations from the smallest up */
+#define SELFTEST_DDC_SAMPLES    65536
+static const uint32_t benchmark_decimations[] = { 4, 16, 64 };
+#define BENCHMARK_DECIMATIONS   (sizeof(benchmark_decimations) / sizeof(benchmark_decimations[0]))
+
+/* Tones at multiples of sample rate / 1024, so they are bin-centred at every FFT size from 1024 up.
+ *  Amplitudes give 6 - 20dB over the noise per bin, inside the display range above the floor.
+ *  A tone of two lines, a multiple apart, is a carrier wider than CARRIER_MIN_BINS for every
+ *  estimator: WOLA keeps a single line to one bin however strong it is. Their cross terms cancel
+ *  over pairs of frames for the Hann configs, and WOLA leaves no overlap to cancel. */
+static const struct {
+    int32_t bins_1024;
+    double amplitude;
+    uint32_t lines;
+} selftest_tones[] = {
+    { 200,  0.003,  1 },
+    { -333, 0.0015, 1 },
+    { 50,   0.0008, 1 },
+    { -150, 0.002,  2 },
+};
+#define SELFTEST_TONES      (sizeof(selftest_tones) / sizeof(selftest_tones[0]))
+#define SELFTEST_LINES_MAX  2
+
+/* Each fixed-point config follows its float twin, which it is also compared against */
+static const pipeline_config_t selftest_configs[] = {
+    /* As the "wb" pipeline */
+    {
+        .name = "hann-1024",
+        .freq_hz = SELFTEST_FREQ,
+        .sample_rate = SELFTEST_SAMPLE_RATE,
+        .fft_size = 1024,
+        .estimator = FILTERBANK_HANN,
+        .overlap = 50,
+        .fft_estimate = true,
+    },
+    {
+        .name = "hann-1024-fixed",
+        .freq_hz = SELFTEST_FREQ,
+        .sample_rate = SELFTEST_SAMPLE_RATE,
+        .fft_size = 1024,
+        .estimator = FILTERBANK_HANN,
+        .overlap = 50,
+        .fixed_point = true,
+    },
+    {
+        .name = "hann-2048",
+        .freq_hz = SELFTEST_FREQ,
+        .sample_rate = SELFTEST_SAMPLE_RATE,
+        .fft_size = 2048,
+        .estimator = FILTERBANK_HANN,
+        .overlap = 75,
+        .fft_estimate = true,
+    },
+    {
+        .name = "wola-2048",
+        .freq_hz = SELFTEST_FREQ,
+        .sample_rate = SELFTEST_SAMPLE_RATE,
+        .fft_size = 2048,
+        .estimator = FILTERBANK_WOLA,
+        .estimator_taps = 4,
+        .overlap = 0,
+        .fft_estimate = true,
+    },
+    {
+        .name = "wola-2048-fixed",
+        .freq_hz = SELFTEST_FREQ,
+        .sample_rate = SELFTEST_SAMPLE_RATE,
+        .fft_size = 2048,
+        .estimator = FILTERBANK_WOLA,
+        .estimator_taps = 4,
+        .overlap = 0,
+        .fixed_point = true,
+    },
+};
+#define SELFTEST_CONFIGS    (sizeof(selftest_configs) / sizeof(selftest_configs[0]))
+
+/* Benchmarked with the production plan from the wisdom file */
+static const pipeline_config_t benchmark_configs[] = {
+    {
+        .name = "hann-1024",
+        .freq_hz = SELFTEST_FREQ,
+        .sample_rate = SELFTEST_SAMPLE_RATE,
+        .fft_size = 1024,
+        .estimator = FILTERBANK_HANN,
+        .overlap = 50,
+    },
+    {
+        .name = "wola-1024",
+        .freq_hz = SELFTEST_FREQ,
+        .sample_rate = SELFTEST_SAMPLE_RATE,
+        .fft_size = 1024,
+        .estimator = FILTERBANK_WOLA,
+        .estimator_taps = 4,
+        .overlap = 50,
+    },
+    {
+        .name = "hann-1024-fixed",
+        .freq_hz = SELFTEST_FREQ,
+        .sample_rate = SELFTEST_SAMPLE_RATE,
+        .fft_size = 1024,
+        .estimator = FILTERBANK_HANN,
+        .overlap = 50,
+        .fixed_point = true,
+    },
+};
+#define BENCHMARK_CONFIGS   (sizeof(benchmark_configs) / sizeof(benchmark_configs[0]))
+
+static pipeline_t selftest_pipeline;
+
+/* Packed frame of the last float pipeline run */
+static uint16_t *selftest_float_frame;
+static uint32_t selftest_float_length;
+
+/** Deterministic IQ **/
+
+typedef struct {
+    uint64_t state;
+    double tone_phase[SELFTEST_TONES][SELFTEST_LINES_MAX];
+} selftest_signal_t;
+
+static void signal_init(selftest_signal_t *signal)
+{
+    memset(signal, 0, sizeof(selftest_signal_t));
+    signal->state = SELFTEST_SEED;
+}
+
+/* xorshift64*, uniform in (0, 1] */
+static double signal_uniform(selftest_signal_t *signal)
+{
+    signal->state ^= signal->state >> 12;
+    signal->state ^= signal->state << 25;
+    signal->state ^= signal->state >> 27;
+    return ((signal->state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0) + (1.0 / 18014398509481984.0);
+}
+
+/* _count samples of the tones over gaussian noise, interleaved IQ */
+static void signal_generate(selftest_signal_t *signal, float *samples, uint32_t _count)
+{
+    double r, theta, step;
+    uint32_t i, t, l;
+
+    for(i = 0; i < _count; i++)
+    {
+        /* Box-Muller, one pair per sample */
+        r = SELFTEST_NOISE_RMS * sqrt(-2.0 * log(signal_uniform(signal)));
+        theta = 2*M_PI * signal_uniform(signal);
+        samples[2*i] = r * cos(theta);
+        samples[(2*i)+1] = r * sin(theta);
+    }
+
+    for(t = 0; t < SELFTEST_TONES; t++)
+    {
+        for(l = 0; l < selftest_tones[t].lines; l++)
+        {
+            step = 2*M_PI * (selftest_tones[t].bins_1024 + (int32_t)l) / 1024.0;
+            for(i = 0; i < _count; i++)
+            {
+                samples[2*i] += selftest_tones[t].amplitude * cos(signal->tone_phase[t][l]);
+                samples[(2*i)+1] += selftest_tones[t].amplitude * sin(signal->tone_phase[t][l]);
+                signal->tone_phase[t][l] = fmod(signal->tone_phase[t][l] + step, 2*M_PI);
+            }
+        }
+    }
+}
+
+/* The same samples as int16, for a fixed-point pipeline */
+static void signal_to_int16(const float *samples, int16_t *samples_int16, uint32_t _count)
+{
+    long q;
+    uint32_t i;
+
+    for(i = 0; i < 2 * _count; i++)
+    {
+        q = lrintf(samples[i] * 32768.0f);
+        samples_int16[i] = q > INT16_MAX ? INT16_MAX : (q < INT16_MIN ? INT16_MIN : q);
+    }
+}
+
+/** Expected frame **/
+
+/* Mean power of a bin of tone and noise, the stages averaging linear power */
+static double expected_power_db(double _tone_power, double _noise_power)
+{
+    return 10.0 * log10(_tone_power + _noise_power);
+}
+
+/* Power response of the prefilter to a bin-centred tone _offset bins away */
+static double filterbank_response(const filterbank_t *fb, int32_t _offset)
+{
+    const uint32_t length = fb->taps * fb->fft_size;
+    double re = 0.0, im = 0.0;
+    uint32_t n;
+
+    for(n = 0; n < length; n++)
+    {
+        re += fb->coeffs[2*n] * cos(2*M_PI * _offset * (double)n / fb->fft_size);
+        im -= fb->coeffs[2*n] * sin(2*M_PI * _offset * (double)n / fb->fft_size);
+    }
+    return (re * re) + (im * im);
+}
+
+/* Level of each output bin relative to a bin of noise alone, in dB */
+static void expected_frame(const pipeline_t *pipeline, double *expected_db)
+{
+    const filterbank_t *fb = &pipeline->filterbank;
+    const uint32_t length = fb->taps * fb->fft_size;
+    const int32_t first_bin = (int32_t)(pipeline->fft_size*0.05) - (int32_t)(pipeline->fft_size/2);
+    double noise_power, tone_power, noise_db;
+    int32_t tone_bin, offset;
+    uint32_t i, t, l, n;
+
+    /* Complex noise of 2 * rms^2 per sample through the prefilter */
+    noise_power = 0.0;
+    for(n = 0; n < length; n++)
+    {
+        noise_power += fb->coeffs[2*n] * fb->coeffs[2*n];
+    }
+    noise_power *= 2.0 * SELFTEST_NOISE_RMS * SELFTEST_NOISE_RMS;
+    noise_db = expected_power_db(0.0, noise_power);
+
+    for(i = 0; i < pipeline->output_length; i++)
+    {
+        tone_power = 0.0;
+        for(t = 0; t < SELFTEST_TONES; t++)
+        {
+            for(l = 0; l < selftest_tones[t].lines; l++)
+            {
+                tone_bin = ((selftest_tones[t].bins_1024 + (int32_t)l) * (int32_t)pipeline->fft_size) / 1024;
+                offset = (first_bin + (int32_t)i) - tone_bin;
+                if(abs(offset) <= SELFTEST_RESPONSE_BINS)
+                {
+                    tone_power += selftest_tones[t].amplitude * selftest_tones[t].amplitude * filterbank_response(fb, offset);
+                }
+            }
+        }
+        expected_db[i] = expected_power_db(tone_power, noise_power) - noise_db;
+    }
+}
+
+/* Centre frequency of tone _t, between its lines */
+static double tone_freq_hz(const pipeline_t *pipeline, uint32_t _t)
+{
+    return pipeline->freq_hz + ((selftest_tones[_t].bins_1024 + ((selftest_tones[_t].lines - 1) / 2.0)) * (pipeline->sample_rate / 1024.0));
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/** Self-test **/
+
+static uint8_t selftest_pipeline_run(arena_t *arena, const pipeline_config_t *config)
+{
+    pipeline_t *pipeline = &selftest_pipeline;
+    const pipeline_fft_level_t *level;
+    pipeline_stage_t *stage;
+    selftest_signal_t signal;
+    float *samples, *profile;
+    int16_t *samples_int16;
+    double *expected_db, *measured_db, *noise_db;
+    double units_per_db, reference, error, worst_tone = 0.0, worst_noise = 0.0, worst_float = 0.0;
+    double bin_hz, tone_hz;
+    uint32_t i, t, c, noise_count = 0, tone_count = 0, failures = 0, carriers = 0, detectable = 0;
+    int32_t first, last;
+    uint16_t expected;
+    carrier_t *carrier;
+    bool found;
+
+    fprintf(stdout, "%s: ", config->name);
+    fflush(stdout);
+
+    if(!pipeline_init(pipeline, config, NULL, arena)
+        || !pipeline_stage_add(pipeline, arena, 1, SELFTEST_STAGE_FRAMES,
+            &pipeline->output_fft, &pipeline->output_fft_v2, &pipeline->output_carriers))
+    {
+        fprintf(stdout, "FAIL (init)\n");
+        return 0;
+    }
+    stage = &pipeline->stages[0];
+    samples = arena_alloc(arena, sizeof(float) * 2 * pipeline->fft_block_samples, ARENA_CACHE_LINE);
+    samples_int16 = arena_alloc(arena, sizeof(int16_t) * 2 * pipeline->fft_block_samples, ARENA_CACHE_LINE);
+    expected_db = arena_alloc(arena, sizeof(double) * pipeline->fft_size, ARENA_CACHE_LINE);
+    measured_db = arena_alloc(arena, sizeof(double) * pipeline->fft_size, ARENA_CACHE_LINE);
+    noise_db = arena_alloc(arena, sizeof(double) * pipeline->fft_size, ARENA_CACHE_LINE);
+    profile = arena_alloc(arena, sizeof(float) * SELFTEST_PROFILE_POINTS, ARENA_CACHE_LINE);
+    if(samples == NULL || samples_int16 == NULL || expected_db == NULL || measured_db == NULL || noise_db == NULL
+        || profile == NULL)
+    {
+        fprintf(stdout, "FAIL (arena)\n");
+        return 0;
+    }
+
+    /* A profile as if loaded for the device, so the frame is checked with the passband compensation */
+    for(i = 0; i < SELFTEST_PROFILE_POINTS; i++)
+    {
+        profile[i] = SELFTEST_PROFILE_DB * ((((2.0 * i) / SELFTEST_PROFILE_POINTS) - 1.0)
+            + sin(2*M_PI * 5.0 * i / SELFTEST_PROFILE_POINTS));
+    }
+    pipeline_line_profile_set(pipeline, profile, SELFTEST_PROFILE_POINTS);
+
+    level = &pipeline->fft_levels[0];
+    signal_init(&signal);
+    for(i = 0; i < SELFTEST_BLOCKS; i++)
+    {
+        signal_generate(&signal, samples, pipeline->fft_block_samples);
+        if(config->fixed_point)
+        {
+            signal_to_int16(samples, samples_int16, pipeline->fft_block_samples);
+            pipeline_fft_block(pipeline, samples_int16, level);
+        }
+        else
+        {
+            pipeline_fft_block(pipeline, samples, level);
+        }
+    }
+
+    for(i = 0; i < SELFTEST_STAGE_FRAMES; i++)
+    {
+        if(pipeline_stages_run(pipeline, i) != 1)
+        {
+            fprintf(stdout, "\n  stage not published at %dms", i);
+            failures++;
+        }
+    }
+
+    /* The websocket frames are the packed frame */
+    if(pipeline->output_fft.length != 2 * pipeline->output_length
+        || memcmp(&pipeline->output_fft.buffer[LWS_PRE], stage->frame, pipeline->output_fft.length) != 0
+        || pipeline->output_fft_v2.output.length != FFT_FRAME_HEADER_LENGTH + (2 * pipeline->output_length)
+        || memcmp(&pipeline->output_fft_v2.output.buffer[LWS_PRE + FFT_FRAME_HEADER_LENGTH], stage->frame, 2 * pipeline->output_length) != 0)
+    {
+        fprintf(stdout, "\n  websocket frame does not match the packed frame");
+        failures++;
+    }
+
+    /* Measured levels without the passband compensation, against the median of the noise bins */
+    units_per_db = pipeline->carrier_detector.units_per_db;
+    expected_frame(pipeline, expected_db);
+    for(i = 0; i < pipeline->output_length; i++)
+    {
+        measured_db[i] = (stage->frame[i] / units_per_db) - pipeline_line_compensation_db(pipeline, i);
+        if(expected_db[i] < 0.01)
+        {
+            noise_db[noise_count++] = measured_db[i];
+        }
+    }
+    qsort(noise_db, noise_count, sizeof(double), compare_double);
+    reference = noise_db[noise_count / 2];
+
+    for(i = 0; i < pipeline->output_length; i++)
+    {
+        /* Expected frame, clipped as the packed frame is */
+        expected = fmin(fmax((reference + expected_db[i] + pipeline_line_compensation_db(pipeline, i)) * units_per_db, 0.0), 0xFFFF);
+        error = (stage->frame[i] - (double)expected) / units_per_db;
+
+        if(expected_db[i] < 0.01)
+        {
+            worst_noise = fmax(worst_noise, fabs(error));
+            if(fabs(error) > SELFTEST_NOISE_TOLERANCE_DB)
+            {
+                fprintf(stdout, "\n  noise bin %d: %d, expected %d (%+.2fdB)", i, stage->frame[i], expected, error);
+                failures++;
+            }
+        }
+        else
+        {
+            tone_count++;
+            worst_tone = fmax(worst_tone, fabs(error));
+            if(fabs(error) > SELFTEST_TONE_TOLERANCE_DB)
+            {
+                fprintf(stdout, "\n  tone bin %d: %d, expected %d (%+.2fdB)", i, stage->frame[i], expected, error);
+                failures++;
+            }
+        }
+    }
+
+    /* The floor AGC holds the floor at its target */
+    if(abs((int32_t)stage->floor - (int32_t)pipeline_floor_target()) > 0.2 * units_per_db)
+    {
+        fprintf(stdout, "\n  floor %d, expected %d", stage->floor, pipeline_floor_target());
+        failures++;
+    }
+
+    /* Every tone spanning enough bins over the threshold is reported within a bin of its frequency, and nothing
+     *  else is. The span is first to last such bin, as the detector merges across gaps. */
+    bin_hz = (double)pipeline->sample_rate / pipeline->fft_size;
+    for(t = 0; t < SELFTEST_TONES; t++)
+    {
+        tone_hz = tone_freq_hz(pipeline, t);
+        first = -1;
+        last = -1;
+        for(i = 0; i < pipeline->output_length; i++)
+        {
+            if(expected_db[i] > CARRIER_THRESHOLD_DB + 2.0
+                && fabs((pipeline->freq_hz + ((((int32_t)i + (int32_t)(pipeline->fft_size*0.05)) - (int32_t)(pipeline->fft_size/2)) * bin_hz)) - tone_hz) < SELFTEST_RESPONSE_BINS * bin_hz)
+            {
+                first = first < 0 ? (int32_t)i : first;
+                last = i;
+            }
+        }
+        found = false;
+        for(c = 0; c < pipeline->carrier_detector.carrier_count; c++)
+        {
+            carrier = &pipeline->carrier_detector.carriers[c];
+            if(carrier->reported && fabs(carrier->freq_hz - tone_hz) <= bin_hz)
+            {
+                found = true;
+            }
+        }
+        carriers += found;
+        if(first >= 0 && (last - first + 1) >= CARRIER_MIN_BINS)
+        {
+            detectable++;
+            if(!found)
+            {
+                fprintf(stdout, "\n  carrier at %.03fMHz not reported", tone_hz / 1000000);
+                failures++;
+            }
+        }
+    }
+    if(detectable == 0)
+    {
+        fprintf(stdout, "\n  no tone wide enough to test the carrier detector");
+        failures++;
+    }
+    for(c = 0; c < pipeline->carrier_detector.carrier_count; c++)
+    {
+        carrier = &pipeline->carrier_detector.carriers[c];
+        found = false;
+        for(t = 0; t < SELFTEST_TONES; t++)
+        {
+            tone_hz = tone_freq_hz(pipeline, t);
+            found |= fabs(carrier->freq_hz - tone_hz) <= 2 * bin_hz;
+        }
+        if(carrier->reported && !found)
+        {
+            fprintf(stdout, "\n  spurious carrier at %.03fMHz", carrier->freq_hz / 1000000);
+            failures++;
+        }
+    }
+
+    /* A fixed-point pipeline reads as its float twin did */
+    if(config->fixed_point && selftest_float_frame != NULL && selftest_float_length == pipeline->output_length)
+    {
+        for(i = 0; i < pipeline->output_length; i++)
+        {
+            error = ((int32_t)stage->frame[i] - (int32_t)selftest_float_frame[i]) / units_per_db;
+            worst_float = fmax(worst_float, fabs(error));
+        }
+        if(worst_float > SELFTEST_FIXED_TOLERANCE_DB)
+        {
+            fprintf(stdout, "\n  %.2fdB from the float path", worst_float);
+            failures++;
+        }
+    }
+    else if(!config->fixed_point
+        && (selftest_float_frame = arena_alloc(arena, sizeof(uint16_t) * pipeline->output_length, ARENA_CACHE_LINE)) != NULL)
+    {
+        memcpy(selftest_float_frame, stage->frame, sizeof(uint16_t) * pipeline->output_length);
+        selftest_float_length = pipeline->output_length;
+    }
+
+    pipeline_close(pipeline);
+
+    if(failures > 0)
+    {
+        fprintf(stdout, "\n  FAIL (%d failures)\n", failures);
+        return 0;
+    }
+    fprintf(stdout, "PASS (%d blocks, %d tone bins within %.2fdB, %d noise bins within %.2fdB, floor %d, %d carriers",
+        SELFTEST_BLOCKS, tone_count, worst_tone, pipeline->output_length - tone_count, worst_noise, stage->floor, carriers);
+    if(config->fixed_point)
+    {
+        fprintf(stdout, ", within %.3fdB of float", worst_float);
+    }
+    fprintf(stdout, ")\n");
+    return 1;
+}
+
+uint8_t selftest_run(arena_t *arena)
+{
+    uint32_t i, passed = 0;
+
+    fprintf(stdout, "Self-test, %d tones over noise of %.03f rms:\n", (int)SELFTEST_TONES, SELFTEST_NOISE_RMS);
+    for(i = 0; i < SELFTEST_CONFIGS; i++)
+    {
+        passed += selftest_pipeline_run(arena, &selftest_configs[i]);
+    }
+    fprintf(stdout, "%d of %d passed\n", passed, (int)SELFTEST_CONFIGS);
+
+    return passed == SELFTEST_CONFIGS;
+}
+
+/** Benchmarks **/
+
+typedef struct {
+    pipeline_t *pipeline;
+    /* Float or int16, as the pipeline takes */
+    const void *samples;
+    /* A stage due on every call, and one block of the FFT thread's power to refill it from */
+    pipeline_stage_t *stage;
+    uint32_t ms;
+    fft_buffer_t block;
+    /* Zoom down-converter, over SELFTEST_DDC_SAMPLES float samples */
+    ddc_t ddc;
+    float *ddc_output;
+} benchmark_t;
+
+static void benchmark_prefilter(benchmark_t *b)
+{
+    filterbank_prefilter(&b->pipeline->filterbank, b->samples, b->pipeline->fft_in);
+}
+
+static void benchmark_fft(benchmark_t *b)
+{
+    fftw_execute(b->pipeline->fft_plan);
+}
+
+/* Fixed point window/fold and FFT are one kernel */
+static void benchmark_fft_fixed(benchmark_t *b)
+{
+    fft_fixed_execute(&b->pipeline->fft_fixed, b->samples);
+}
+
+static void benchmark_accumulate(benchmark_t *b)
+{
+    pipeline_fft_accumulate(b->pipeline);
+}
+
+static void benchmark_block(benchmark_t *b)
+{
+    pipeline_fft_block(b->pipeline, b->samples, &b->pipeline->fft_levels[0]);
+}
+
+static void benchmark_floor(benchmark_t *b)
+{
+    uint32_t i;
+
+    floor_estimator_reset(&b->pipeline->floor_estimator);
+    for(i = 0; i < b->pipeline->output_length; i++)
+    {
+        floor_estimator_add(&b->pipeline->floor_estimator, b->pipeline->output_data[i]);
+    }
+    b->stage->floor = floor_estimator_percentile(&b->pipeline->floor_estimator, 5);
+}
+
+/* Copy one block of power in for the FFT thread, as pipeline_fft_block() would have added it */
+static void benchmark_refill(benchmark_t *b)
+{
+    pipeline_t *pipeline = b->pipeline;
+
+    if(pipeline->config->fixed_point)
+    {
+        memcpy(pipeline->fft_buffer.power_lo, b->block.power_lo, sizeof(uint64_t) * pipeline->fft_size);
+        memcpy(pipeline->fft_buffer.power_hi, b->block.power_hi, sizeof(uint32_t) * pipeline->fft_size);
+    }
+    else
+    {
+        memcpy(pipeline->fft_buffer.power, b->block.power, sizeof(double) * pipeline->fft_size);
+    }
+    pipeline->fft_buffer.frames = b->block.frames;
+}
+
+/* Drain, scale, floor and pack of one stage (with the refill) */
+static void benchmark_stage(benchmark_t *b)
+{
+    benchmark_refill(b);
+    b->ms += b->stage->interval_ms;
+    pipeline_stages_run(b->pipeline, b->ms);
+}
+
+static void benchmark_carriers(benchmark_t *b)
+{
+    pipeline_carriers_to_buffer(b->pipeline, b->stage, &b->pipeline->output_carriers);
+}
+
+static void benchmark_ddc(benchmark_t *b)
+{
+    ddc_process(&b->ddc, b->samples, SELFTEST_DDC_SAMPLES, b->ddc_output);
+}
+
+/* Mean time per call, doubling the calls until the run lasts SELFTEST_BENCHMARK_NS */
+static double benchmark_time(void (*kernel)(benchmark_t *), benchmark_t *b)
+{
+    struct timespec start, end;
+    uint64_t calls, i, elapsed_ns;
+
+    for(calls = 1; ; calls *= 2)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(i = 0; i < calls; i++)
+        {
+            kernel(b);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        elapsed_ns = ((end.tv_sec - start.tv_sec) * 1000000000ULL) + end.tv_nsec - start.tv_nsec;
+        if(elapsed_ns >= SELFTEST_BENCHMARK_NS)
+        {
+            return (double)elapsed_ns / calls;
+        }
+    }
+}
+
+uint8_t selftest_benchmark(arena_t *arena)
+{
+    static const struct {
+        const char *name;
+        void (*kernel)(benchmark_t *);
+        /* Run on float and / or fixed-point pipelines */
+        bool float_path;
+        bool fixed_path;
+    } kernels[] = {
+        { "window/fold", benchmark_prefilter, true, false },
+        { "fft", benchmark_fft, true, false },
+        { "window+fft", benchmark_fft_fixed, false, true },
+        { "power", benchmark_accumulate, true, true },
+        { "fft block", benchmark_block, true, true },
+        { "stage", benchmark_stage, true, true },
+        { "floor", benchmark_floor, true, true },
+        { "carriers", benchmark_carriers, true, true },
+    };
+    pipeline_t *pipeline = &selftest_pipeline;
+    selftest_signal_t signal;
+    benchmark_t b;
+    float *samples;
+    int16_t *samples_int16;
+    double ns;
+    uint32_t i, k;
+
+    for(i = 0; i < BENCHMARK_CONFIGS; i++)
+    {
+        if(!pipeline_init(pipeline, &benchmark_configs[i], NULL, arena)
+            || !pipeline_stage_add(pipeline, arena, 1, 1, &pipeline->output_fft, &pipeline->output_fft_v2, NULL)
+            || (b.block.power = arena_alloc(arena, sizeof(double) * pipeline->fft_size, ARENA_CACHE_LINE)) == NULL
+            || (b.block.power_lo = arena_alloc(arena, sizeof(uint64_t) * pipeline->fft_size, ARENA_CACHE_LINE)) == NULL
+            || (b.block.power_hi = arena_alloc(arena, sizeof(uint32_t) * pipeline->fft_size, ARENA_CACHE_LINE)) == NULL
+            || (samples = arena_alloc(arena, sizeof(float) * 2 * pipeline->fft_block_samples, ARENA_CACHE_LINE)) == NULL
+            || (samples_int16 = arena_alloc(arena, sizeof(int16_t) * 2 * pipeline->fft_block_samples, ARENA_CACHE_LINE)) == NULL)
+        {
+            fprintf(stderr, "%s: benchmark init failed\n", benchmark_configs[i].name);
+            return 0;
+        }
+        signal_init(&signal);
+        signal_generate(&signal, samples, pipeline->fft_block_samples);
+        signal_to_int16(samples, samples_int16, pipeline->fft_block_samples);
+        b.pipeline = pipeline;
+        b.samples = benchmark_configs[i].fixed_point ? (const void *)samples_int16 : (const void *)samples;
+        b.stage = &pipeline->stages[0];
+        b.ms = 0;
+
+        /* Fill the FFT buffer with a real spectrum, keep it to refill from, and publish it */
+        pipeline_fft_block(pipeline, b.samples, &pipeline->fft_levels[0]);
+        if(benchmark_configs[i].fixed_point)
+        {
+            memcpy(b.block.power_lo, pipeline->fft_buffer.power_lo, sizeof(uint64_t) * pipeline->fft_size);
+            memcpy(b.block.power_hi, pipeline->fft_buffer.power_hi, sizeof(uint32_t) * pipeline->fft_size);
+        }
+        else
+        {
+            memcpy(b.block.power, pipeline->fft_buffer.power, sizeof(double) * pipeline->fft_size);
+        }
+        b.block.frames = pipeline->fft_buffer.frames;
+        pipeline_stages_run(pipeline, b.ms);
+
+        fprintf(stdout, "%s (%d lines/block):\n", benchmark_configs[i].name, pipeline->fft_levels[0].frames);
+        for(k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+        {
+            if(!(benchmark_configs[i].fixed_point ? kernels[k].fixed_path : kernels[k].float_path))
+            {
+                continue;
+            }
+            ns = benchmark_time(kernels[k].kernel, &b);
+            fprintf(stdout, "  %-14s %10.2fus", kernels[k].name, ns / 1000);
+            if(kernels[k].kernel == benchmark_block)
+            {
+                fprintf(stdout, "  (%.2fus/line, %.1f%% of realtime)", ns / 1000 / pipeline->fft_levels[0].frames,
+                    100.0 * ns / (((double)pipeline->iq_ring.block_samples * 1000000000) / pipeline->sample_rate));
+            }
+            fprintf(stdout, "\n");
+        }
+
+        pipeline_close(pipeline);
+    }
+
+    /* NCO, CIC and FIR of a zoom pipeline's FFT thread */
+    if((samples = arena_alloc(arena, sizeof(float) * 2 * SELFTEST_DDC_SAMPLES, ARENA_CACHE_LINE)) == NULL
+        || (b.ddc_output = arena_alloc(arena, sizeof(float) * 2 * ((SELFTEST_DDC_SAMPLES / DDC_FIR_DECIMATION) + 1), ARENA_CACHE_LINE)) == NULL
+        || !ddc_init(&b.ddc, arena, SELFTEST_SAMPLE_RATE / 8, SELFTEST_SAMPLE_RATE, DDC_FIR_DECIMATION))
+    {
+        fprintf(stderr, "ddc: benchmark init failed\n");
+        return 0;
+    }
+    signal_init(&signal);
+    signal_generate(&signal, samples, SELFTEST_DDC_SAMPLES);
+    b.samples = samples;
+
+    fprintf(stdout, "ddc (%d samples/block):\n", SELFTEST_DDC_SAMPLES);
+    for(i = 0; i < BENCHMARK_DECIMATIONS; i++)
+    {
+        ddc_configure(&b.ddc, SELFTEST_SAMPLE_RATE / 8, SELFTEST_SAMPLE_RATE, benchmark_decimations[i]);
+        ns = benchmark_time(benchmark_ddc, &b);
+        fprintf(stdout, "  decimation %-3d %10.2fus  (%.2fns/sample, %.1f%% of realtime)\n", benchmark_decimations[i], ns / 1000,
+            ns / SELFTEST_DDC_SAMPLES, 100.0 * ns / (((double)SELFTEST_DDC_SAMPLES * 1000000000) / SELFTEST_SAMPLE_RATE));
+    }
+
+    return 1;
+}
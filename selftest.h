@@ -0,0 +1,35 @@
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+#include <stdint.h>
+
+#include "arena.h"
+
+/* DSP self-test and benchmarks, run from the command line in place of the server (no AirSpy needed)
+ *
+ * Deterministic IQ, bin-centred tones of known amplitude over seeded gaussian noise of known power,
+ *  is run through the FFT, an output stage and the carrier detector of test pipelines with a fixed FFTW
+ *  plan (FFTW_ESTIMATE, no wisdom) and a synthetic line profile. Each packed uint16 frame is compared bin
+ *  by bin against the frame expected from the window's response and the profile, within tolerances:
+ *
+ *   - tone bins, at SELFTEST_TONE_TOLERANCE_DB of the expected level above the noise
+ *   - noise bins, at SELFTEST_NOISE_TOLERANCE_DB of the noise reference
+ *   - the noise floor AGC, which must settle the floor at its target level
+ *   - the carrier detector, which must report each tone wide enough to be a carrier at its frequency and
+ *      nothing else; every pipeline has at least one such tone, or it fails
+ *   - for a fixed-point pipeline, its float twin's frame, within SELFTEST_FIXED_TOLERANCE_DB
+ *
+ * The benchmarks time each step of the FFT thread and output stage in isolation, per call, and a zoom
+ *  pipeline's DDC over one AirSpy transfer at a few decimations.
+ */
+
+#define SELFTEST_TONE_TOLERANCE_DB  0.5
+#define SELFTEST_NOISE_TOLERANCE_DB 0.75
+
+/* Returns 1 if every test passed */
+uint8_t selftest_run(arena_t *arena);
+
+/* Returns 1 on success */
+uint8_t selftest_benchmark(arena_t *arena);
+
+#endif /* SELFTEST_H */
@@ -0,0 +1,20 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdint.h>
+
+/* Portable SIMD vectors using GCC vector extensions
+ *
+ * 8 floats, compiled to AVX where available, otherwise split by the compiler into SSE / NEON pairs.
+ */
+
+typedef float v8sf __attribute__((vector_size(32)));
+/* Same, for loads from sample buffers with no alignment guarantee beyond float */
+typedef float v8sf_u __attribute__((vector_size(32), aligned(4)));
+
+#define V8SF_FLOATS     (sizeof(v8sf) / sizeof(float))
+
+/* 2 x uint64, one lane each for I and Q of fixed-point IQ (SSE2 / NEON) */
+typedef uint64_t v2du __attribute__((vector_size(16)));
+
+#endif /* SIMD_H */
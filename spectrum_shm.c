@@ -0,0 +1,127 @@
+#include "spectrum_shm.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* Readers in other processes wait on the futex, so it can't be FUTEX_PRIVATE */
+static void futex_wake_all(uint32_t *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+uint8_t spectrum_shm_init(spectrum_shm_t *shm, const char *_name, uint32_t _bin_count_max)
+{
+    uint32_t slot_bytes;
+
+    memset(shm, 0, sizeof(spectrum_shm_t));
+    shm->fd = -1;
+    snprintf(shm->name, sizeof(shm->name), SPECTRUM_SHM_NAME_PREFIX "%s", _name);
+
+    /* Whole cache lines per slot */
+    slot_bytes = sizeof(spectrum_shm_slot_t) + (sizeof(float) * _bin_count_max);
+    slot_bytes = (slot_bytes + 63) & ~63;
+    shm->size = SPECTRUM_SHM_HEADER_BYTES + ((size_t)slot_bytes * SPECTRUM_SHM_SLOTS);
+
+    /* Readers still mapping an old object see it marked closed, and reopen by name */
+    shm_unlink(shm->name);
+    shm->fd = shm_open(shm->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(shm->fd < 0)
+    {
+        printf("shm_open(%s) failed: %s\n", shm->name, strerror(errno));
+        return 0;
+    }
+    if(ftruncate(shm->fd, shm->size) != 0)
+    {
+        printf("ftruncate(%s) failed: %s\n", shm->name, strerror(errno));
+        spectrum_shm_close(shm);
+        return 0;
+    }
+    shm->base = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, shm->fd, 0);
+    if(shm->base == MAP_FAILED)
+    {
+        printf("mmap(%s) failed: %s\n", shm->name, strerror(errno));
+        shm->base = NULL;
+        spectrum_shm_close(shm);
+        return 0;
+    }
+
+    shm->header = (spectrum_shm_header_t *)shm->base;
+    shm->header->version = SPECTRUM_SHM_VERSION;
+    shm->header->writer_pid = getpid();
+    shm->header->slot_count = SPECTRUM_SHM_SLOTS;
+    shm->header->slot_bytes = slot_bytes;
+    shm->header->bin_count_max = _bin_count_max;
+    shm->header->head = 0;
+    shm->header->state = SPECTRUM_SHM_RUNNING;
+    /* Readers check the magic last */
+    __atomic_store_n(&shm->header->magic, SPECTRUM_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+void spectrum_shm_publish(spectrum_shm_t *shm, const float *bins, uint32_t _bin_count, uint32_t _flags,
+    uint64_t _sample_index, const struct timespec *timestamp,
+    uint64_t _freq_hz, uint32_t _sample_rate, uint32_t _fft_size, uint32_t _quality)
+{
+    spectrum_shm_header_t *header = shm->header;
+    const uint64_t sequence = header->head;
+    spectrum_shm_slot_t *slot = (spectrum_shm_slot_t *)&shm->base[SPECTRUM_SHM_HEADER_BYTES
+        + ((sequence % SPECTRUM_SHM_SLOTS) * header->slot_bytes)];
+
+    if(_bin_count > header->bin_count_max)
+    {
+        _bin_count = header->bin_count_max;
+    }
+
+    /* Seqlock odd, the fence keeps the slot writes after it */
+    __atomic_store_n(&slot->seqlock, slot->seqlock + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->flags = _flags;
+    slot->sequence = sequence;
+    slot->sample_index = _sample_index;
+    slot->timestamp_ns = (timestamp->tv_sec * 1000000000LL) + timestamp->tv_nsec;
+    slot->freq_hz = _freq_hz;
+    slot->sample_rate = _sample_rate;
+    slot->fft_size = _fft_size;
+    slot->bin_count = _bin_count;
+    slot->quality = _quality;
+    memcpy((uint8_t *)slot + sizeof(spectrum_shm_slot_t), bins, sizeof(float) * _bin_count);
+
+    /* Seqlock even again, then publish */
+    __atomic_store_n(&slot->seqlock, slot->seqlock + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->head, sequence + 1, __ATOMIC_RELEASE);
+
+    /* Read-only readers can't say they are waiting, so always wake (see spectrum_shm_layout.h) */
+    __atomic_add_fetch(&header->notify, 1, __ATOMIC_RELEASE);
+    futex_wake_all(&header->notify);
+}
+
+void spectrum_shm_close(spectrum_shm_t *shm)
+{
+    if(shm->header != NULL)
+    {
+        __atomic_store_n(&shm->header->state, SPECTRUM_SHM_CLOSED, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&shm->header->notify, 1, __ATOMIC_RELEASE);
+        futex_wake_all(&shm->header->notify);
+    }
+    if(shm->base != NULL)
+    {
+        munmap(shm->base, shm->size);
+        shm->base = NULL;
+        shm->header = NULL;
+    }
+    if(shm->fd >= 0)
+    {
+        close(shm->fd);
+        shm_unlink(shm->name);
+        shm->fd = -1;
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef SPECTRUM_SHM_H
+#define SPECTRUM_SHM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "spectrum_shm_layout.h"
+
+/* Shared memory spectrum ring, writer (see spectrum_shm_layout.h)
+ *
+ * Published by the FFT thread with no locks or allocation; readers never hold up the writer.
+ */
+
+/* Slots in the ring, a reader more than this far behind skips forward */
+#define SPECTRUM_SHM_SLOTS  64
+
+typedef struct {
+    char name[64];
+    int fd;
+    uint8_t *base;
+    size_t size;
+    spectrum_shm_header_t *header;
+} spectrum_shm_t;
+
+/* Create (replacing any stale object) and map "/airspy_fft_<_name>" for up to _bin_count_max bins.
+ *  Returns 1 on success. */
+uint8_t spectrum_shm_init(spectrum_shm_t *shm, const char *_name, uint32_t _bin_count_max);
+
+/* Publish one spectrum into the next slot, waking any waiting readers */
+void spectrum_shm_publish(spectrum_shm_t *shm, const float *bins, uint32_t _bin_count, uint32_t _flags,
+    uint64_t _sample_index, const struct timespec *timestamp,
+    uint64_t _freq_hz, uint32_t _sample_rate, uint32_t _fft_size, uint32_t _quality);
+
+/* Mark the ring closed for readers, unmap and unlink it */
+void spectrum_shm_close(spectrum_shm_t *shm);
+
+#endif /* SPECTRUM_SHM_H */
@@ -0,0 +1,87 @@
+#ifndef SPECTRUM_SHM_LAYOUT_H
+#define SPECTRUM_SHM_LAYOUT_H
+
+#include <stdint.h>
+
+/* Shared memory spectrum ring, memory layout
+ *
+ * Shared by the daemon (spectrum_shm.c) and local readers (spectrum_shm_reader.c), so this header
+ *  depends on nothing else in the tree. Each pipeline with .shm_spectrum set publishes into the POSIX
+ *  shared memory object "/airspy_fft_<pipeline name>" (ie. /dev/shm/airspy_fft_wb):
+ *
+ *  spectrum_shm_header_t                       one page
+ *  spectrum_shm_slot_t + float[bin_count]      slot_count times, each slot_bytes long
+ *
+ * Every FFT thread block publishes its mean power spectrum into the next slot, in dBFS across all
+ *  fft_size bins with bin 0 at the lowest frequency. This is the FFT thread's own output, ahead of the
+ *  display scaling, noise floor AGC and edge trimming applied to the websocket frames.
+ *
+ * Each slot is guarded by a seqlock: odd while the writer is in it, so a reader copies the slot and
+ *  then checks the lock is unchanged. head counts slots published, and notify is a futex word bumped
+ *  after each publish for readers that want to sleep until the next one.
+ *
+ * The object is created mode 0644 and readers map it read-only, so any local user can read it and
+ *  none can disturb it. Readers so can't register as waiting: the writer wakes notify on every
+ *  publish, one futex syscall per block that costs next to nothing when no one is asleep.
+ */
+
+#define SPECTRUM_SHM_MAGIC          0x4d485353  /* "SSHM" */
+#define SPECTRUM_SHM_VERSION        1
+
+#define SPECTRUM_SHM_NAME_PREFIX    "/airspy_fft_"
+
+#define SPECTRUM_SHM_HEADER_BYTES   4096
+
+/* spectrum_shm_header_t state */
+#define SPECTRUM_SHM_RUNNING        1
+/* Set when the daemon exits, a restarted daemon creates a new object under the same name */
+#define SPECTRUM_SHM_CLOSED         2
+
+/* spectrum_shm_slot_t flags */
+/* IQ blocks were lost, or the AirSpy retuned, between this slot and the one before */
+#define SPECTRUM_SHM_FLAG_DISCONTINUITY 0x0001
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t state;
+    uint32_t writer_pid;
+
+    uint32_t slot_count;
+    uint32_t slot_bytes;
+    /* Most bins in any slot */
+    uint32_t bin_count_max;
+    uint32_t reserved;
+
+    /* Slots published, slot (head - 1) % slot_count is the newest */
+    uint64_t head __attribute__((aligned(64)));
+    /* Futex word, incremented and woken after each publish */
+    uint32_t notify;
+    uint32_t reserved2;
+} spectrum_shm_header_t;
+
+typedef struct {
+    /* Odd while being written */
+    uint32_t seqlock;
+    uint32_t flags;
+    /* Slot number since the daemon started, matches head when published */
+    uint64_t sequence;
+    /* Index of the first IQ sample of the block, and its CLOCK_REALTIME in ns */
+    uint64_t sample_index;
+    int64_t timestamp_ns;
+
+    uint64_t freq_hz;
+    uint32_t sample_rate;
+    uint32_t fft_size;
+    /* Bin i is at freq_hz + ((i - fft_size/2) * sample_rate / fft_size) */
+    uint32_t bin_count;
+    /* FFT lines in this block as a percentage of the configured overlap's, see load_shed.h */
+    uint32_t quality;
+    uint32_t reserved[2];
+    /* float bins[bin_count] follow */
+} spectrum_shm_slot_t;
+
+_Static_assert(sizeof(spectrum_shm_header_t) <= SPECTRUM_SHM_HEADER_BYTES, "spectrum_shm_header_t too large");
+_Static_assert(sizeof(spectrum_shm_slot_t) % 16 == 0, "spectrum_shm_slot_t bins not aligned");
+
+#endif /* SPECTRUM_SHM_LAYOUT_H */
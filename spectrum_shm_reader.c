@@ -0,0 +1,182 @@
+#include "spectrum_shm_reader.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+int spectrum_shm_reader_open(spectrum_shm_reader_t *reader, const char *_name)
+{
+    char name[64];
+    struct stat st;
+
+    memset(reader, 0, sizeof(spectrum_shm_reader_t));
+    snprintf(name, sizeof(name), SPECTRUM_SHM_NAME_PREFIX "%s", _name);
+
+    reader->fd = shm_open(name, O_RDONLY, 0);
+    if(reader->fd < 0)
+    {
+        fprintf(stderr, "shm_open(%s) failed: %s\n", name, strerror(errno));
+        return 0;
+    }
+    if(fstat(reader->fd, &st) != 0 || (size_t)st.st_size < SPECTRUM_SHM_HEADER_BYTES)
+    {
+        fprintf(stderr, "%s: not a spectrum ring\n", name);
+        spectrum_shm_reader_close(reader);
+        return 0;
+    }
+    reader->size = st.st_size;
+
+    /* Read-only, the daemon's object is only writable by its own user */
+    reader->base = mmap(NULL, reader->size, PROT_READ, MAP_SHARED, reader->fd, 0);
+    if(reader->base == MAP_FAILED)
+    {
+        fprintf(stderr, "mmap(%s) failed: %s\n", name, strerror(errno));
+        reader->base = NULL;
+        spectrum_shm_reader_close(reader);
+        return 0;
+    }
+    reader->header = (const spectrum_shm_header_t *)reader->base;
+
+    if(__atomic_load_n(&reader->header->magic, __ATOMIC_ACQUIRE) != SPECTRUM_SHM_MAGIC
+        || reader->header->version != SPECTRUM_SHM_VERSION
+        || SPECTRUM_SHM_HEADER_BYTES + ((size_t)reader->header->slot_bytes * reader->header->slot_count) > reader->size)
+    {
+        fprintf(stderr, "%s: unknown layout (version %d)\n", name, reader->header->version);
+        spectrum_shm_reader_close(reader);
+        return 0;
+    }
+
+    /* Start from the newest slot */
+    reader->sequence = __atomic_load_n(&reader->header->head, __ATOMIC_ACQUIRE);
+    if(reader->sequence > 0)
+    {
+        reader->sequence--;
+    }
+
+    return 1;
+}
+
+void spectrum_shm_reader_close(spectrum_shm_reader_t *reader)
+{
+    if(reader->base != NULL)
+    {
+        munmap((void *)reader->base, reader->size);
+        reader->base = NULL;
+        reader->header = NULL;
+    }
+    if(reader->fd >= 0)
+    {
+        close(reader->fd);
+        reader->fd = -1;
+    }
+}
+
+int spectrum_shm_reader_wait(spectrum_shm_reader_t *reader, int32_t _timeout_ms)
+{
+    const spectrum_shm_header_t *header = reader->header;
+    struct timespec timeout;
+    uint32_t notify;
+    int result;
+
+    while(1)
+    {
+        if(__atomic_load_n(&header->state, __ATOMIC_ACQUIRE) != SPECTRUM_SHM_RUNNING)
+        {
+            return -1;
+        }
+
+        /* notify before head: a publish after this load changes notify, and FUTEX_WAIT then returns at once */
+        notify = __atomic_load_n(&header->notify, __ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&header->head, __ATOMIC_ACQUIRE) > reader->sequence)
+        {
+            return 1;
+        }
+
+        if(_timeout_ms >= 0)
+        {
+            timeout.tv_sec = _timeout_ms / 1000;
+            timeout.tv_nsec = (_timeout_ms % 1000) * 1000000;
+        }
+        result = syscall(SYS_futex, &header->notify, FUTEX_WAIT, notify, _timeout_ms >= 0 ? &timeout : NULL, NULL, 0);
+
+        if(result != 0 && errno == ETIMEDOUT)
+        {
+            return 0;
+        }
+        /* Woken, changed under us (EAGAIN) or interrupted: check again */
+    }
+}
+
+const spectrum_shm_slot_t *spectrum_shm_reader_next(spectrum_shm_reader_t *reader, const float **bins, uint32_t *seqlock)
+{
+    const spectrum_shm_header_t *header = reader->header;
+    const spectrum_shm_slot_t *slot;
+    uint64_t head;
+
+    while(1)
+    {
+        head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+        if(reader->sequence >= head)
+        {
+            return NULL;
+        }
+
+        /* Lapped, skip to the oldest slot the writer isn't about to reuse */
+        if(head - reader->sequence > header->slot_count - 1)
+        {
+            reader->skipped += (head - reader->sequence) - (header->slot_count - 1);
+            reader->sequence = head - (header->slot_count - 1);
+        }
+
+        slot = (const spectrum_shm_slot_t *)&reader->base[SPECTRUM_SHM_HEADER_BYTES
+            + ((reader->sequence % header->slot_count) * header->slot_bytes)];
+
+        *seqlock = __atomic_load_n(&slot->seqlock, __ATOMIC_ACQUIRE);
+        if((*seqlock & 1) == 0 && slot->sequence == reader->sequence)
+        {
+            *bins = (const float *)((const uint8_t *)slot + sizeof(spectrum_shm_slot_t));
+            reader->sequence++;
+            return slot;
+        }
+
+        /* Being rewritten, so we have been lapped since reading head */
+        reader->sequence++;
+        reader->skipped++;
+    }
+}
+
+int spectrum_shm_reader_valid(const spectrum_shm_slot_t *slot, uint32_t _seqlock)
+{
+    /* Order the caller's reads of the slot before re-reading the lock */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->seqlock, __ATOMIC_RELAXED) == _seqlock;
+}
+
+uint32_t spectrum_shm_reader_copy(spectrum_shm_reader_t *reader, spectrum_shm_slot_t *slot, float *bins, uint32_t _bins_max)
+{
+    const spectrum_shm_slot_t *shared;
+    const float *shared_bins;
+    uint32_t seqlock, count;
+
+    while((shared = spectrum_shm_reader_next(reader, &shared_bins, &seqlock)) != NULL)
+    {
+        memcpy(slot, shared, sizeof(spectrum_shm_slot_t));
+        count = slot->bin_count < _bins_max ? slot->bin_count : _bins_max;
+        memcpy(bins, shared_bins, sizeof(float) * count);
+
+        if(spectrum_shm_reader_valid(shared, seqlock))
+        {
+            return count;
+        }
+        reader->skipped++;
+    }
+
+    return 0;
+}
@@ -0,0 +1,63 @@
+#ifndef SPECTRUM_SHM_READER_H
+#define SPECTRUM_SHM_READER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "spectrum_shm_layout.h"
+
+/* Shared memory spectrum ring, reader library for local consumers
+ *
+ * Build with "make reader" and link libspectrum_shm_reader.a. Eg.
+ *
+ *   spectrum_shm_reader_t reader;
+ *   const spectrum_shm_slot_t *slot;
+ *   const float *bins;
+ *   uint32_t seqlock;
+ *
+ *   if(!spectrum_shm_reader_open(&reader, "wb")) ..
+ *   while(spectrum_shm_reader_wait(&reader, 1000) >= 0)
+ *   {
+ *       while((slot = spectrum_shm_reader_next(&reader, &bins, &seqlock)) != NULL)
+ *       {
+ *           .. use slot and bins in place ..
+ *           if(!spectrum_shm_reader_valid(slot, seqlock)) .. overwritten while in use, discard ..
+ *       }
+ *   }
+ *
+ * Slots are read in place (zero copy). A reader more than the ring behind skips forward, counting the
+ *  slots it lost in reader->skipped. If the daemon restarts, spectrum_shm_reader_wait() returns -1 and
+ *  the reader should close and reopen.
+ */
+
+typedef struct {
+    int fd;
+    const uint8_t *base;
+    size_t size;
+    const spectrum_shm_header_t *header;
+    /* Next slot to read */
+    uint64_t sequence;
+    uint64_t skipped;
+} spectrum_shm_reader_t;
+
+/* Map the ring of pipeline _name ("wb" for /airspy_fft_wb), starting at the newest slot. Returns 1 on success. */
+int spectrum_shm_reader_open(spectrum_shm_reader_t *reader, const char *_name);
+
+void spectrum_shm_reader_close(spectrum_shm_reader_t *reader);
+
+/* Sleep until a slot newer than reader->sequence is published, for up to _timeout_ms (-1 waits forever).
+ *  Returns 1 if there is a slot to read, 0 on timeout, -1 if the daemon has closed the ring. */
+int spectrum_shm_reader_wait(spectrum_shm_reader_t *reader, int32_t _timeout_ms);
+
+/* Next unread slot and its bins, or NULL if there are none. *seqlock is passed to spectrum_shm_reader_valid()
+ *  once the caller has finished with the slot. */
+const spectrum_shm_slot_t *spectrum_shm_reader_next(spectrum_shm_reader_t *reader, const float **bins, uint32_t *seqlock);
+
+/* True if the slot has not been rewritten since spectrum_shm_reader_next() returned it */
+int spectrum_shm_reader_valid(const spectrum_shm_slot_t *slot, uint32_t _seqlock);
+
+/* Copy the next unread slot into *slot and bins (up to _bins_max), retrying if it is rewritten during the copy.
+ *  Returns the number of bins copied, or 0 if there are no unread slots. */
+uint32_t spectrum_shm_reader_copy(spectrum_shm_reader_t *reader, spectrum_shm_slot_t *slot, float *bins, uint32_t _bins_max);
+
+#endif /* SPECTRUM_SHM_READER_H */